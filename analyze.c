@@ -0,0 +1,424 @@
+/*
+ *  analyze.c
+ *  Contains the static pipeline throughput analyzer
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analyze.h"
+#include "vector.h"
+
+/* Integer registers come first, vector registers after them */
+#define ANALYZE_REGS (16 + VECTOR_REGS)
+
+/* Writes of one register that can be in flight at once */
+#define ANALYZE_IN_FLIGHT 4
+
+/* Why an instruction decoded later than the cycle after its predecessor */
+enum
+{
+  WAIT_NONE,
+  WAIT_RAW,	// A source register was invalid
+  WAIT_FLAG,	// BZ/BNZ behind an arithmetic instruction
+  WAIT_MUL,	// Decode held while MUL takes its second EX cycle
+  WAIT_REDIRECT,	// Fetch redirected by the branch closing the loop
+  NUM_WAITS
+};
+
+static const char* wait_name[NUM_WAITS] = { "", "RAW", "flag", "MUL busy",
+                                            "redirect" };
+
+/* What decode() checks and updates for one instruction */
+typedef struct Hazards
+{
+  int srcs[2];
+  int num_srcs;
+  int dst;	// -1 if none
+  int arithmetic;	// Sets arithmetic_instr, so BZ/BNZ wait for it
+  int mul;
+  int flag;	// BZ/BNZ
+} Hazards;
+
+/* One instruction of one iteration as scheduled */
+typedef struct Slot
+{
+  int decode;	// Cycle decode accepted it
+  int writeback;	// Cycle its result became valid
+  int stall;
+  int wait;
+  int cause;	// Slot that delayed it, -1 if none
+} Slot;
+
+static void
+hazards_of(const APEX_Instruction* ins, Hazards* hz)
+{
+  const char* op = ins->opcode;
+
+  memset(hz, 0, sizeof(*hz));
+  hz->dst = -1;
+
+  if (strcmp(op, "STORE") == 0 || is_compare_branch(op)) {
+    hz->srcs[hz->num_srcs++] = ins->rs1;
+    hz->srcs[hz->num_srcs++] = ins->rs2;
+  } else if (strcmp(op, "LOAD") == 0) {
+    hz->srcs[hz->num_srcs++] = ins->rs1;
+    hz->dst = ins->rd;
+  } else if (strcmp(op, "MOVC") == 0) {
+    hz->dst = ins->rd;
+  } else if (strcmp(op, "ADD") == 0 || strcmp(op, "SUB") == 0 ||
+             strcmp(op, "MUL") == 0 || strcmp(op, "AND") == 0 ||
+             strcmp(op, "OR") == 0 || strcmp(op, "XOR") == 0) {
+    hz->srcs[hz->num_srcs++] = ins->rs1;
+    hz->srcs[hz->num_srcs++] = ins->rs2;
+    hz->dst = ins->rd;
+    hz->arithmetic = strcmp(op, "ADD") == 0 || strcmp(op, "SUB") == 0 ||
+                     strcmp(op, "MUL") == 0;
+    hz->mul = strcmp(op, "MUL") == 0;
+  } else if (strcmp(op, "LOOP") == 0) {
+    hz->srcs[hz->num_srcs++] = ins->rs1;
+  } else if (strcmp(op, "VLOAD") == 0) {
+    hz->srcs[hz->num_srcs++] = ins->rs1;
+    hz->dst = 16 + ins->rd;
+  } else if (strcmp(op, "VSTORE") == 0) {
+    hz->srcs[hz->num_srcs++] = 16 + ins->rs1;
+    hz->srcs[hz->num_srcs++] = ins->rs2;
+  } else if (is_vector_alu(op)) {
+    hz->srcs[hz->num_srcs++] = 16 + ins->rs1;
+    hz->srcs[hz->num_srcs++] = 16 + ins->rs2;
+    hz->dst = vector_writes_vreg(op) ? 16 + ins->rd : -1;
+  } else if (strcmp(op, "BZ") == 0 || strcmp(op, "BNZ") == 0) {
+    hz->flag = 1;
+  }
+
+  for (int i = 0; i < hz->num_srcs; ++i) {
+    if (hz->srcs[i] < 0 || hz->srcs[i] >= ANALYZE_REGS) {
+      hz->srcs[i--] = hz->srcs[--hz->num_srcs];
+    }
+  }
+  if (hz->dst >= ANALYZE_REGS) {
+    hz->dst = -1;
+  }
+}
+
+static int
+is_branch(const char* opcode)
+{
+  return strcmp(opcode, "BZ") == 0 || strcmp(opcode, "BNZ") == 0 ||
+         is_compare_branch(opcode);
+}
+
+/*
+ * Marks the first instruction of every basic block of code[0..n-1]
+ */
+void
+analyze_leaders(const APEX_Instruction* code, int n, unsigned char* leader)
+{
+  memset(leader, 0, n);
+  if (n) {
+    leader[0] = 1;
+  }
+  for (int i = 0; i < n; ++i) {
+    const APEX_Instruction* ins = &code[i];
+    int target = -1;
+
+    if (is_branch(ins->opcode)) {
+      target = i + ins->imm / 4;
+    } else if (strcmp(ins->opcode, "LOOP") == 0) {
+      target = i + 1 + ins->imm / 4;
+    } else if (strcmp(ins->opcode, "JUMP") != 0 &&
+               strcmp(ins->opcode, "HALT") != 0) {
+      continue;
+    }
+    if (target >= 0 && target < n) {
+      leader[target] = 1;
+    }
+    if (i + 1 < n) {
+      leader[i + 1] = 1;
+    }
+  }
+}
+
+/* Returns 1 if slot p has its result in flight at decode of cycle c */
+static int
+in_flight(const Slot* slots, int p, int c)
+{
+  return p >= 0 && slots[p].decode < c && slots[p].writeback > c;
+}
+
+/*
+ * Schedules iterations of the block code[0..n-1] and fills slots, one per
+ * instruction per iteration. Decode accepts an instruction in the first
+ * cycle, after its predecessor, in which decode() would not stall it.
+ * Returns the number of source reads accepted with more than one write
+ * of the register in flight, which see a stale value.
+ */
+static int
+schedule(const APEX_Instruction* code, int n, int kind, int iterations,
+         Slot* slots)
+{
+  int writers[ANALYZE_REGS][ANALYZE_IN_FLIGHT];
+  int arithmetic[ANALYZE_IN_FLIGHT];
+  int num_writes[ANALYZE_REGS] = { 0 };
+  int num_arithmetic = 0;
+  int prev = -1;
+  int stale = 0;
+
+  memset(writers, -1, sizeof(writers));
+  memset(arithmetic, -1, sizeof(arithmetic));
+
+  for (int it = 0; it < iterations; ++it) {
+    for (int k = 0; k < n; ++k) {
+      const APEX_Instruction* ins = &code[k];
+      Slot* slot = &slots[it * n + k];
+      Hazards hz;
+      int wait = WAIT_NONE;
+      int cause = prev;
+      int c;
+
+      hazards_of(ins, &hz);
+
+      /* Fetch at cycle 0, decode at cycle 1 */
+      if (prev < 0) {
+        c = 1;
+      } else {
+        Hazards before;
+        hazards_of(&code[(k + n - 1) % n], &before);
+        c = slots[prev].decode + 1;
+        if (before.mul) {
+          c++;
+          wait = WAIT_MUL;
+        }
+        if (k == 0 && kind == ANALYZE_BRANCH_LOOP) {
+          c += 2;
+          wait = WAIT_REDIRECT;
+        }
+      }
+      int earliest = prev < 0 ? c : slots[prev].decode + 1;
+
+      for (;; ++c) {
+        int blocker = -1;
+        int why = WAIT_NONE;
+
+        /* regs_valid reads as valid unless exactly one write is in
+         * flight, as in decode()
+         */
+        for (int s = 0; s < hz.num_srcs && blocker < 0; ++s) {
+          int pending = 0;
+          int last_writer = -1;
+          for (int w = 0; w < ANALYZE_IN_FLIGHT; ++w) {
+            int p = writers[hz.srcs[s]][w];
+            if (in_flight(slots, p, c)) {
+              pending++;
+              last_writer = p;
+            }
+          }
+          if (pending == 1) {
+            blocker = last_writer;
+            why = WAIT_RAW;
+          }
+        }
+        for (int a = 0; hz.flag && blocker < 0 && a < ANALYZE_IN_FLIGHT; ++a) {
+          if (in_flight(slots, arithmetic[a], c)) {
+            blocker = arithmetic[a];
+            why = WAIT_FLAG;
+          }
+        }
+
+        if (blocker < 0) {
+          break;
+        }
+        wait = why;
+        cause = blocker;
+      }
+
+      for (int s = 0; s < hz.num_srcs; ++s) {
+        int pending = 0;
+        for (int w = 0; w < ANALYZE_IN_FLIGHT; ++w) {
+          pending += in_flight(slots, writers[hz.srcs[s]][w], c);
+        }
+        stale += pending > 1;
+      }
+
+      slot->decode = c;
+      slot->writeback = c + 3 + hz.mul;
+      slot->stall = c - earliest;
+      slot->wait = slot->stall ? wait : WAIT_NONE;
+      slot->cause = cause;
+
+      int index = it * n + k;
+      if (hz.dst >= 0) {
+        writers[hz.dst][num_writes[hz.dst]++ % ANALYZE_IN_FLIGHT] = index;
+      }
+      if (hz.arithmetic) {
+        arithmetic[num_arithmetic++ % ANALYZE_IN_FLIGHT] = index;
+      }
+      prev = index;
+    }
+  }
+  return stale;
+}
+
+/* Prints the chain of waits that led to the last instruction of the last
+ * iteration, back to the same instruction one iteration earlier
+ */
+static void
+print_critical_chain(const APEX_Instruction* code, int first, int n,
+                     int iterations, const Slot* slots)
+{
+  int end = iterations * n - 1;
+  int stop = iterations > 1 ? end - n : 0;
+  int total = 0;
+  char text[64];
+
+  printf("  Critical chain:\n");
+  for (int s = end; s >= stop && s >= 0; s = slots[s].cause) {
+    if (slots[s].wait == WAIT_NONE) {
+      if (slots[s].cause < 0) {
+        break;
+      }
+      continue;
+    }
+    int c = slots[s].cause;
+    format_code(text, sizeof(text), &code[first + s % n]);
+    printf("    pc(%d) %-20s +%d %s", 4000 + 4 * (first + s % n), text,
+           slots[s].stall, wait_name[slots[s].wait]);
+    if (slots[s].wait == WAIT_RAW || slots[s].wait == WAIT_FLAG) {
+      printf(" on pc(%d)%s", 4000 + 4 * (first + c % n),
+             c / n < s / n ? " of the previous iteration" : "");
+    }
+    printf("\n");
+    total += slots[s].stall;
+  }
+  printf("    %d stall cycles on the chain\n", total);
+}
+
+static void
+report_block(const APEX_Instruction* code, int first, int last, int kind,
+             int iterations, const Slot* slots)
+{
+  static const char* kind_name[] = { "straight line", "branch loop",
+                                     "hardware loop" };
+  int n = last - first + 1;
+  int end = iterations * n - 1;
+  int cycles = slots[end].writeback - (slots[0].decode - 1) + 1;
+  char text[64];
+
+  printf("\nBlock pc(%d)..pc(%d), %s\n", 4000 + 4 * first, 4000 + 4 * last,
+         kind_name[kind]);
+  printf("  Iterations:        %d\n", iterations);
+  printf("  Instructions:      %d\n", iterations * n);
+  printf("  Total Cycles:      %d\n", cycles);
+  if (iterations > 1) {
+    double per = (double)(slots[end - n + 1].decode - slots[0].decode) /
+                 (iterations - 1);
+    printf("  Block RThroughput: %.2f cycles/iteration\n", per);
+    printf("  IPC:               %.2f\n", n / per);
+  } else {
+    printf("  IPC:               %.2f\n", (double)n / cycles);
+  }
+
+  printf("\n  %-9s %-20s %8s  %s\n", "pc", "Instruction", "Stalls", "Wait");
+  for (int k = 0; k < n; ++k) {
+    long stalls = 0;
+    int waits[NUM_WAITS] = { 0 };
+    for (int it = 0; it < iterations; ++it) {
+      stalls += slots[it * n + k].stall;
+      waits[slots[it * n + k].wait] += slots[it * n + k].stall;
+    }
+    int main_wait = WAIT_NONE;
+    for (int w = 1; w < NUM_WAITS; ++w) {
+      if (waits[w] > waits[main_wait]) {
+        main_wait = w;
+      }
+    }
+    format_code(text, sizeof(text), &code[first + k]);
+    printf("  pc(%d) %-20s %8.2f  %s\n", 4000 + 4 * (first + k), text,
+           (double)stalls / iterations, wait_name[main_wait]);
+  }
+  printf("\n");
+  print_critical_chain(code, first, n, iterations, slots);
+}
+
+/*
+ * Returns how the block code[first..last] repeats
+ */
+int
+analyze_block_kind(const APEX_Instruction* code, int first, int last)
+{
+  const APEX_Instruction* end = &code[last];
+
+  if (is_branch(end->opcode) && last + end->imm / 4 == first) {
+    return ANALYZE_BRANCH_LOOP;
+  }
+  if (first > 0 && strcmp(code[first - 1].opcode, "LOOP") == 0 &&
+      code[first - 1].imm == 4 * (last - first + 1)) {
+    return ANALYZE_HARDWARE_LOOP;
+  }
+  return ANALYZE_STRAIGHT;
+}
+
+/*
+ * Schedules iterations of the block code[0..n-1], of the given kind, and
+ * returns its timing. Returns -1 if out of memory.
+ */
+int
+analyze_timing(const APEX_Instruction* code, int n, int kind, int iterations,
+               APEX_Timing* timing)
+{
+  memset(timing, 0, sizeof(*timing));
+  if (n < 1 || iterations < 1) {
+    return 0;
+  }
+
+  Slot* slots = malloc(sizeof(*slots) * iterations * n);
+  if (!slots) {
+    return -1;
+  }
+  timing->stale_reads = schedule(code, n, kind, iterations, slots);
+  timing->last_decode = slots[iterations * n - 1].decode;
+  timing->cycles = slots[iterations * n - 1].writeback + 1;
+  free(slots);
+  return 0;
+}
+
+/*
+ * Splits code memory into basic blocks and prints the schedule of each.
+ * Loops run for the given number of iterations, other blocks once.
+ */
+int
+analyze_program(APEX_CPU* cpu, int iterations)
+{
+  int n = cpu->code_memory_size;
+  unsigned char* leader = calloc(n ? n : 1, 1);
+  if (!leader) {
+    return -1;
+  }
+  if (iterations < 1) {
+    iterations = ANALYZE_DEFAULT_ITERATIONS;
+  }
+  analyze_leaders(cpu->code_memory, n, leader);
+
+  printf("\n(apex) >> Static analysis of %d instructions\n", n);
+  for (int first = 0; first < n;) {
+    int last = first;
+    while (last + 1 < n && !leader[last + 1]) {
+      last++;
+    }
+
+    int kind = analyze_block_kind(cpu->code_memory, first, last);
+    int runs = kind == ANALYZE_STRAIGHT ? 1 : iterations;
+
+    Slot* slots = malloc(sizeof(*slots) * runs * (last - first + 1));
+    if (!slots) {
+      free(leader);
+      return -1;
+    }
+    schedule(cpu->code_memory + first, last - first + 1, kind, runs, slots);
+    report_block(cpu->code_memory, first, last, kind, runs, slots);
+    free(slots);
+    first = last + 1;
+  }
+  free(leader);
+  return 0;
+}
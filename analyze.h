@@ -0,0 +1,46 @@
+#ifndef _APEX_ANALYZE_H_
+#define _APEX_ANALYZE_H_
+/**
+ *  analyze.h
+ *  Static throughput analysis of the basic blocks in code memory.
+ *
+ *  Each block is scheduled on a timing model of the pipeline that applies
+ *  the hazard rules of decode(): RAW on the valid counts, the second EX
+ *  cycle of MUL, BZ/BNZ waiting for arithmetic instructions in flight and
+ *  the two cycle redirect of a taken branch. Loops are unrolled for a
+ *  number of iterations. No instruction is executed.
+ */
+#include "cpu.h"
+
+#define ANALYZE_DEFAULT_ITERATIONS 100
+
+/* How the end of a block leads into its next iteration */
+enum
+{
+  ANALYZE_STRAIGHT,	// Runs once
+  ANALYZE_BRANCH_LOOP,	// Closed by a backward branch to its first instruction
+  ANALYZE_HARDWARE_LOOP	// The body of a LOOP instruction
+};
+
+/* Timing of a block as scheduled by the model, from fetch at cycle 0 */
+typedef struct APEX_Timing
+{
+  int last_decode;	// Cycle the last instruction is decoded
+  int cycles;		// Cycles up to the last writeback
+  int stale_reads;	// Reads of a register with two writes in flight
+} APEX_Timing;
+
+int
+analyze_program(APEX_CPU* cpu, int iterations);
+
+void
+analyze_leaders(const APEX_Instruction* code, int n, unsigned char* leader);
+
+int
+analyze_block_kind(const APEX_Instruction* code, int first, int last);
+
+int
+analyze_timing(const APEX_Instruction* code, int n, int kind, int iterations,
+               APEX_Timing* timing);
+
+#endif
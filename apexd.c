@@ -0,0 +1,64 @@
+/*
+ *  apexd.c
+ *  Serves simulation jobs on a Unix domain socket, see server.h
+ */
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "server.h"
+
+static const char* socket_path;
+
+static void
+stop(int sig)
+{
+  (void)sig;
+  unlink(socket_path);
+  _exit(0);
+}
+
+int
+main(int argc, char const* argv[])
+{
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int cache_entries = SERVER_DEFAULT_CACHE;
+
+  if (argc < 2) {
+    fprintf(stderr, "APEX_Help : Usage %s <socket_path> [--threads=<n>] "
+                    "[--programs=<cached programs>]\n",
+            argv[0]);
+    exit(1);
+  }
+  for (int i = 2; i < argc; ++i) {
+    if (strncmp(argv[i], "--threads=", 10) == 0) {
+      threads = atoi(argv[i] + 10);
+    } else if (strncmp(argv[i], "--programs=", 11) == 0) {
+      cache_entries = atoi(argv[i] + 11);
+    } else {
+      fprintf(stderr, "APEX_Error : Unknown option %s\n", argv[i]);
+      exit(1);
+    }
+  }
+
+  socket_path = argv[1];
+  APEX_Server* server = server_create(socket_path, threads > 0 ? threads : 1,
+                                      cache_entries);
+  if (!server) {
+    fprintf(stderr, "APEX_Error : Unable to serve on %s\n", socket_path);
+    exit(1);
+  }
+
+  /* A client that goes away must not take the server with it */
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  fprintf(stderr, "APEX_CPU : Serving on %s with %d threads\n", socket_path,
+          threads > 0 ? threads : 1);
+  server_run(server);
+  fprintf(stderr, "APEX_Error : Unable to accept connections\n");
+  unlink(socket_path);
+  return 1;
+}
@@ -0,0 +1,388 @@
+/*
+ *  barrel.c
+ *  Contains the thread contexts, context switching and fetch policies of
+ *  barrel multithreading
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "barrel.h"
+#include "dmem.h"
+#include "vector.h"
+
+/* Architectural and per-thread control state, swapped in and out of the cpu */
+#define THREAD_FIELDS                                                          \
+  X(pc)                                                                        \
+  X(zero)                                                                      \
+  X(ex_halt)                                                                   \
+  X(regs)                                                                      \
+  X(regs_valid)                                                                \
+  X(buff_valid)                                                                \
+  X(vregs)                                                                     \
+  X(vregs_valid)                                                               \
+  X(code_memory)                                                               \
+  X(code_memory_size)                                                          \
+  X(ins_completed)                                                             \
+  X(retired)                                                                   \
+  X(vector_completed)                                                          \
+  X(loop_active)                                                               \
+  X(loop_start)                                                                \
+  X(loop_end)                                                                  \
+  X(loop_count)                                                                \
+  X(loop_iterations)                                                           \
+  X(loop_buffer_fetches)                                                       \
+  X(force_branch)
+
+typedef struct APEX_Thread
+{
+#define X(field) __typeof__(((APEX_CPU*)0)->field) field;
+  THREAD_FIELDS
+#undef X
+  APEX_Instruction loop_buffer[LOOP_BUFFER_SIZE];
+
+  int fetched;		// Fetch slots used
+  int finish_clock;	// Cycle the thread retired HALT, 0 while running
+} APEX_Thread;
+
+struct APEX_Barrel
+{
+  APEX_CPU* cpu;
+  APEX_Thread threads[BARREL_MAX_THREADS];
+  int num_threads;
+  int policy;
+  int next;		// Next thread in the fetch rotation
+  int idle_slots;	// Fetch slots no thread could use
+};
+
+static void
+save_thread(APEX_Barrel* b)
+{
+  APEX_CPU* cpu = b->cpu;
+  APEX_Thread* t = &b->threads[cpu->thread];
+
+#define X(field) memcpy(&t->field, &cpu->field, sizeof(t->field));
+  THREAD_FIELDS
+#undef X
+  if (cpu->loop_active) {
+    memcpy(t->loop_buffer, cpu->loop_buffer, sizeof(t->loop_buffer));
+  }
+}
+
+/* Loads the context of thread id into the cpu, saving the current one */
+static void
+switch_thread(APEX_Barrel* b, int id)
+{
+  APEX_CPU* cpu = b->cpu;
+  if (id == cpu->thread) {
+    return;
+  }
+
+  save_thread(b);
+  APEX_Thread* t = &b->threads[id];
+#define X(field) memcpy(&cpu->field, &t->field, sizeof(t->field));
+  THREAD_FIELDS
+#undef X
+  if (t->loop_active) {
+    memcpy(cpu->loop_buffer, t->loop_buffer, sizeof(t->loop_buffer));
+  }
+  cpu->thread = id;
+}
+
+static int
+thread_done(APEX_Thread* t)
+{
+  return t->ins_completed == t->code_memory_size;
+}
+
+static int
+is_redirect(const char* opcode)
+{
+  return strcmp(opcode, "BZ") == 0 || strcmp(opcode, "BNZ") == 0 ||
+         strcmp(opcode, "JUMP") == 0 || is_compare_branch(opcode);
+}
+
+/* Returns 1 if an instruction of thread id in the given stage is still
+ * in front of memory(), where redirects take effect
+ */
+static int
+in_flight(APEX_CPU* cpu, int stage, int id)
+{
+  return cpu->stage[stage].tid == id && strcmp(cpu->stage[stage].opcode, "");
+}
+
+/*
+ * Returns 1 if the next instruction of thread id can be fetched without
+ * stalling decode or being flushed: no unresolved branch or JUMP of the
+ * thread ahead of it, and all its sources valid.
+ */
+static int
+thread_ready(APEX_Barrel* b, int id)
+{
+  APEX_CPU* cpu = b->cpu;
+  APEX_Thread* t = &b->threads[id];
+
+  for (int s = DRF; s <= MEM; ++s) {
+    if (s == DRF && !cpu->stage[DRF].stalled) {
+      continue;	// already copied on to EX by decode
+    }
+    if (in_flight(cpu, s, id)) {
+      if (is_redirect(cpu->stage[s].opcode)) {
+        return 0;
+      }
+      if (cpu->stage[s].arithmetic_instr && s != DRF) {
+        /* BZ/BNZ wait for it in decode */
+        int index = get_code_index(t->pc);
+        if (index >= 0 && index < t->code_memory_size &&
+            (strcmp(t->code_memory[index].opcode, "BZ") == 0 ||
+             strcmp(t->code_memory[index].opcode, "BNZ") == 0)) {
+          return 0;
+        }
+      }
+    }
+  }
+
+  int index = get_code_index(t->pc);
+  if (index < 0 || index >= t->code_memory_size) {
+    return 1;
+  }
+
+  APEX_Instruction* ins = &t->code_memory[index];
+  const char* op = ins->opcode;
+
+  if (strcmp(op, "VSTORE") == 0) {
+    return t->vregs_valid[ins->rs1] && t->regs_valid[ins->rs2];
+  }
+  if (is_vector_alu(op)) {
+    return t->vregs_valid[ins->rs1] && t->vregs_valid[ins->rs2];
+  }
+  if (strcmp(op, "LOAD") == 0 || strcmp(op, "LOOP") == 0 ||
+      strcmp(op, "VLOAD") == 0) {
+    return t->regs_valid[ins->rs1];
+  }
+  if (strcmp(op, "STORE") == 0 || strcmp(op, "ADD") == 0 ||
+      strcmp(op, "SUB") == 0 || strcmp(op, "MUL") == 0 ||
+      strcmp(op, "AND") == 0 || strcmp(op, "OR") == 0 ||
+      strcmp(op, "XOR") == 0 || is_compare_branch(op)) {
+    return t->regs_valid[ins->rs1] && t->regs_valid[ins->rs2];
+  }
+  return 1;
+}
+
+/* Returns 1 if fetch can hand a new instruction to decode this cycle */
+static int
+front_end_free(APEX_CPU* cpu)
+{
+  return !cpu->stage[F].busy && !cpu->stage[F].stalled &&
+         !cpu->stage[DRF].stalled;
+}
+
+/* Picks the thread to fetch for this cycle, or -1 for a bubble */
+static int
+pick_thread(APEX_Barrel* b)
+{
+  int n = b->num_threads;
+
+  if (b->policy == FETCH_ROUND_ROBIN) {
+    int id = b->next;
+    b->next = (b->next + 1) % n;
+    if (thread_done(&b->threads[id]) || b->threads[id].ex_halt) {
+      return -1;
+    }
+    return id;
+  }
+
+  for (int i = 0; i < n; ++i) {
+    int id = (b->next + i) % n;
+    APEX_Thread* t = &b->threads[id];
+    if (!thread_done(t) && !t->ex_halt && thread_ready(b, id)) {
+      if (front_end_free(b->cpu)) {
+        b->next = (id + 1) % n;
+      }
+      return id;
+    }
+  }
+  return -1;
+}
+
+/* Fetch slot with no instruction: passes a bubble to decode */
+static void
+idle_fetch(APEX_Barrel* b)
+{
+  APEX_CPU* cpu = b->cpu;
+  if (front_end_free(cpu)) {
+    memset(&cpu->stage[F], 0, sizeof(cpu->stage[F]));
+    cpu->stage[DRF] = cpu->stage[F];
+  }
+  b->idle_slots++;
+}
+
+static void
+barrel_cycle(APEX_Barrel* b)
+{
+  APEX_CPU* cpu = b->cpu;
+
+  switch_thread(b, cpu->stage[WB].tid);
+  writeback(cpu);
+  switch_thread(b, cpu->stage[MEM].tid);
+  memory(cpu);
+  switch_thread(b, cpu->stage[EX].tid);
+  execute(cpu);
+  switch_thread(b, cpu->stage[DRF].tid);
+  decode(cpu);
+
+  save_thread(b);
+  int id = pick_thread(b);
+  if (id < 0) {
+    idle_fetch(b);
+  } else {
+    if (front_end_free(cpu)) {
+      b->threads[id].fetched++;
+    } else {
+      b->idle_slots++;
+    }
+    switch_thread(b, id);
+    fetch(cpu);
+  }
+
+  cpu->clock++;
+  save_thread(b);
+  for (int i = 0; i < b->num_threads; ++i) {
+    APEX_Thread* t = &b->threads[i];
+    if (!t->finish_clock && thread_done(t)) {
+      t->finish_clock = cpu->clock;
+    }
+  }
+}
+
+static int
+barrel_done(APEX_Barrel* b)
+{
+  if (b->cpu->clock == b->cpu->no_cycles) {
+    return 1;
+  }
+  for (int i = 0; i < b->num_threads; ++i) {
+    if (!thread_done(&b->threads[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void
+init_thread(APEX_Thread* t, APEX_Instruction* code, int size)
+{
+  memset(t, 0, sizeof(*t));
+  t->pc = 4000;
+  for (int i = 0; i < 16; i++) {
+    t->regs_valid[i] = 1;
+  }
+  for (int i = 0; i < VECTOR_REGS; i++) {
+    t->vregs_valid[i] = 1;
+  }
+  t->code_memory = code;
+  t->code_memory_size = size;
+}
+
+/*
+ * Turns a freshly initialized cpu into a barrel core. The cpu's own
+ * program is thread 0 and each program file adds one more thread.
+ */
+APEX_Barrel*
+barrel_create(APEX_CPU* cpu, const char** programs, int num_programs,
+              int policy)
+{
+  if (num_programs + 1 > BARREL_MAX_THREADS) {
+    return NULL;
+  }
+
+  APEX_Barrel* b = calloc(1, sizeof(*b));
+  if (!b) {
+    return NULL;
+  }
+  b->cpu = cpu;
+  b->policy = policy;
+  b->num_threads = num_programs + 1;
+
+  cpu->thread = 0;
+  save_thread(b);
+  for (int i = 1; i < b->num_threads; ++i) {
+    int size = 0;
+    APEX_Instruction* code = create_code_memory(programs[i - 1], &size);
+    if (!code) {
+      b->num_threads = i;
+      barrel_destroy(b);
+      return NULL;
+    }
+    init_thread(&b->threads[i], code, size);
+  }
+
+  cpu->barrel = b;
+  return b;
+}
+
+int
+barrel_run(APEX_Barrel* b)
+{
+  while (!barrel_done(b)) {
+    barrel_cycle(b);
+  }
+  return 0;
+}
+
+void
+barrel_print(APEX_Barrel* b)
+{
+  APEX_CPU* cpu = b->cpu;
+  int retired = 0;
+
+  save_thread(b);
+  printf("\n(apex) >> Barrel Simulation Complete: %d threads, %s fetch, "
+         "%d cycles\n",
+         b->num_threads,
+         b->policy == FETCH_ROUND_ROBIN ? "round-robin" : "skip-stalled",
+         cpu->clock);
+
+  for (int i = 0; i < b->num_threads; ++i) {
+    APEX_Thread* t = &b->threads[i];
+    int cycles = t->finish_clock ? t->finish_clock : cpu->clock;
+    retired += t->retired;
+
+    printf("\n=====THREAD %d: %d instructions, %d cycles, IPC %.3f, "
+           "%d fetch slots============\n",
+           i, t->retired, cycles, cycles ? (double)t->retired / cycles : 0.0,
+           t->fetched);
+    for (int j = 0; j < 16; j++) {
+      printf(" | Register[%d] | Value=%d | status=%s | \n", j, t->regs[j],
+             (t->regs_valid[j]) ? "Valid" : "Invalid");
+    }
+  }
+
+  printf("\n(apex) >> Aggregate: %d instructions, IPC %.3f, %d idle fetch "
+         "slots\n",
+         retired, cpu->clock ? (double)retired / cpu->clock : 0.0,
+         b->idle_slots);
+  printf("=======DATA MEMORY===========\n");
+  for (int i = 0; i < 99; i++) {
+    printf(" | MEM[%d] | Value=%d | \n", i, dmem_read(cpu, i));
+  }
+}
+
+/*
+ * Frees the extra thread programs and leaves thread 0 loaded in the cpu,
+ * so APEX_cpu_stop frees the cpu as usual
+ */
+void
+barrel_destroy(APEX_Barrel* b)
+{
+  APEX_CPU* cpu = b->cpu;
+
+  if (cpu->barrel == b) {
+    switch_thread(b, 0);
+    cpu->barrel = NULL;
+  }
+  for (int i = 1; i < b->num_threads; ++i) {
+    free(b->threads[i].code_memory);
+  }
+  free(b);
+}
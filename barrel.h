@@ -0,0 +1,40 @@
+#ifndef _APEX_BARREL_H_
+#define _APEX_BARREL_H_
+/**
+ *  barrel.h
+ *  Fine-grained (barrel) multithreading: several hardware thread contexts,
+ *  each with its own program, pc, registers, valid bits and zero flag,
+ *  share the five pipeline stages and data memory of one APEX_CPU.
+ *
+ *  Every latch carries the id of the thread that fetched it, and each
+ *  stage runs with the context of that thread loaded. Fetch picks one
+ *  thread per cycle, so instructions of independent threads fill the
+ *  bubbles a single thread leaves behind RAW stalls and branch flushes.
+ */
+#include "cpu.h"
+
+#define BARREL_MAX_THREADS 8
+
+/* Fetch policies */
+enum
+{
+  FETCH_ROUND_ROBIN,	// Fixed rotation, a thread that can not fetch loses its slot
+  FETCH_SKIP_STALLED	// Rotation that passes over threads that would stall
+};
+
+typedef struct APEX_Barrel APEX_Barrel;
+
+APEX_Barrel*
+barrel_create(APEX_CPU* cpu, const char** programs, int num_programs,
+              int policy);
+
+int
+barrel_run(APEX_Barrel* barrel);
+
+void
+barrel_print(APEX_Barrel* barrel);
+
+void
+barrel_destroy(APEX_Barrel* barrel);
+
+#endif
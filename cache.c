@@ -0,0 +1,357 @@
+/*
+ *  cache.c
+ *  Contains the content-addressed result cache
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "checkpoint.h"
+#include "dmem.h"
+#include "hash.h"
+#include "steady.h"
+
+#define CACHE_MAGIC 0x41505253u	// "APRS"
+
+/* Bump whenever a change to the pipeline can change results */
+#define CACHE_MODEL_VERSION 3
+
+#define CACHE_LOCK ".lock"
+
+struct APEX_Cache
+{
+  char* dir;
+  long max_bytes;
+  uint64_t key;
+  uint64_t check;	// Second hash, guards against key collisions
+};
+
+/* Final state of a run, followed by num_words (address, value) pairs */
+typedef struct CacheResult
+{
+  uint32_t magic;
+  uint32_t cpu_size;
+  uint64_t check;
+  int clock;
+  int ins_completed;
+  int retired;
+  int vector_completed;
+  int loop_iterations;
+  int loop_buffer_fetches;
+  int fused[FUSE_KINDS];
+  int fetches;
+  int fetch_words;
+  int regs[16];
+  int regs_valid[16];
+  int vregs[VECTOR_REGS][VECTOR_LANES];
+  int vregs_valid[VECTOR_REGS];
+  int num_words;
+} CacheResult;
+
+typedef struct CacheFile
+{
+  char* path;
+  off_t size;
+  time_t mtime;
+} CacheFile;
+
+/* Hashes every input of a run of cpu from its current (initial) state */
+static uint64_t
+hash_inputs(APEX_CPU* cpu, uint64_t hash)
+{
+  static const int model[] = { CACHE_MODEL_VERSION, DATA_MEMORY_SIZE,
+                               VECTOR_REGS, VECTOR_LANES, LOOP_BUFFER_SIZE };
+
+  hash = hash_bytes(hash, model, sizeof(model));
+  hash = hash_code(hash, cpu->code_memory, cpu->code_memory_size,
+                   cpu->code_memory_size);
+  hash = hash_bytes(hash, &cpu->no_cycles, sizeof(cpu->no_cycles));
+  hash = hash_bytes(hash, &cpu->pc, sizeof(cpu->pc));
+  hash = hash_bytes(hash, cpu->regs, sizeof(cpu->regs));
+  hash = hash_bytes(hash, &cpu->force_branch, sizeof(cpu->force_branch));
+  hash = hash_bytes(hash, cpu->stage_extra, sizeof(cpu->stage_extra));
+  hash = hash_bytes(hash, &cpu->fuse, sizeof(cpu->fuse));
+  hash = hash_bytes(hash, &cpu->compressed, sizeof(cpu->compressed));
+  for (int i = 0; i < DATA_MEMORY_SIZE; ++i) {
+    int value = dmem_read(cpu, i);
+    if (value) {
+      hash = hash_bytes(hash, &i, sizeof(i));
+      hash = hash_bytes(hash, &value, sizeof(value));
+    }
+  }
+  return hash;
+}
+
+static char*
+path_of(APEX_Cache* cache, const char* name)
+{
+  size_t size = strlen(cache->dir) + strlen(name) + 2;
+  char* path = malloc(size);
+  if (path) {
+    snprintf(path, size, "%s/%s", cache->dir, name);
+  }
+  return path;
+}
+
+static char*
+result_path(APEX_Cache* cache)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "%016" PRIx64 ".res", cache->key);
+  return path_of(cache, name);
+}
+
+/*
+ * Loads the cached result for the cpu's inputs, if there is one. A hit
+ * marks the entry as recently used.
+ */
+static int
+lookup(APEX_Cache* cache, APEX_CPU* cpu)
+{
+  char* path = result_path(cache);
+  FILE* fp = path ? fopen(path, "rb") : NULL;
+  CacheResult result;
+  int hit = 0;
+
+  if (fp) {
+    hit = fread(&result, sizeof(result), 1, fp) == 1 &&
+          result.magic == CACHE_MAGIC &&
+          result.cpu_size == sizeof(APEX_CPU) && result.check == cache->check;
+  }
+
+  int (*words)[2] = NULL;
+  if (hit) {
+    words = malloc((result.num_words ? result.num_words : 1) * sizeof(*words));
+    hit = words && fread(words, sizeof(*words), result.num_words, fp) ==
+                     (size_t)result.num_words;
+  }
+
+  if (hit) {
+    dmem_release(cpu);
+    for (int i = 0; i < result.num_words; ++i) {
+      dmem_write(cpu, words[i][0], words[i][1]);
+    }
+    cpu->clock = result.clock;
+    cpu->ins_completed = result.ins_completed;
+    cpu->retired = result.retired;
+    cpu->vector_completed = result.vector_completed;
+    cpu->loop_iterations = result.loop_iterations;
+    cpu->loop_buffer_fetches = result.loop_buffer_fetches;
+    memcpy(cpu->fused, result.fused, sizeof(cpu->fused));
+    cpu->fetches = result.fetches;
+    cpu->fetch_words = result.fetch_words;
+    memcpy(cpu->regs, result.regs, sizeof(cpu->regs));
+    memcpy(cpu->regs_valid, result.regs_valid, sizeof(cpu->regs_valid));
+    memcpy(cpu->vregs, result.vregs, sizeof(cpu->vregs));
+    memcpy(cpu->vregs_valid, result.vregs_valid, sizeof(cpu->vregs_valid));
+    utimes(path, NULL);
+  }
+
+  if (fp) {
+    fclose(fp);
+  }
+  free(words);
+  free(path);
+  return hit;
+}
+
+static int
+older_first(const void* a, const void* b)
+{
+  const CacheFile* x = a;
+  const CacheFile* y = b;
+  return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+/*
+ * Removes the least recently used results until the cache fits in its
+ * size bound. Runs under an exclusive lock so that processes sharing the
+ * cache do not evict concurrently; readers need no lock because a result
+ * that is unlinked while open stays readable.
+ */
+static void
+evict(APEX_Cache* cache)
+{
+  char* lock_path = path_of(cache, CACHE_LOCK);
+  int lock = lock_path ? open(lock_path, O_RDWR | O_CREAT, 0666) : -1;
+  free(lock_path);
+  if (lock < 0) {
+    return;
+  }
+  flock(lock, LOCK_EX);
+
+  DIR* dir = opendir(cache->dir);
+  CacheFile* files = NULL;
+  int num_files = 0;
+  int cap = 0;
+  long total = 0;
+  struct dirent* entry;
+
+  while (dir && (entry = readdir(dir))) {
+    size_t len = strlen(entry->d_name);
+    struct stat st;
+    if (len < 5 || strcmp(entry->d_name + len - 4, ".res")) {
+      continue;
+    }
+    char* path = path_of(cache, entry->d_name);
+    if (!path || stat(path, &st)) {
+      free(path);
+      continue;
+    }
+    if (num_files == cap) {
+      cap = cap ? 2 * cap : 64;
+      CacheFile* grown = realloc(files, cap * sizeof(*files));
+      if (!grown) {
+        free(path);
+        break;
+      }
+      files = grown;
+    }
+    files[num_files].path = path;
+    files[num_files].size = st.st_size;
+    files[num_files].mtime = st.st_mtime;
+    num_files++;
+    total += st.st_size;
+  }
+  if (dir) {
+    closedir(dir);
+  }
+
+  qsort(files, num_files, sizeof(*files), older_first);
+  for (int i = 0; i < num_files; ++i) {
+    if (total > cache->max_bytes && unlink(files[i].path) == 0) {
+      total -= files[i].size;
+    }
+    free(files[i].path);
+  }
+  free(files);
+
+  flock(lock, LOCK_UN);
+  close(lock);
+}
+
+/*
+ * Stores the final state of the cpu. The file is written under a
+ * temporary name and renamed into place, so readers never see a partial
+ * result.
+ */
+static void
+store(APEX_Cache* cache, APEX_CPU* cpu)
+{
+  CacheResult result;
+  memset(&result, 0, sizeof(result));
+  result.magic = CACHE_MAGIC;
+  result.cpu_size = sizeof(APEX_CPU);
+  result.check = cache->check;
+  result.clock = cpu->clock;
+  result.ins_completed = cpu->ins_completed;
+  result.retired = cpu->retired;
+  result.vector_completed = cpu->vector_completed;
+  result.loop_iterations = cpu->loop_iterations;
+  result.loop_buffer_fetches = cpu->loop_buffer_fetches;
+  memcpy(result.fused, cpu->fused, sizeof(cpu->fused));
+  result.fetches = cpu->fetches;
+  result.fetch_words = cpu->fetch_words;
+  memcpy(result.regs, cpu->regs, sizeof(cpu->regs));
+  memcpy(result.regs_valid, cpu->regs_valid, sizeof(cpu->regs_valid));
+  memcpy(result.vregs, cpu->vregs, sizeof(cpu->vregs));
+  memcpy(result.vregs_valid, cpu->vregs_valid, sizeof(cpu->vregs_valid));
+  for (int i = 0; i < DATA_MEMORY_SIZE; ++i) {
+    if (dmem_read(cpu, i)) {
+      result.num_words++;
+    }
+  }
+
+  char tmp_name[64];
+  snprintf(tmp_name, sizeof(tmp_name), ".tmp.%d", (int)getpid());
+  char* tmp = path_of(cache, tmp_name);
+  char* path = result_path(cache);
+  FILE* fp = tmp ? fopen(tmp, "wb") : NULL;
+
+  if (fp) {
+    int ok = fwrite(&result, sizeof(result), 1, fp) == 1;
+    for (int i = 0; ok && i < DATA_MEMORY_SIZE; ++i) {
+      int word[2] = { i, dmem_read(cpu, i) };
+      if (word[1]) {
+        ok = fwrite(word, sizeof(word), 1, fp) == 1;
+      }
+    }
+    if (fclose(fp) || !ok || !path || rename(tmp, path)) {
+      unlink(tmp);
+    }
+  }
+  free(tmp);
+  free(path);
+  evict(cache);
+}
+
+/*
+ * Attaches a result cache to a freshly initialized cpu, creating the
+ * directory if needed. The key is taken now, from the initial state.
+ */
+APEX_Cache*
+cache_open(APEX_CPU* cpu, const char* dir, long max_bytes)
+{
+  if (mkdir(dir, 0777) && errno != EEXIST) {
+    return NULL;
+  }
+
+  APEX_Cache* cache = calloc(1, sizeof(*cache));
+  if (!cache) {
+    return NULL;
+  }
+  cache->dir = strdup(dir);
+  if (!cache->dir) {
+    free(cache);
+    return NULL;
+  }
+  cache->max_bytes = max_bytes > 0 ? max_bytes : CACHE_DEFAULT_SIZE;
+  cache->key = hash_inputs(cpu, HASH_SEED);
+  cache->check = hash_inputs(cpu, ~HASH_SEED);
+  cpu->cache = cache;
+  return cache;
+}
+
+/*
+ * Returns the cached result of the run if there is one, otherwise runs
+ * the cpu (from a checkpoint if those are in use) and caches the result
+ */
+int
+cache_simulate(APEX_CPU* cpu)
+{
+  APEX_Cache* cache = cpu->cache;
+
+  if (lookup(cache, cpu)) {
+    fprintf(stderr, "APEX_CPU : Result served from cache %s\n", cache->dir);
+    return 0;
+  }
+
+  if (cpu->checkpoints) {
+    checkpoint_simulate(cpu);
+  } else if (cpu->steady) {
+    steady_simulate(cpu);
+  } else {
+    APEX_cpu_simulate(cpu);
+  }
+  if (!cpu->out_of_memory) {
+    store(cache, cpu);
+  }
+  return 0;
+}
+
+void
+cache_close(APEX_Cache* cache)
+{
+  free(cache->dir);
+  free(cache);
+}
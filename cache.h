@@ -0,0 +1,25 @@
+#ifndef _APEX_CACHE_H_
+#define _APEX_CACHE_H_
+/**
+ *  cache.h
+ *  On-disk cache of final simulation results, keyed by a hash of
+ *  everything the result depends on: code memory, initial registers and
+ *  data memory, the cycle limit and the model parameters. Several
+ *  processes may share one cache directory.
+ */
+#include "cpu.h"
+
+#define CACHE_DEFAULT_SIZE (64L << 20)
+
+typedef struct APEX_Cache APEX_Cache;
+
+APEX_Cache*
+cache_open(APEX_CPU* cpu, const char* dir, long max_bytes);
+
+int
+cache_simulate(APEX_CPU* cpu);
+
+void
+cache_close(APEX_Cache* cache);
+
+#endif
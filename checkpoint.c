@@ -0,0 +1,321 @@
+/*
+ *  checkpoint.c
+ *  Contains the checkpoint files of incremental re-simulation
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "dmem.h"
+#include "hash.h"
+
+#define CHECKPOINT_MAGIC 0x41504358u	// "APCX"
+#define CHECKPOINT_VERSION 1
+
+/* Last program run in the directory, used to report what changed */
+#define CHECKPOINT_PROGRAM "program.code"
+
+struct APEX_Checkpoints
+{
+  char* dir;
+  int interval;
+};
+
+typedef struct CheckpointHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t cpu_size;	// sizeof(APEX_CPU) of the writer
+  int32_t clock;
+  int32_t reach;	// Highest code index read up to clock
+  uint64_t hash;	// Hash of code memory up to reach
+} CheckpointHeader;
+
+static char*
+path_of(APEX_Checkpoints* cp, const char* name)
+{
+  size_t size = strlen(cp->dir) + strlen(name) + 2;
+  char* path = malloc(size);
+  if (path) {
+    snprintf(path, size, "%s/%s", cp->dir, name);
+  }
+  return path;
+}
+
+/* Writes data to dir/name through a temporary file, so a reader never
+ * sees a partial file
+ */
+static void
+write_file(APEX_Checkpoints* cp, const char* name, const void* a,
+           size_t a_size, const void* b, size_t b_size, const void* c,
+           size_t c_size)
+{
+  char tmp_name[64];
+  snprintf(tmp_name, sizeof(tmp_name), ".tmp.%d", (int)getpid());
+  char* tmp = path_of(cp, tmp_name);
+  char* path = path_of(cp, name);
+  FILE* fp = tmp ? fopen(tmp, "wb") : NULL;
+
+  if (fp) {
+    int ok = fwrite(a, 1, a_size, fp) == a_size &&
+             fwrite(b, 1, b_size, fp) == b_size &&
+             fwrite(c, 1, c_size, fp) == c_size;
+    if (fclose(fp) || !ok || !path || rename(tmp, path)) {
+      unlink(tmp);
+    }
+  }
+  free(tmp);
+  free(path);
+}
+
+static void
+save(APEX_Checkpoints* cp, APEX_CPU* cpu)
+{
+  static int memory[DATA_MEMORY_SIZE];
+  CheckpointHeader header = { CHECKPOINT_MAGIC, CHECKPOINT_VERSION,
+                              sizeof(APEX_CPU), cpu->clock, cpu->code_reach,
+                              hash_code(HASH_SEED, cpu->code_memory,
+                                        cpu->code_memory_size,
+                                        cpu->code_reach) };
+  char name[32];
+
+  for (int i = 0; i < DATA_MEMORY_SIZE; ++i) {
+    memory[i] = dmem_read(cpu, i);
+  }
+  snprintf(name, sizeof(name), "%d.ckpt", cpu->clock);
+  write_file(cp, name, &header, sizeof(header), cpu, sizeof(*cpu), memory,
+             sizeof(memory));
+}
+
+/*
+ * Loads the checkpoint in path into cpu. The cpu keeps its own code
+ * memory and everything else that is not simulation state.
+ */
+static int
+load(APEX_CPU* cpu, const char* path)
+{
+  static APEX_CPU saved;
+  static int memory[DATA_MEMORY_SIZE];
+  CheckpointHeader header;
+  FILE* fp = fopen(path, "rb");
+  if (!fp) {
+    return -1;
+  }
+
+  int ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+           fread(&saved, sizeof(saved), 1, fp) == 1 &&
+           fread(memory, sizeof(memory), 1, fp) == 1;
+  fclose(fp);
+  if (!ok) {
+    return -1;
+  }
+
+  APEX_CPU live = *cpu;
+  *cpu = saved;
+  cpu->code_memory = live.code_memory;
+  cpu->code_memory_size = live.code_memory_size;
+  cpu->code_refs = live.code_refs;
+  memcpy(cpu->data_pages, live.data_pages, sizeof(cpu->data_pages));
+  cpu->sim = live.sim;
+  cpu->no_cycles = live.no_cycles;
+  cpu->trace = live.trace;
+  cpu->lanes = live.lanes;
+  cpu->port = live.port;
+  cpu->barrel = live.barrel;
+  cpu->watch = live.watch;
+  cpu->checkpoints = live.checkpoints;
+  cpu->cache = live.cache;
+  cpu->steady = live.steady;
+  cpu->lsq = live.lsq;
+  cpu->dma = live.dma;
+  cpu->profile = live.profile;
+  cpu->vpred = live.vpred;
+  cpu->stack_distance = live.stack_distance;
+  cpu->host_profile = live.host_profile;
+  cpu->callbacks = live.callbacks;
+
+  dmem_release(cpu);
+  for (int i = 0; i < DATA_MEMORY_SIZE; ++i) {
+    if (memory[i]) {
+      dmem_write(cpu, i, memory[i]);
+    }
+  }
+  return 0;
+}
+
+/* Returns the index of the first instruction that differs from the
+ * program last run in the directory, or -1 if there was none
+ */
+static int
+first_change(APEX_Checkpoints* cp, APEX_CPU* cpu)
+{
+  char* path = path_of(cp, CHECKPOINT_PROGRAM);
+  FILE* fp = path ? fopen(path, "rb") : NULL;
+  int index = -1;
+
+  free(path);
+  if (!fp) {
+    return -1;
+  }
+
+  APEX_Instruction old;
+  for (index = 0; index < cpu->code_memory_size; ++index) {
+    if (fread(&old, sizeof(old), 1, fp) != 1 ||
+        hash_code(HASH_SEED, &old, 1, 0) !=
+          hash_code(HASH_SEED, &cpu->code_memory[index], 1, 0)) {
+      break;
+    }
+  }
+  if (index == cpu->code_memory_size && fread(&old, sizeof(old), 1, fp) != 1) {
+    index = -1;	// same program
+  }
+  fclose(fp);
+  return index;
+}
+
+/*
+ * Restores the latest checkpoint that is exact for the cpu's program and
+ * deletes those that are not. Returns the restored cycle, or 0.
+ */
+static int
+restore(APEX_Checkpoints* cp, APEX_CPU* cpu)
+{
+  DIR* dir = opendir(cp->dir);
+  if (!dir) {
+    return 0;
+  }
+
+  char* best = NULL;
+  int best_clock = 0;
+  struct dirent* entry;
+
+  while ((entry = readdir(dir))) {
+    size_t len = strlen(entry->d_name);
+    if (len < 6 || strcmp(entry->d_name + len - 5, ".ckpt")) {
+      continue;
+    }
+
+    char* path = path_of(cp, entry->d_name);
+    FILE* fp = path ? fopen(path, "rb") : NULL;
+    CheckpointHeader header;
+    int valid = 0;
+
+    if (fp) {
+      valid = fread(&header, sizeof(header), 1, fp) == 1 &&
+              header.magic == CHECKPOINT_MAGIC &&
+              header.version == CHECKPOINT_VERSION &&
+              header.cpu_size == sizeof(APEX_CPU) &&
+              header.hash == hash_code(HASH_SEED, cpu->code_memory,
+                                       cpu->code_memory_size, header.reach);
+      fclose(fp);
+    }
+
+    if (!valid) {
+      if (path) {
+        unlink(path);
+      }
+      free(path);
+    } else if (header.clock > best_clock && header.clock <= cpu->no_cycles) {
+      free(best);
+      best = path;
+      best_clock = header.clock;
+    } else {
+      free(path);
+    }
+  }
+  closedir(dir);
+
+  int changed = first_change(cp, cpu);
+  if (best && load(cpu, best) == 0) {
+    if (changed >= 0) {
+      fprintf(stderr,
+              "APEX_CPU : First changed instruction at pc(%d), resuming "
+              "from checkpoint at cycle %d\n",
+              4000 + 4 * changed, best_clock);
+    } else {
+      fprintf(stderr, "APEX_CPU : Resuming from checkpoint at cycle %d\n",
+              best_clock);
+    }
+  } else {
+    best_clock = 0;
+  }
+  free(best);
+  return best_clock;
+}
+
+/* Returns 1 if cpu has state outside it that a checkpoint does not hold */
+static int
+has_outside_state(const APEX_CPU* cpu)
+{
+  return cpu->lsq || cpu->dma || cpu->vpred || cpu->stack_distance ||
+         cpu->callbacks;
+}
+
+/*
+ * Attaches a checkpoint directory to a freshly initialized cpu, creating
+ * the directory if needed. A checkpoint is written every interval cycles.
+ * Returns NULL if the cpu has state a checkpoint does not hold.
+ */
+APEX_Checkpoints*
+checkpoint_open(APEX_CPU* cpu, const char* dir, int interval)
+{
+  if (has_outside_state(cpu) || (mkdir(dir, 0777) && errno != EEXIST)) {
+    return NULL;
+  }
+
+  APEX_Checkpoints* cp = calloc(1, sizeof(*cp));
+  if (!cp) {
+    return NULL;
+  }
+  cp->dir = strdup(dir);
+  cp->interval = interval > 0 ? interval : 1;
+  if (!cp->dir) {
+    free(cp);
+    return NULL;
+  }
+  cpu->checkpoints = cp;
+  return cp;
+}
+
+/*
+ * Runs the cpu to completion from the latest usable checkpoint, writing
+ * new checkpoints on the way. The end state is the same as a run from
+ * cycle 0. If state a checkpoint does not hold was attached after
+ * checkpoint_open, the run starts at cycle 0 without checkpoints and -1
+ * is returned.
+ */
+int
+checkpoint_simulate(APEX_CPU* cpu)
+{
+  APEX_Checkpoints* cp = cpu->checkpoints;
+
+  if (has_outside_state(cpu)) {
+    APEX_cpu_simulate(cpu);
+    return -1;
+  }
+  restore(cp, cpu);
+  write_file(cp, CHECKPOINT_PROGRAM, cpu->code_memory,
+             sizeof(*cpu->code_memory) * cpu->code_memory_size, NULL, 0,
+             NULL, 0);
+
+  while (!APEX_cpu_done(cpu)) {
+    APEX_cpu_cycle(cpu);
+    if (cpu->clock % cp->interval == 0 && !cpu->out_of_memory) {
+      save(cp, cpu);
+    }
+  }
+  return 0;
+}
+
+void
+checkpoint_close(APEX_Checkpoints* cp)
+{
+  free(cp->dir);
+  free(cp);
+}
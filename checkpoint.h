@@ -0,0 +1,31 @@
+#ifndef _APEX_CHECKPOINT_H_
+#define _APEX_CHECKPOINT_H_
+/**
+ *  checkpoint.h
+ *  Periodic on-disk checkpoints for incremental re-simulation.
+ *
+ *  Each checkpoint holds the complete cpu and data memory at some cycle,
+ *  tagged with a hash of the part of code memory read up to that cycle.
+ *  When a program is edited and run again, every checkpoint whose tagged
+ *  prefix is unchanged is still exact, and the run resumes from the latest
+ *  of them instead of cycle 0.
+ *
+ *  Only the cpu and data memory are saved. The load/store queue, the DMA
+ *  engine, the value predictor, the stack distance analysis and embedding
+ *  callbacks keep state of their own, so checkpoints refuse a cpu with any
+ *  of them attached rather than resume it with that state out of step.
+ */
+#include "cpu.h"
+
+typedef struct APEX_Checkpoints APEX_Checkpoints;
+
+APEX_Checkpoints*
+checkpoint_open(APEX_CPU* cpu, const char* dir, int interval);
+
+int
+checkpoint_simulate(APEX_CPU* cpu);
+
+void
+checkpoint_close(APEX_Checkpoints* cp);
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ *  compress.c
+ *  Contains the compressed encoding pass and its fetch accounting
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compress.h"
+
+/* Major opcodes of the 16-bit forms */
+enum
+{
+  C_MOVC = 1,
+  C_ADD,
+  C_SUB,
+  C_AND,
+  C_OR,
+  C_XOR,
+  C_MUL,
+  C_BZ,
+  C_BNZ
+};
+
+/* Two-operand forms, in the order of their major opcodes from C_ADD */
+static const char* alu_ops[] = { "ADD", "SUB", "AND", "OR", "XOR", "MUL" };
+
+/* Offsets a short branch reaches, in bytes */
+#define SHORT_BRANCH_MIN (-4096)
+#define SHORT_BRANCH_MAX 4094
+
+static int
+is_loop(const APEX_Instruction* ins)
+{
+  return strcmp(ins->opcode, "LOOP") == 0;
+}
+
+/* Returns 1 for the instructions whose imm is measured in code bytes */
+static int
+is_relative(const APEX_Instruction* ins)
+{
+  return strcmp(ins->opcode, "BZ") == 0 || strcmp(ins->opcode, "BNZ") == 0 ||
+         is_compare_branch(ins->opcode) || is_loop(ins);
+}
+
+/* Returns the major opcode of the 16-bit form of ins, or 0 if it has none.
+ * Whether a branch offset fits is decided during layout.
+ */
+static int
+short_form(const APEX_Instruction* ins)
+{
+  if (strcmp(ins->opcode, "MOVC") == 0) {
+    return ins->imm >= -128 && ins->imm <= 127 ? C_MOVC : 0;
+  }
+  for (int k = 0; k < (int)(sizeof(alu_ops) / sizeof(*alu_ops)); ++k) {
+    if (strcmp(ins->opcode, alu_ops[k]) == 0) {
+      return ins->rd == ins->rs1 ? C_ADD + k : 0;
+    }
+  }
+  if (strcmp(ins->opcode, "BZ") == 0) {
+    return C_BZ;
+  }
+  if (strcmp(ins->opcode, "BNZ") == 0) {
+    return C_BNZ;
+  }
+  return 0;
+}
+
+static unsigned
+encode(const APEX_Instruction* ins, int form)
+{
+  switch (form) {
+    case C_MOVC:
+      return C_MOVC << 12 | (ins->rd & 0xf) << 8 | (ins->imm & 0xff);
+    case C_BZ:
+    case C_BNZ:
+      return form << 12 | ((ins->imm / 2) & 0xfff);
+  }
+  return form << 12 | (ins->rd & 0xf) << 8 | (ins->rs2 & 0xf) << 4;
+}
+
+/* Writes every instruction with its pc and, for a 16-bit one, its
+ * encoding. Returns 0 on success.
+ */
+static int
+write_listing(APEX_CPU* cpu, const char* filename)
+{
+  FILE* fp = fopen(filename, "w");
+  char text[128];
+
+  if (!fp) {
+    return -1;
+  }
+  for (int i = 0; i < cpu->code_memory_size; ++i) {
+    const APEX_Instruction* ins = &cpu->code_memory[i];
+    format_code(text, sizeof(text), ins);
+    if (ins->size == 2) {
+      fprintf(fp, "pc(%d) %04x %s\n", ins->pc, encode(ins, short_form(ins)),
+              text);
+    } else {
+      fprintf(fp, "pc(%d) ---- %s\n", ins->pc, text);
+    }
+  }
+  return fclose(fp) ? -1 : 0;
+}
+
+/*
+ * Lays out code memory with the compressed forms and rewrites the
+ * relative offsets, then writes the listing to filename unless it is
+ * NULL. Returns a COMPRESS_* result; a JUMP cannot be relocated because
+ * its target is computed at run time.
+ */
+int
+compress_program(APEX_CPU* cpu, const char* filename)
+{
+  APEX_Instruction* code = cpu->code_memory;
+  int n = cpu->code_memory_size;
+
+  for (int i = 0; i < n; ++i) {
+    if (strcmp(code[i].opcode, "JUMP") == 0 ||
+        (is_relative(&code[i]) && code[i].imm % 4)) {
+      return COMPRESS_RELOCATE;
+    }
+  }
+
+  /* Targets as instruction indexes, the same in both layouts */
+  int* target = malloc((n > 0 ? (size_t)n : 1) * sizeof(*target));
+  if (!target) {
+    return COMPRESS_NO_MEMORY;
+  }
+  for (int i = 0; i < n; ++i) {
+    target[i] = is_loop(&code[i]) ? i + 1 + code[i].imm / 4
+                                  : i + code[i].imm / 4;
+    code[i].size = short_form(&code[i]) ? 2 : 4;
+  }
+  cpu->compressed = 1;
+  cpu->fetch_word = -1;
+
+  /* Widening a branch only moves others further apart, so this ends */
+  for (int changed = 1; changed;) {
+    int pc = 4000;
+    for (int i = 0; i < n; ++i) {
+      code[i].pc = pc;
+      pc += code[i].size;
+    }
+
+    changed = 0;
+    for (int i = 0; i < n; ++i) {
+      int offset = code_pc(cpu, target[i]) - code[i].pc;
+      if (code[i].size == 2 && is_relative(&code[i]) &&
+          (offset < SHORT_BRANCH_MIN || offset > SHORT_BRANCH_MAX)) {
+        code[i].size = 4;
+        changed = 1;
+      }
+    }
+  }
+
+  for (int i = 0; i < n; ++i) {
+    if (is_loop(&code[i])) {
+      code[i].imm = code_pc(cpu, target[i]) - code_pc(cpu, i + 1);
+    } else if (is_relative(&code[i])) {
+      code[i].imm = code_pc(cpu, target[i]) - code[i].pc;
+    }
+  }
+  free(target);
+
+  if (filename && write_listing(cpu, filename)) {
+    return COMPRESS_LISTING;
+  }
+  return COMPRESS_OK;
+}
+
+/*
+ * Counts the aligned words of code memory fetching the instruction at pc
+ * reads. The word read last is still held, so it is not read again.
+ */
+void
+compress_fetch(APEX_CPU* cpu, int pc)
+{
+  int index = code_index(cpu, pc);
+  int size = index >= 0 && index < cpu->code_memory_size
+               ? cpu->code_memory[index].size
+               : 4;
+
+  cpu->fetches++;
+  for (int word = pc & ~3; word < pc + size; word += 4) {
+    if (word != cpu->fetch_word) {
+      cpu->fetch_words++;
+      cpu->fetch_word = word;
+    }
+  }
+}
+
+void
+compress_print(APEX_CPU* cpu)
+{
+  int compressed = 0;
+  int bytes = 0;
+
+  for (int i = 0; i < cpu->code_memory_size; ++i) {
+    compressed += cpu->code_memory[i].size == 2;
+    bytes += cpu->code_memory[i].size;
+  }
+  printf("\n(apex) >> Compressed code: %d of %d instructions 16-bit, %d "
+         "bytes instead of %d (%.1f%% smaller)",
+         compressed, cpu->code_memory_size, bytes, 4 * cpu->code_memory_size,
+         cpu->code_memory_size
+           ? 100.0 - 100.0 * bytes / (4 * cpu->code_memory_size)
+           : 0.0);
+  printf("\n(apex) >> Fetch words=%d for %d instructions fetched (%.2f per "
+         "instruction)",
+         cpu->fetch_words, cpu->fetches,
+         cpu->fetches ? (double)cpu->fetch_words / cpu->fetches : 0.0);
+}
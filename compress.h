@@ -0,0 +1,43 @@
+#ifndef _APEX_COMPRESS_H_
+#define _APEX_COMPRESS_H_
+/**
+ *  compress.h
+ *  Compressed 16-bit encoding of common instructions.
+ *
+ *  Code memory normally gives every instruction a 4-byte slot. This pass
+ *  assembles the program again with 2-byte forms where one exists: MOVC
+ *  of an 8-bit signed constant, an ADD, SUB, AND, OR, XOR or MUL whose
+ *  destination is its first source, and a BZ or BNZ within 4 KB. The
+ *  16-bit word holds the major opcode in bits 15..12, the destination in
+ *  11..8 and then either the constant, the second source in 7..4, or the
+ *  branch offset in halfwords in 11..0. Each instruction gets its new pc,
+ *  and the offsets of branches and the body lengths of LOOP are rewritten
+ *  for the new layout; a branch is only kept short once its offset is
+ *  known to fit. Fetch then steps by the width of each instruction and
+ *  reads code memory a 4-byte aligned word at a time, so two compressed
+ *  instructions in one word cost one fetch access.
+ */
+#include "cpu.h"
+
+/* Results of compress_program */
+enum
+{
+  COMPRESS_OK,
+  COMPRESS_RELOCATE,	// A JUMP, or an offset that is not whole instructions
+  COMPRESS_NO_MEMORY,
+  COMPRESS_LISTING	// The listing could not be written
+};
+
+int
+compress_program(APEX_CPU* cpu, const char* filename);
+
+void
+compress_print(APEX_CPU* cpu);
+
+/* Hook, called for every instruction fetched from code memory while the
+ * program is compressed
+ */
+void
+compress_fetch(APEX_CPU* cpu, int pc);
+
+#endif
@@ -1,24 +1,45 @@
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "cache.h"
+#include "checkpoint.h"
+#include "compress.h"
 #include "cpu.h"
+#include "dma.h"
+#include "dmem.h"
+#include "fusion.h"
+#include "hostprof.h"
+#include "lockstep.h"
+#include "lsq.h"
+#include "pipeline.h"
+#include "profile.h"
+#include "stackdist.h"
+#include "steady.h"
+#include "trace.h"
+#include "vector.h"
+#include "vpred.h"
+#include "watch.h"
 
 /* Set this flag to 1 to enable debug messages */
 #define ENABLE_DEBUG_MESSAGES 1
 
 /*
- * This function creates and initializes APEX cpu.
+ * This function creates and initializes an APEX cpu that runs the given
+ * code memory and takes ownership of it. Nothing is printed.
  */
 APEX_CPU*
-APEX_cpu_init(const char* filename)
+APEX_cpu_init_code(APEX_Instruction* code_memory, int size)
 {
-  if (!filename) {
+  if (!code_memory) {
     return NULL;
   }
 
-  APEX_CPU* cpu = malloc(sizeof(*cpu));
+  APEX_CPU* cpu = calloc(1, sizeof(*cpu));
   if (!cpu) {
+    free(code_memory);
     return NULL;
   }
 
@@ -27,22 +48,53 @@ APEX_cpu_init(const char* filename)
   memset(cpu->regs, 0, sizeof(int) * 16);
   memset(cpu->regs_valid, 1, sizeof(int) * 16);
   memset(cpu->stage, 0, sizeof(CPU_Stage) * NUM_STAGES);
-  memset(cpu->data_memory, 0, sizeof(int) * 4000);
 
   cpu->stage[EX].flush=0;
 
   for (int i =0; i<16; i++) {
     cpu->regs_valid[i] = 1;
   }
+  for (int i = 0; i < VECTOR_REGS; i++) {
+    cpu->vregs_valid[i] = 1;
+  }
   //dispRegValid(cpu);
 
-  /* Parse input file and create code memory */
-  cpu->code_memory = create_code_memory(filename, &cpu->code_memory_size);
+  cpu->code_memory = code_memory;
+  cpu->code_memory_size = size;
 
-  if (!cpu->code_memory) {
+  cpu->code_refs = malloc(sizeof(*cpu->code_refs));
+  if (!cpu->code_refs) {
+    free(cpu->code_memory);
     free(cpu);
     return NULL;
   }
+  atomic_init(cpu->code_refs, 1);
+
+  /* Make all stages busy except Fetch stage, initally to start the pipeline */
+  for (int i = 1; i < NUM_STAGES; ++i) {
+    cpu->stage[i].busy = 1;
+  }
+  //dispRegValid(cpu);
+  return cpu;
+}
+
+/*
+ * This function creates and initializes APEX cpu.
+ */
+APEX_CPU*
+APEX_cpu_init(const char* filename)
+{
+  if (!filename) {
+    return NULL;
+  }
+
+  /* Parse input file and create code memory */
+  int size = 0;
+  APEX_Instruction* code_memory = create_code_memory(filename, &size);
+  APEX_CPU* cpu = APEX_cpu_init_code(code_memory, size);
+  if (!cpu) {
+    return NULL;
+  }
 
   if (ENABLE_DEBUG_MESSAGES) {
     fprintf(stderr,
@@ -60,12 +112,6 @@ APEX_cpu_init(const char* filename)
              cpu->code_memory[i].imm);
     }
   }
-
-  /* Make all stages busy except Fetch stage, initally to start the pipeline */
-  for (int i = 1; i < NUM_STAGES; ++i) {
-    cpu->stage[i].busy = 1;
-  }
-  //dispRegValid(cpu);
   return cpu;
 }
 
@@ -78,7 +124,11 @@ APEX_cpu_init(const char* filename)
 void
 APEX_cpu_stop(APEX_CPU* cpu)
 {
-  free(cpu->code_memory);
+  if (atomic_fetch_sub(cpu->code_refs, 1) == 1) {
+    free(cpu->code_memory);
+    free(cpu->code_refs);
+  }
+  dmem_release(cpu);
   free(cpu);
 }
 
@@ -94,89 +144,220 @@ get_code_index(int pc)
   return (pc - 4000) / 4;
 }
 
-static void
-print_instruction(CPU_Stage* stage)
+/* Same as get_code_index, for code memory that may be compressed. A pc
+ * inside a compressed instruction maps to it, and pcs beyond either end
+ * of code memory count 4-byte slots.
+ */
+int
+code_index(const APEX_CPU* cpu, int pc)
 {
-  if (strcmp(stage->opcode, "STORE") == 0)
-   {
-    printf("%s,R%d,R%d,#%d ", stage->opcode, stage->rs1, stage->rs2, stage->imm);
-   }
+  const APEX_Instruction* code = cpu->code_memory;
+  int n = cpu->code_memory_size;
 
-   if (strcmp(stage->opcode, "LOAD") == 0) 
-  {
-    printf("%s,R%d,R%d,#%d ", stage->opcode, stage->rd, stage->rs1, stage->imm);
+  if (!cpu->compressed || pc < 4000) {
+    return get_code_index(pc);
+  }
+  int end = n ? code[n - 1].pc + code[n - 1].size : 4000;
+  if (pc >= end) {
+    return n + (pc - end) / 4;
   }
 
-  if (strcmp(stage->opcode, "MOVC") == 0) 
-  {
-    printf("%s,R%d,#%d ", stage->opcode, stage->rd, stage->imm);
+  int lo = 0;
+  int hi = n - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (code[mid].pc <= pc) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
   }
-  
-  if (strcmp(stage->opcode, "ADD") == 0) 
-  {
-    printf("%s,R%d,R%d,R%d", stage->opcode, stage->rd, stage->rs1,stage->rs2);
+  return lo;
+}
+
+/* Returns the pc of the instruction at index, the inverse of code_index */
+int
+code_pc(const APEX_CPU* cpu, int index)
+{
+  const APEX_Instruction* code = cpu->code_memory;
+  int n = cpu->code_memory_size;
+
+  if (!cpu->compressed || index < 0) {
+    return 4000 + 4 * index;
   }
-  
-  if (strcmp(stage->opcode, "SUB") == 0) 
-  {
-    printf("%s,R%d,R%d,R%d", stage->opcode, stage->rd, stage->rs1,stage->rs2);
+  if (index < n) {
+    return code[index].pc;
   }
-  
-  if (strcmp(stage->opcode, "AND") == 0) 
-  {
-    printf("%s,R%d,R%d,R%d", stage->opcode, stage->rd, stage->rs1,stage->rs2);
+  return (n ? code[n - 1].pc + code[n - 1].size : 4000) + 4 * (index - n);
+}
+
+/* Returns the pc of the instruction after the one at pc */
+static int
+next_pc(const APEX_CPU* cpu, int pc)
+{
+  return cpu->compressed ? code_pc(cpu, code_index(cpu, pc) + 1) : pc + 4;
+}
+
+/* Returns 1 for the register compare-and-branch instructions */
+int
+is_compare_branch(const char* opcode)
+{
+  return strcmp(opcode, "BEQ") == 0 || strcmp(opcode, "BNE") == 0 ||
+         strcmp(opcode, "BLT") == 0 || strcmp(opcode, "BGE") == 0;
+}
+
+/* Returns 1 if the instruction in the given stage belongs to the thread
+ * now loaded. Always true without barrel multithreading.
+ */
+static int
+same_thread(APEX_CPU* cpu, int stage)
+{
+  return !cpu->barrel || cpu->stage[stage].tid == cpu->thread;
+}
+
+/* Returns 1 if pc is served by the active loop buffer */
+static int
+in_loop_buffer(APEX_CPU* cpu, int pc)
+{
+  return cpu->loop_active && pc >= cpu->loop_start && pc < cpu->loop_end &&
+         code_index(cpu, pc) - code_index(cpu, cpu->loop_start) <
+           LOOP_BUFFER_SIZE;
+}
+
+/* Returns the instruction at pc, or an empty instruction once fetch runs
+ * past the end of code memory
+ */
+static APEX_Instruction*
+code_at(APEX_CPU* cpu, int pc)
+{
+  static APEX_Instruction empty;
+  int index = code_index(cpu, pc);
+
+  if (index > cpu->code_reach) {
+    cpu->code_reach = index;
   }
-  
-  if (strcmp(stage->opcode, "OR") == 0) 
-  {
-    printf("%s,R%d,R%d,R%d", stage->opcode, stage->rd, stage->rs1,stage->rs2);
+
+  if (in_loop_buffer(cpu, pc)) {
+    return &cpu->loop_buffer[index - code_index(cpu, cpu->loop_start)];
   }
-  
-  if (strcmp(stage->opcode, "XOR") == 0) 
-  {
-    printf("%s,R%d,R%d,R%d", stage->opcode, stage->rd, stage->rs1,stage->rs2);
+
+  if (index < 0 || index >= cpu->code_memory_size) {
+    return &empty;
   }
-  
-  if (strcmp(stage->opcode, "MUL") == 0) 
-  {
-    printf("%s,R%d,R%d,R%d", stage->opcode, stage->rd, stage->rs1,stage->rs2);
+  return &cpu->code_memory[index];
+}
+
+/* Debug function which queues the cpu stage
+ * content on the trace
+ */
+static void
+print_stage_content(APEX_CPU* cpu, char* name, CPU_Stage* stage)
+{
+  if (cpu->trace) {
+    trace_stage(cpu->trace, name, stage);
   }
-  
-  if (strcmp(stage->opcode, "BZ") == 0) 
-  {
-    printf("%s,#%d", stage->opcode, stage->imm);
+}
+
+/* Queues a fixed trace line, text must be a string literal */
+static void
+print_trace_text(APEX_CPU* cpu, const char* text)
+{
+  if (cpu->trace) {
+    trace_text(cpu->trace, text);
   }
-  
-  if (strcmp(stage->opcode, "BNZ") == 0) 
-  {
-    printf("%s,#%d", stage->opcode, stage->imm);
+}
+
+/* Computes the next fetch pc. At the end of an active hardware loop body
+ * fetch goes back to the loop start until the loop count runs out, with
+ * no branch passing through the pipeline.
+ */
+static void
+advance_pc(APEX_CPU* cpu)
+{
+  if (in_loop_buffer(cpu, cpu->pc)) {
+    cpu->loop_buffer_fetches++;
+  } else if (cpu->compressed) {
+    compress_fetch(cpu, cpu->pc);
   }
-  
-  if (strcmp(stage->opcode, "JUMP") == 0) 
-  {
-    printf("%s,R%d,#%d", stage->opcode,stage->rs1,stage->imm);
+
+  int next = next_pc(cpu, cpu->pc);
+  if (cpu->loop_active && next == cpu->loop_end) {
+    if (--cpu->loop_count > 0) {
+      cpu->pc = cpu->loop_start;
+      cpu->loop_iterations++;
+      /* The body retires again, same accounting as a taken branch */
+      cpu->ins_completed -=
+        code_index(cpu, cpu->loop_end) - code_index(cpu, cpu->loop_start);
+      return;
+    }
+    cpu->loop_active = 0;
   }
-  
-  if (strcmp(stage->opcode, "HALT") == 0)
-   {
-    printf("%s", stage->opcode);
-   }
+  cpu->pc = next;
+}
 
-   if (strcmp(stage->opcode, "") == 0)
-   {
-    printf("EMPTY");
-   }
+/* Sets up the loop count register and loop buffer for a decoded LOOP.
+ * The body is the imm bytes that follow the LOOP instruction and runs
+ * count times; a count below 2 runs it once.
+ */
+static void
+start_loop(APEX_CPU* cpu, CPU_Stage* stage, int count)
+{
+  cpu->loop_start = next_pc(cpu, stage->pc);
+  cpu->loop_end = cpu->loop_start + stage->imm;
+
+  int first = code_index(cpu, cpu->loop_start);
+  int length = code_index(cpu, cpu->loop_end) - first;
+  cpu->loop_count = count;
+  cpu->loop_active = count > 1 && length > 0;
+
+  for (int i = 0; i < LOOP_BUFFER_SIZE && i < length; ++i) {
+    if (first + i > cpu->code_reach) {
+      cpu->code_reach = first + i;
+    }
+    if (first + i >= cpu->code_memory_size) {
+      break;
+    }
+    cpu->loop_buffer[i] = cpu->code_memory[first + i];
+  }
 }
 
-/* Debug function which dumps the cpu stage
- * content
+/* With a split fetch stage, fetch may already be past the end of the
+ * body when LOOP is decoded. The instructions fetched beyond it are
+ * dropped and fetch goes back to the loop start, as it would have.
  */
 static void
-print_stage_content(char* name, CPU_Stage* stage)
+refetch_loop(APEX_CPU* cpu)
 {
-  printf("%-15s: pc(%d) ", name, stage->pc);
-  print_instruction(stage);
-  printf("\n");
+  if (!cpu->loop_active || cpu->pc < cpu->loop_end) {
+    return;
+  }
+  for (int k = 0; k < cpu->stage_extra[F]; ++k) {
+    if (cpu->transit[F][k].pc >= cpu->loop_end) {
+      strcpy(cpu->transit[F][k].opcode, "");
+      cpu->transit[F][k].pc = 0;
+    }
+  }
+  if (--cpu->loop_count > 0) {
+    cpu->pc = cpu->loop_start;
+    cpu->loop_iterations++;
+    cpu->ins_completed -=
+      code_index(cpu, cpu->loop_end) - code_index(cpu, cpu->loop_start);
+  } else {
+    cpu->loop_active = 0;
+    cpu->pc = cpu->loop_end;
+  }
+}
+
+/* A taken branch leaving the loop body, or flushing a LOOP that was
+ * already decoded, ends the hardware loop
+ */
+static void
+cancel_loop_on_branch(APEX_CPU* cpu, int target)
+{
+  if ((strcmp(cpu->stage[EX].opcode, "LOOP") == 0 && same_thread(cpu, EX)) ||
+      target < cpu->loop_start || target >= cpu->loop_end) {
+    cpu->loop_active = 0;
+  }
 }
 
 /*
@@ -190,18 +371,19 @@ fetch(APEX_CPU* cpu)
   if(cpu->stage[EX].flush==1)
   {
      strcpy(cpu->stage[F].opcode, "");
-     printf("Fetch         : EMPTY\n");    
+     print_trace_text(cpu, "Fetch         : EMPTY\n");    
 
   }
   
  else if (!stage->busy && !stage->stalled) 
   {  
     stage->pc = cpu->pc;
+    stage->tid = cpu->thread;
 
     /* Index into code memory using this pc and copy all instruction fields into
      * fetch latch
      */
-    APEX_Instruction* current_ins = &cpu->code_memory[get_code_index(cpu->pc)];
+    APEX_Instruction* current_ins = code_at(cpu, cpu->pc);
     strcpy(stage->opcode, current_ins->opcode);
     stage->rd = current_ins->rd;
     stage->rs1 = current_ins->rs1;
@@ -213,14 +395,17 @@ fetch(APEX_CPU* cpu)
   if(!cpu->stage[DRF].stalled)
   {
     /* Update PC for next instruction */
-    cpu->pc += 4;
+    advance_pc(cpu);
 
     /* Copy data from fetch latch to decode latch*/
-    cpu->stage[DRF] = cpu->stage[F];
+    pipeline_pass(cpu, F, &cpu->stage[F]);
+    if (cpu->lanes) {
+      lockstep_fetch(cpu);
+    }
   }
 
     if (ENABLE_DEBUG_MESSAGES) {
-      print_stage_content("Fetch", stage);
+      print_stage_content(cpu, "Fetch", stage);
     }
   }
   
@@ -228,11 +413,12 @@ fetch(APEX_CPU* cpu)
   {
     /* Store current PC in fetch latch */
     stage->pc = cpu->pc;
+    stage->tid = cpu->thread;
 
     /* Index into code memory using this pc and copy all instruction fields into
      * fetch latch
      */
-    APEX_Instruction* current_ins = &cpu->code_memory[get_code_index(cpu->pc)];
+    APEX_Instruction* current_ins = code_at(cpu, cpu->pc);
     strcpy(stage->opcode, current_ins->opcode);
     stage->rd = current_ins->rd;
     stage->rs1 = current_ins->rs1;
@@ -242,13 +428,86 @@ fetch(APEX_CPU* cpu)
     
    if(ENABLE_DEBUG_MESSAGES)
     {
-      print_stage_content("Fetch", stage);
+      print_stage_content(cpu, "Fetch", stage);
     }
   }
   // printf("\nFAstage->regs[0]: %d\n", cpu->regs[0]);  
   return 0;
 }
 
+/* Checks the scalar and vector sources of a vector instruction and, if
+ * they are all valid, reads them into the latch. Returns 0 on a RAW stall.
+ */
+static int
+read_vector_operands(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  if (strcmp(stage->opcode, "VLOAD") == 0) {
+    if (!cpu->regs_valid[stage->rs1]) {
+      return 0;
+    }
+    stage->rs1_value = cpu->regs[stage->rs1];
+    return 1;
+  }
+
+  if (strcmp(stage->opcode, "VSTORE") == 0) {
+    if (!cpu->vregs_valid[stage->rs1] || !cpu->regs_valid[stage->rs2]) {
+      return 0;
+    }
+    memcpy(stage->vs1_value, cpu->vregs[stage->rs1], sizeof(stage->vs1_value));
+    stage->rs2_value = cpu->regs[stage->rs2];
+    return 1;
+  }
+
+  if (!cpu->vregs_valid[stage->rs1] || !cpu->vregs_valid[stage->rs2]) {
+    return 0;
+  }
+  memcpy(stage->vs1_value, cpu->vregs[stage->rs1], sizeof(stage->vs1_value));
+  memcpy(stage->vs2_value, cpu->vregs[stage->rs2], sizeof(stage->vs2_value));
+  return 1;
+}
+
+/* Issues the instruction fetch would bring in next together with the one
+ * just decoded, if the two form an enabled pair and the second has its
+ * sources. The second instruction is then consumed as if fetched.
+ */
+static void
+fuse_next(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  /* Not after a redirect, or with fetch already further ahead */
+  if (cpu->pc != next_pc(cpu, stage->pc)) {
+    return;
+  }
+  APEX_Instruction* next = code_at(cpu, cpu->pc);
+  int kind = fusion_pair(cpu, stage, next);
+  if (kind == FUSE_NONE) {
+    return;
+  }
+
+  if (kind == FUSE_MOVC_ALU) {
+    /* The constant stands in for the register MOVC writes */
+    int rx = stage->rd;
+    if ((next->rs1 != rx && !cpu->regs_valid[next->rs1]) ||
+        (next->rs2 != rx && !cpu->regs_valid[next->rs2])) {
+      return;
+    }
+    stage->rs1_value = next->rs1 == rx ? stage->imm : cpu->regs[next->rs1];
+    stage->rs2_value = next->rs2 == rx ? stage->imm : cpu->regs[next->rs2];
+    stage->arithmetic_instr = strcmp(next->opcode, "ADD") == 0 ||
+                              strcmp(next->opcode, "SUB") == 0;
+    cpu->regs_valid[next->rd]--;
+  }
+
+  stage->fused.kind = kind;
+  stage->fused.pc = cpu->pc;
+  snprintf(stage->fused.opcode, sizeof(stage->fused.opcode), "%.7s",
+           next->opcode);
+  stage->fused.rd = next->rd;
+  stage->fused.rs1 = next->rs1;
+  stage->fused.rs2 = next->rs2;
+  stage->fused.imm = next->imm;
+  advance_pc(cpu);
+}
+
 /*
  *  Decode Stage of APEX Pipeline
  *
@@ -266,7 +525,7 @@ decode(APEX_CPU* cpu)
   if(cpu->stage[EX].flush==1)
   {
      strcpy(cpu->stage[F].opcode, "");
-     printf("Decode        : EMPTY\n");    
+     print_trace_text(cpu, "Decode        : EMPTY\n");    
 
   }
     
@@ -301,7 +560,10 @@ decode(APEX_CPU* cpu)
       cpu->stage[F].stalled=0; 
       cpu->stage[DRF].stalled=0;
       stage->rs1_value= cpu->regs[stage->rs1];  // 0 is invalid for dependency
-    cpu->regs_valid[stage->rd]--; 
+      /* A predicted value keeps the register valid for dependents */
+      if (!cpu->vpred || !vpred_decode(cpu, stage)) {
+        cpu->regs_valid[stage->rd]--;
+      }
     }
     else
     {
@@ -450,17 +712,78 @@ decode(APEX_CPU* cpu)
       if(strcmp(stage->opcode, "HALT") == 0) 
       {
         stage->arithmetic_instr = 0;
-        cpu->stage[F].stalled = 1;
-        cpu->stage[F].pc = 0;
-        strcpy(cpu->stage[F].opcode, "");
+        /* A barrel thread only stops its own fetch */
+        if (!cpu->barrel) {
+          cpu->stage[F].stalled = 1;
+          cpu->stage[F].pc = 0;
+          strcpy(cpu->stage[F].opcode, "");
+        }
         cpu->ex_halt = 1;
       }
 
 
+      /* Vector instructions */
+      if (is_vector_opcode(stage->opcode))
+      {
+        stage->arithmetic_instr = 0;
+        if(read_vector_operands(cpu, stage))
+        {
+          cpu->stage[F].stalled=0;
+          cpu->stage[DRF].stalled=0;
+          if (vector_writes_vreg(stage->opcode)) {
+            cpu->vregs_valid[stage->rd]--;
+          }
+        }
+        else
+        {
+          cpu->stage[F].stalled=1;
+          cpu->stage[DRF].stalled=1;
+        }
+      }
+
+      /* LOOP reads its trip count and arms the loop buffer */
+      if (strcmp(stage->opcode, "LOOP") == 0)
+      {
+        stage->arithmetic_instr = 0;
+        if(cpu->regs_valid[stage->rs1])
+        {
+          cpu->stage[F].stalled=0;
+          cpu->stage[DRF].stalled=0;
+          stage->rs1_value= cpu->regs[stage->rs1];
+          start_loop(cpu, stage, stage->rs1_value);
+          refetch_loop(cpu);
+        }
+        else
+        {
+          cpu->stage[F].stalled=1;
+          cpu->stage[DRF].stalled=1;
+        }
+      }
+
+      /* Compare-and-branch reads its operands like STORE and does not
+       * wait for the zero flag
+       */
+      if (is_compare_branch(stage->opcode))
+      {
+        stage->arithmetic_instr = 0;
+        if(cpu->regs_valid[stage->rs1] && cpu->regs_valid[stage->rs2])
+        {
+          cpu->stage[F].stalled=0;
+          cpu->stage[DRF].stalled=0;
+          stage->rs1_value= cpu->regs[stage->rs1];
+          stage->rs2_value= cpu->regs[stage->rs2];
+        }
+        else
+        {
+          cpu->stage[F].stalled=1;
+          cpu->stage[DRF].stalled=1;
+        }
+      }
+
       if(strcmp(stage->opcode, "BZ") == 0 || strcmp(stage->opcode, "BNZ") == 0) 
       {
       stage->arithmetic_instr = 0;
-      if((cpu->stage[WB].arithmetic_instr == 1) || (cpu->stage[MEM].arithmetic_instr == 1)) 
+      if((cpu->stage[WB].arithmetic_instr == 1 && same_thread(cpu, WB)) || (cpu->stage[MEM].arithmetic_instr == 1 && same_thread(cpu, MEM)) || pipeline_flag_pending(cpu)) 
       {
         stage->stalled = 1;
       } else {
@@ -469,12 +792,20 @@ decode(APEX_CPU* cpu)
     }
 
 
+    stage->fused.kind = FUSE_NONE;
+    if (cpu->fuse && !stage->stalled) {
+      fuse_next(cpu, stage);
+    }
+
     /* Copy data from decode latch to execute latch*/
-    cpu->stage[EX] = cpu->stage[DRF];
+    pipeline_pass(cpu, DRF, &cpu->stage[DRF]);
+    if (cpu->lanes) {
+      lockstep_decode(cpu);
+    }
 
     if(ENABLE_DEBUG_MESSAGES)
     {
-      print_stage_content("Decode/RF", stage);
+      print_stage_content(cpu, "Decode/RF", stage);
   }
   
   }
@@ -483,13 +814,81 @@ decode(APEX_CPU* cpu)
    {  
    if(ENABLE_DEBUG_MESSAGES)
    {
-      print_stage_content("Decode/RF", stage);
+      print_stage_content(cpu, "Decode/RF", stage);
     }
   } 
    
   return 0;
 }
 
+/* Applies a forced outcome, if one was set on this cpu, to the
+ * conditional branch being resolved
+ */
+static int
+resolve_branch(APEX_CPU* cpu, int taken)
+{
+  if (cpu->force_branch == BRANCH_FORCE_TAKEN) {
+    taken = 1;
+  } else if (cpu->force_branch == BRANCH_FORCE_NOT_TAKEN) {
+    taken = 0;
+  }
+  cpu->force_branch = BRANCH_FREE;
+  return taken;
+}
+
+/* Evaluates the condition of BEQ/BNE/BLT/BGE on the operand values */
+static int
+compare_branch_taken(CPU_Stage* stage)
+{
+  if (strcmp(stage->opcode, "BEQ") == 0) {
+    return stage->rs1_value == stage->rs2_value;
+  }
+  if (strcmp(stage->opcode, "BNE") == 0) {
+    return stage->rs1_value != stage->rs2_value;
+  }
+  if (strcmp(stage->opcode, "BLT") == 0) {
+    return stage->rs1_value < stage->rs2_value;
+  }
+  return stage->rs1_value >= stage->rs2_value;
+}
+
+/* Executes the second instruction of a fused pair, after the first */
+static void
+execute_fused(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  CPU_Fused* fused = &stage->fused;
+  const char* op = fused->opcode;
+
+  if (fused->kind == FUSE_MOVC_ALU) {
+    if (strcmp(op, "ADD") == 0) {
+      fused->buffer = stage->rs1_value + stage->rs2_value;
+    } else if (strcmp(op, "SUB") == 0) {
+      fused->buffer = stage->rs1_value - stage->rs2_value;
+    } else if (strcmp(op, "AND") == 0) {
+      fused->buffer = stage->rs1_value & stage->rs2_value;
+    } else if (strcmp(op, "OR") == 0) {
+      fused->buffer = stage->rs1_value | stage->rs2_value;
+    } else {
+      fused->buffer = stage->rs1_value ^ stage->rs2_value;
+    }
+    if (stage->arithmetic_instr) {
+      cpu->zero = fused->buffer == 0;
+    }
+    return;
+  }
+
+  /* The branch sees the flag the first instruction has just set */
+  int bz = strcmp(op, "BZ") == 0;
+  if (resolve_branch(cpu, bz ? cpu->zero == 1 : !cpu->zero)) {
+    stage->mem_address = fused->pc + fused->imm;
+    if (bz) {
+      cpu->zero = 0;
+    }
+  } else {
+    stage->mem_address = 0;
+  }
+}
+
 /*
  *  Execute Stage of APEX Pipeline implementation
  */
@@ -509,6 +908,7 @@ execute(APEX_CPU* cpu)
     if (strcmp(stage->opcode, "LOAD") == 0) 
   {
     stage->mem_address = stage->imm+stage->rs1_value;
+    stage->saved_zero = cpu->zero;
     }
 
   if (strcmp(stage->opcode, "JUMP") == 0) 
@@ -520,7 +920,7 @@ execute(APEX_CPU* cpu)
   if (strcmp(stage->opcode, "BZ") == 0)
    {  
     // && stage->arithmetic_instr==1
-    if(cpu->zero==1)
+    if(resolve_branch(cpu, cpu->zero==1))
     {
       
     //cpu->pc =(stage->pc) + (stage->imm);
@@ -533,10 +933,20 @@ execute(APEX_CPU* cpu)
   }
   }
   
+  if (is_compare_branch(stage->opcode))
+  {
+    if(resolve_branch(cpu, compare_branch_taken(stage)))
+    {
+      stage->mem_address = stage->pc + stage->imm;
+    } else {
+      stage->mem_address = 0;
+    }
+  }
+
   if (strcmp(stage->opcode, "BNZ") == 0) 
   { 
     // && stage->arithmetic_instr==1
-    if(!cpu->zero)
+    if(resolve_branch(cpu, !cpu->zero))
     {
     //cpu->pc =(stage->pc) + (stage->imm);
     stage->mem_address = stage->pc + stage->imm;
@@ -612,7 +1022,28 @@ execute(APEX_CPU* cpu)
        cpu->zero=0;
     }
 
-    if(strcmp(stage->opcode, "HALT") == 0)
+  if (strcmp(stage->opcode, "VLOAD") == 0)
+  {
+    stage->mem_address = stage->rs1_value + stage->imm;
+  }
+
+  if (strcmp(stage->opcode, "VSTORE") == 0)
+  {
+    stage->mem_address = stage->rs2_value + stage->imm;
+  }
+
+  if (is_vector_alu(stage->opcode))
+  {
+    vector_alu(stage->opcode, stage->vbuffer, stage->vs1_value,
+               stage->vs2_value);
+  }
+
+    if (stage->fused.kind)
+    {
+      execute_fused(cpu, stage);
+    }
+
+    if(strcmp(stage->opcode, "HALT") == 0 && !cpu->barrel)
      {
       stage->flush=1;
       cpu->stage[DRF].pc = 0;
@@ -625,27 +1056,131 @@ execute(APEX_CPU* cpu)
     }
 
     /* Copy data from Execute latch to Memory latch*/
-    cpu->stage[MEM] = cpu->stage[EX];
+    pipeline_pass(cpu, EX, &cpu->stage[EX]);
+    if (cpu->lanes) {
+      lockstep_execute(cpu, 1);
+    }
 
     if(ENABLE_DEBUG_MESSAGES)
      {
-      print_stage_content("Execute", stage);
+      print_stage_content(cpu, "Execute", stage);
      }
   }
   
   else
   {
-   cpu->stage[MEM] = cpu->stage[EX];
+   pipeline_pass(cpu, EX, &cpu->stage[EX]);
+   if (cpu->lanes) {
+     lockstep_execute(cpu, 0);
+   }
   if(ENABLE_DEBUG_MESSAGES)
    {
-      printf("Execute        : EMPTY\n");
+      print_trace_text(cpu, "Execute        : EMPTY\n");
     } 
   } 
   return 0;
 }
 
+/* Keeps the instruction in the memory stage for another cycle: writeback
+ * gets a bubble and the earlier stages keep their latches
+ */
+static void
+hold_memory(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  CPU_Stage bubble = *stage;
+  bubble.nop = 1;
+  pipeline_pass(cpu, MEM, &bubble);
+  if (ENABLE_DEBUG_MESSAGES) {
+    print_stage_content(cpu, "Memory", stage);
+  }
+}
+
+/* Sends fetch to the target of a taken branch in the memory stage, with
+ * the given offset, and squashes the instructions behind it
+ */
+static void
+take_branch(APEX_CPU* cpu, int target, int imm)
+{
+  cpu->pc = target;
+  cancel_loop_on_branch(cpu, target);
+
+  /* Another barrel thread is not on the wrong path, and a stall bubble or
+   * a predicted LOAD never took its destination
+   */
+  if (same_thread(cpu, EX) && !cpu->stage[EX].stalled &&
+      !cpu->stage[EX].predicted) {
+    pipeline_release(cpu, &cpu->stage[EX]);
+  }
+  /* With a split execute stage a MUL can be squashed between its two
+   * cycles there, while it still holds fetch and decode
+   */
+  if (same_thread(cpu, EX) && strcmp(cpu->stage[EX].opcode, "MUL") == 0 &&
+      cpu->stage[EX].mul_flag) {
+    cpu->stage[EX].mul_flag = 0;
+    cpu->stage[F].stalled = 0;
+    cpu->stage[F].busy = 0;
+    cpu->stage[DRF].stalled = 0;
+    cpu->stage[DRF].busy = 0;
+  }
+  if (same_thread(cpu, DRF)) {
+    cpu->stage[DRF].pc = 0;
+    strcpy(cpu->stage[DRF].opcode, "");
+  }
+  if (same_thread(cpu, EX)) {
+    strcpy(cpu->stage[EX].opcode, "");
+    cpu->stage[EX].pc = 0;
+  }
+  pipeline_squash(cpu);
+
+  /* Counted in instructions, which compressed code does not size alike */
+  int offset = code_index(cpu, target) - code_index(cpu, target - imm);
+  if (offset < 0) {
+    cpu->ins_completed = (cpu->ins_completed + offset) - 1;
+  } else {
+    cpu->ins_completed = (cpu->ins_completed - offset);
+  }
+  if (cpu->ex_halt) {
+    cpu->ex_halt = 0;
+    cpu->stage[F].stalled = 0;
+  }
+}
+
+/* Squashes the instructions behind a LOAD whose value was mispredicted
+ * and fetches them again. None of them has reached the memory stage, and
+ * the zero flag goes back to what it was when the LOAD executed.
+ */
+static void
+replay_load(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  CPU_Stage* ex = &cpu->stage[EX];
+
+  if (!ex->stalled && !ex->predicted) {
+    pipeline_release(cpu, ex);
+  }
+  strcpy(ex->opcode, "");
+  ex->pc = 0;
+  ex->arithmetic_instr = 0;
+  strcpy(cpu->stage[DRF].opcode, "");
+  cpu->stage[DRF].pc = 0;
+  cpu->stage[DRF].arithmetic_instr = 0;
+  pipeline_squash(cpu);
+
+  /* A hardware loop can only have been armed by a squashed LOOP, and a
+   * squashed MUL or HALT may be holding fetch
+   */
+  cpu->loop_active = 0;
+  cpu->ex_halt = 0;
+  cpu->stage[F].stalled = 0;
+  cpu->stage[F].busy = 0;
+  cpu->stage[DRF].busy = 0;
+  cpu->zero = stage->saved_zero;
+  cpu->pc = next_pc(cpu, stage->pc);
+}
+
 /*
- *  Memory Stage of APEX Pipeline implementation
+ *  Memory Stage of APEX Pipeline implementation. Returns 1 if the
+ *  instruction stays in the stage, in which case the earlier stages do
+ *  not run this cycle.
  */
 int
 memory(APEX_CPU* cpu)
@@ -654,83 +1189,68 @@ memory(APEX_CPU* cpu)
   if (!stage->busy && !stage->stalled && stage->nop==0) 
   {
     // printf("\nInside Memory IF\n");
-    /* Store */
-    if (strcmp(stage->opcode, "STORE") == 0) 
-    {
-    cpu->data_memory[stage->mem_address] = stage->rs1_value;
+    /* The load/store queue or the DMA engine may take the access or
+     * hold the stage
+     */
+    int access = cpu->lsq   ? lsq_memory(cpu, stage)
+                 : cpu->dma ? dma_memory(cpu, stage)
+                            : LSQ_ACCESS;
+    if (access == LSQ_HOLD) {
+      hold_memory(cpu, stage);
+      return 1;
     }
-  
-    /* LOAD */
-    if (strcmp(stage->opcode, "LOAD") == 0) 
-    {
-    stage->buffer= cpu->data_memory[stage->mem_address];
+
+    /* The address stream is the program's, whichever way it is served */
+    if (cpu->stack_distance) {
+      stackdist_memory(cpu, stage);
     }
 
-    if (strcmp(stage->opcode, "BZ") == 0) 
+    if (access == LSQ_ACCESS)
     {
-      if(stage->mem_address != 0) {
-        cpu->pc =stage->mem_address;
-
-
-        //printf("\nTesting: %d: %d\n",cpu->stage[EX].rd,cpu->regs_valid[cpu->stage[EX].rd]);
-        if((strcmp(cpu->stage[EX].opcode, "ADD") == 0) || (strcmp(cpu->stage[EX].opcode, "SUB") == 0) || (strcmp(cpu->stage[EX].opcode, "MUL") == 0) || (strcmp(cpu->stage[EX].opcode, "AND") == 0) || (strcmp(cpu->stage[EX].opcode, "OR") == 0) || (strcmp(cpu->stage[EX].opcode, "XOR") == 0) || (strcmp(cpu->stage[EX].opcode, "MOVC") == 0) || (strcmp(cpu->stage[EX].opcode, "LOAD") == 0)) {
-          cpu->regs_valid[cpu->stage[EX].rd]++;
-        }
-
-          //stage->flush=1;
-        cpu->stage[DRF].pc = 0;
-         strcpy(cpu->stage[DRF].opcode, "");
-         //cpu->stage[DRF].stalled = 1;
-        //cpu->stage[EX].stalled = 1;
-         strcpy(cpu->stage[EX].opcode, "");
-        cpu->stage[EX].pc = 0;
-        if(stage->imm < 0) {
-          cpu->ins_completed = (cpu->ins_completed + (stage->imm/4))-1;
-        }
-
-        else{
-          cpu->ins_completed = (cpu->ins_completed - (stage->imm/4));
-        }
-        if(cpu->ex_halt) {
-          cpu->ex_halt = 0;
-          cpu->stage[F].stalled =0;
-        }
+      /* Store */
+      if (strcmp(stage->opcode, "STORE") == 0) 
+      {
+      dmem_write(cpu, stage->mem_address, stage->rs1_value);
       }
-    }
   
-    if (strcmp(stage->opcode, "BNZ") == 0) 
-    {
-      if(stage->mem_address != 0) {
-        cpu->pc =stage->mem_address;
-
-      //printf("\nTesting: %d: %d\n",cpu->stage[EX].rd,cpu->regs_valid[cpu->stage[EX].rd]);
-        if((strcmp(cpu->stage[EX].opcode, "ADD") == 0) || (strcmp(cpu->stage[EX].opcode, "SUB") == 0) || (strcmp(cpu->stage[EX].opcode, "MUL") == 0) || (strcmp(cpu->stage[EX].opcode, "AND") == 0) || (strcmp(cpu->stage[EX].opcode, "OR") == 0) || (strcmp(cpu->stage[EX].opcode, "XOR") == 0) || (strcmp(cpu->stage[EX].opcode, "MOVC") == 0) || (strcmp(cpu->stage[EX].opcode, "LOAD") == 0)) {
-          cpu->regs_valid[cpu->stage[EX].rd]++;
-        }
-
-          //stage->flush=1;
-        cpu->stage[DRF].pc = 0;
-         strcpy(cpu->stage[DRF].opcode, "");
-         //cpu->stage[DRF].stalled = 1;
-        //cpu->stage[EX].stalled = 1;
-         strcpy(cpu->stage[EX].opcode, "");
-        cpu->stage[EX].pc = 0;
+      /* LOAD */
+      if (strcmp(stage->opcode, "LOAD") == 0) 
+      {
+      stage->buffer= dmem_read(cpu, stage->mem_address);
+      if (cpu->vpred && vpred_memory(cpu, stage)) {
+        replay_load(cpu, stage);
+      }
+      }
 
-        if(stage->imm < 0) {
-          cpu->ins_completed = (cpu->ins_completed + (stage->imm/4))-1;
+      /* Vector transfers move one word per lane */
+      if (strcmp(stage->opcode, "VSTORE") == 0)
+      {
+        for (int i = 0; i < VECTOR_LANES; ++i) {
+          dmem_write(cpu, stage->mem_address + 4 * i, stage->vs1_value[i]);
         }
+      }
 
-        else{
-          cpu->ins_completed = (cpu->ins_completed - (stage->imm/4));
-        }
-        if(cpu->ex_halt) {
-          cpu->ex_halt = 0;
-          cpu->stage[F].stalled =0;
+      if (strcmp(stage->opcode, "VLOAD") == 0)
+      {
+        for (int i = 0; i < VECTOR_LANES; ++i) {
+          stage->vbuffer[i] = dmem_read(cpu, stage->mem_address + 4 * i);
         }
       }
     }
 
-  if(strcmp(stage->opcode, "HALT") == 0) 
+    /* A taken branch resolved in execute redirects fetch here, and so
+     * does the branch of a fused pair
+     */
+    if ((strcmp(stage->opcode, "BZ") == 0 ||
+         strcmp(stage->opcode, "BNZ") == 0 ||
+         is_compare_branch(stage->opcode)) && stage->mem_address != 0) {
+      take_branch(cpu, stage->mem_address, stage->imm);
+    }
+    if (stage->fused.kind == FUSE_ALU_BRANCH && stage->mem_address != 0) {
+      take_branch(cpu, stage->mem_address, stage->fused.imm);
+    }
+
+  if(strcmp(stage->opcode, "HALT") == 0 && !cpu->barrel) 
   {
       cpu->stage[EX].pc = 0;
       strcpy(cpu->stage[EX].opcode, "");
@@ -744,27 +1264,66 @@ memory(APEX_CPU* cpu)
       cpu->ex_halt=1;
     }
 
+    if (cpu->steady) {
+      steady_memory(cpu, stage);
+    }
+
     /* Copy data from decode latch to execute latch*/
-    cpu->stage[WB] = cpu->stage[MEM];
+    pipeline_pass(cpu, MEM, &cpu->stage[MEM]);
+    if (cpu->lanes) {
+      lockstep_memory(cpu, 1);
+    }
 
     if (ENABLE_DEBUG_MESSAGES) 
     {
-      print_stage_content("Memory", stage);
+      print_stage_content(cpu, "Memory", stage);
     }
   }
   
    else
    {
-   cpu->stage[WB] = cpu->stage[MEM];
+   pipeline_pass(cpu, MEM, &cpu->stage[MEM]);
+   if (cpu->lanes) {
+     lockstep_memory(cpu, 0);
+   }
     if(ENABLE_DEBUG_MESSAGES)
     {
-       printf("Memory         : EMPTY\n");
+       print_trace_text(cpu, "Memory         : EMPTY\n");
     } 
   }
   
   return 0;
 }
 
+/* Hands an instruction being written back to the embedder's callback,
+ * both instructions of a fused pair
+ */
+static void
+report_retire(APEX_CPU* cpu, const CPU_Stage* stage)
+{
+  APEX_Instruction ins;
+  char text[128];
+
+  memcpy(ins.opcode, stage->opcode, sizeof(ins.opcode));
+  ins.rd = stage->rd;
+  ins.rs1 = stage->rs1;
+  ins.rs2 = stage->rs2;
+  ins.imm = stage->imm;
+  format_code(text, sizeof(text), &ins);
+  cpu->callbacks->retire(cpu->callbacks->ctx, cpu->clock, stage->pc, text);
+
+  if (stage->fused.kind) {
+    snprintf(ins.opcode, sizeof(ins.opcode), "%s", stage->fused.opcode);
+    ins.rd = stage->fused.rd;
+    ins.rs1 = stage->fused.rs1;
+    ins.rs2 = stage->fused.rs2;
+    ins.imm = stage->fused.imm;
+    format_code(text, sizeof(text), &ins);
+    cpu->callbacks->retire(cpu->callbacks->ctx, cpu->clock, stage->fused.pc,
+                           text);
+  }
+}
+
 /*
  *  Writeback Stage of APEX Pipeline implementation
  */
@@ -775,6 +1334,16 @@ writeback(APEX_CPU* cpu)
   // printf("\ncpu->regs_valid[stage->rd] %d:%d\n", stage->rd, cpu->regs_valid[stage->rd]);
   if (!stage->busy && !stage->stalled && stage->nop==0 && (strcmp(stage->opcode, "")!=0)) 
   {
+    if (cpu->watch) {
+      watch_retire(cpu, stage);
+    }
+    if (cpu->callbacks && cpu->callbacks->retire) {
+      report_retire(cpu, stage);
+    }
+
+    /* A LOAD still waiting for its data writes its register later */
+    int pending = cpu->lsq ? lsq_writeback(cpu, stage) : 0;
+
     /* Update register file */
     if (strcmp(stage->opcode, "MOVC") == 0) 
   {
@@ -784,7 +1353,7 @@ writeback(APEX_CPU* cpu)
     cpu->stage[F].stalled=0;  
     }
   
-  if (strcmp(stage->opcode, "LOAD") == 0) 
+  if (strcmp(stage->opcode, "LOAD") == 0 && !pending && !stage->predicted) 
   {
       cpu->regs[stage->rd] = stage->buffer;
     cpu->regs_valid[stage->rd]++;
@@ -841,8 +1410,31 @@ writeback(APEX_CPU* cpu)
     cpu->stage[F].stalled=0; 
     }
 
+  /* After MOVC, so the operation wins if both write the same register */
+  if (stage->fused.kind == FUSE_MOVC_ALU)
+  {
+    cpu->regs[stage->fused.rd] = stage->fused.buffer;
+    cpu->regs_valid[stage->fused.rd]++;
+  }
+
+  if (vector_writes_vreg(stage->opcode))
+  {
+    memcpy(cpu->vregs[stage->rd], stage->vbuffer, sizeof(stage->vbuffer));
+    cpu->vregs_valid[stage->rd]++;
+    cpu->stage[DRF].stalled=0;
+    cpu->stage[F].stalled=0;
+  }
+
+  if (is_vector_opcode(stage->opcode))
+  {
+    cpu->vector_completed++;
+  }
+
     if(strcmp(stage->opcode, "HALT") == 0) {
         cpu->ins_completed = cpu->code_memory_size - 1;
+      }
+
+    if(strcmp(stage->opcode, "HALT") == 0 && !cpu->barrel) {
         cpu->stage[EX].pc = 0;
         strcpy(cpu->stage[EX].opcode, "");
         cpu->stage[DRF].pc = 0;
@@ -858,11 +1450,23 @@ writeback(APEX_CPU* cpu)
         cpu->ex_halt=1;
       }
   
+    if (cpu->lanes) {
+      lockstep_writeback(cpu);
+    }
+
+    cpu->retired++;
     cpu->ins_completed++;
 
+    /* A fused pair retires as both its instructions */
+    if (stage->fused.kind) {
+      cpu->fused[stage->fused.kind]++;
+      cpu->retired++;
+      cpu->ins_completed++;
+    }
+
     if (ENABLE_DEBUG_MESSAGES) 
     {
-      print_stage_content("Writeback", stage);
+      print_stage_content(cpu, "Writeback", stage);
     }
   }
   
@@ -871,7 +1475,7 @@ writeback(APEX_CPU* cpu)
    
   if(ENABLE_DEBUG_MESSAGES)
    {
-      printf("Writeback      : EMPTY\n");
+      print_trace_text(cpu, "Writeback      : EMPTY\n");
 
     } 
   }
@@ -924,60 +1528,282 @@ void dispMem(APEX_CPU* cpu)
 {
   for(int i=0;i<100;i++)
   {
-    printf("\n\tMEM_Value[%d] || Value=%d",i,cpu->data_memory[i]);
+    printf("\n\tMEM_Value[%d] || Value=%d",i,dmem_read(cpu, i));
   }
 }
 
 /*
- *  APEX CPU simulation loop
+ * Returns 1 once all instructions committed and their memory accesses and
+ * DMA transfers completed, the cycle limit is reached or data memory ran
+ * out
  */
 int
-APEX_cpu_run(APEX_CPU* cpu)
+APEX_cpu_done(APEX_CPU* cpu)
 {
-  //valid(cpu);
-  
-  while (1) 
-  {
+  return (cpu->ins_completed == cpu->code_memory_size &&
+          (!cpu->lsq || lsq_idle(cpu)) && (!cpu->dma || dma_idle(cpu))) ||
+         cpu->clock == cpu->no_cycles || cpu->out_of_memory;
+}
 
-    /* All the instructions committed, so exit */
-    if (cpu->ins_completed == cpu->code_memory_size || cpu->clock==cpu->no_cycles) 
-    {
-      printf("\n%d==%d || %d==%d\n",cpu->ins_completed, cpu->code_memory_size, cpu->clock, cpu->no_cycles);
-      printf("(apex) >> Simulation Complete");
-      break;
+/*
+ * Advances the pipeline by one clock cycle
+ */
+void
+APEX_cpu_cycle(APEX_CPU* cpu)
+{
+  long start = cpu->host_profile ? hostprof_now() : 0;
+
+  if (ENABLE_DEBUG_MESSAGES && cpu->trace) {
+    trace_clock(cpu->trace, cpu->clock);
+  }
+
+  if (cpu->profile) {
+    profile_cycle(cpu);
+  }
+  pipeline_step(cpu);
+  if (cpu->lsq) {
+    lsq_cycle(cpu);
+  }
+  if (cpu->dma) {
+    dma_cycle(cpu);
+  }
+  cpu->clock++;
+  if (cpu->host_profile) {
+    hostprof_cycle(cpu, start);
+  }
+}
+
+/*
+ * Runs the cpu until it is done, without printing anything except the
+ * trace if one is open
+ */
+int
+APEX_cpu_simulate(APEX_CPU* cpu)
+{
+  while (!APEX_cpu_done(cpu)) {
+    APEX_cpu_cycle(cpu);
+  }
+  return 0;
+}
+
+/* Formats text like printf and hands it to sink */
+static void
+emit(APEX_Sink sink, void* ctx, const char* fmt, ...)
+{
+  char text[256];
+  va_list args;
+
+  va_start(args, fmt);
+  int len = vsnprintf(text, sizeof(text), fmt, args);
+  va_end(args);
+  if (len >= (int)sizeof(text)) {
+    len = sizeof(text) - 1;
+  }
+  sink(ctx, text, len);
+}
+
+/*
+ * Writes the register file and the start of data memory to sink
+ */
+void
+APEX_cpu_write_state(APEX_CPU* cpu, APEX_Sink sink, void* ctx)
+{
+  emit(sink, ctx, "\n");
+  emit(sink, ctx, "=====REGISTER VALUE============\n");
+  for (int i = 0; i < 16; i++) {
+    emit(sink, ctx, "\n");
+    emit(sink, ctx, " | Register[%d] | Value=%d | status=%s | \n", i,
+         cpu->regs[i], (cpu->regs_valid[i]) ? "Valid" : "Invalid");
+  }
+  if (cpu->vector_completed) {
+    emit(sink, ctx, "=====VECTOR REGISTERS==========\n");
+    for (int i = 0; i < VECTOR_REGS; i++) {
+      emit(sink, ctx, " | V%d |", i);
+      for (int j = 0; j < VECTOR_LANES; j++) {
+        emit(sink, ctx, " %d", cpu->vregs[i][j]);
+      }
+      emit(sink, ctx, " | status=%s | \n",
+           cpu->vregs_valid[i] ? "Valid" : "Invalid");
     }
+  }
+  emit(sink, ctx, "=======DATA MEMORY===========\n");
 
+  for (int i = 0; i < 99; i++) {
+    emit(sink, ctx, " | MEM[%d] | Value=%d | \n", i, dmem_read(cpu, i));
+  }
+}
 
+static void
+write_stdout(void* ctx, const char* text, size_t len)
+{
+  (void)ctx;
+  fwrite(text, 1, len, stdout);
+}
 
-    if(ENABLE_DEBUG_MESSAGES)
-    {
-      printf("--------------------------------\n");
-      printf("Clock Cycle #: %d\n", cpu->clock);
-      printf("--------------------------------\n");
+/*
+ * Dumps the register file and the start of data memory
+ */
+void
+APEX_cpu_print_state(APEX_CPU* cpu)
+{
+  APEX_cpu_write_state(cpu, write_stdout, NULL);
+}
+
+/*
+ *  APEX CPU simulation loop
+ */
+int
+APEX_cpu_run(APEX_CPU* cpu)
+{
+  /* With breakpoints set the run is quiet up to the first hit, otherwise
+   * only display mode produces the cycle by cycle trace
+   */
+  if (cpu->watch) {
+    watch_simulate(cpu);
+  } else if (ENABLE_DEBUG_MESSAGES && cpu->sim &&
+             strcmp(cpu->sim, "display") == 0) {
+    cpu->trace = trace_open(stdout);
+    if (cpu->trace && cpu->host_profile) {
+      hostprof_attach_trace(cpu);
     }
-  
-  // printf("\n\n\n============================REGISTER VALID=========================");
-  // dispRegValid(cpu);
-  
-    writeback(cpu);
-    memory(cpu);
-    execute(cpu);
-    decode(cpu);
-    fetch(cpu);
-    cpu->clock++;
+    APEX_cpu_simulate(cpu);
+  } else if (cpu->cache) {
+    cache_simulate(cpu);
+  } else if (cpu->checkpoints) {
+    checkpoint_simulate(cpu);
+  } else if (cpu->steady) {
+    steady_simulate(cpu);
+  } else {
+    APEX_cpu_simulate(cpu);
+  }
+
+  /* All the instructions committed, so exit */
+  trace_close(cpu->trace);
+  cpu->trace = NULL;
+  if (cpu->out_of_memory) {
+    fprintf(stderr, "APEX_Error : Out of memory for data memory, run "
+                    "stopped at cycle %d\n",
+            cpu->clock);
+    return 1;
+  }
+  printf("\n%d==%d || %d==%d\n", cpu->ins_completed, cpu->code_memory_size,
+         cpu->clock, cpu->no_cycles);
+  printf(watch_stopped(cpu) ? "(apex) >> Simulation Stopped"
+                            : "(apex) >> Simulation Complete");
+  if (cpu->loop_iterations) {
+    printf("\n(apex) >> Hardware loop iterations=%d, loop buffer fetches=%d",
+           cpu->loop_iterations, cpu->loop_buffer_fetches);
+  }
+  if (cpu->lsq) {
+    lsq_print(cpu);
+  }
+  if (cpu->dma) {
+    dma_print(cpu);
+  }
+  if (cpu->vpred) {
+    vpred_print(cpu);
+  }
+  if (cpu->fuse) {
+    fusion_print(cpu);
+  }
+  if (cpu->compressed) {
+    compress_print(cpu);
+  }
+  if (pipeline_depth(cpu) > NUM_STAGES) {
+    printf("\n(apex) >> Pipeline depth=%d stages, CPI=%.2f",
+           pipeline_depth(cpu),
+           cpu->retired ? (double)cpu->clock / cpu->retired : 0.0);
+  }
+  if (cpu->profile) {
+    profile_print(cpu);
+  }
+  if (cpu->stack_distance) {
+    stackdist_print(cpu);
+  }
+
+  APEX_cpu_print_state(cpu);
+  return 0;
 }
-  printf("\n");
-  printf("=====REGISTER VALUE============\n");
-  for(int i=0;i<16;i++)
-  {printf("\n");
-  printf(" | Register[%d] | Value=%d | status=%s | \n",i,cpu->regs[i],(cpu->regs_valid[i])?"Valid" : "Invalid");
-      
+
+/*
+ * This function creates a copy of the cpu that can run independently.
+ * Registers, latches and statistics are copied; code memory and data
+ * memory pages are shared, and a data page is only copied when one of
+ * the cpus writes to it. The clone has no trace, and the features that
+ * keep state of their own stay with the cpu, so clones can run on other
+ * threads.
+ */
+APEX_CPU*
+APEX_cpu_clone(APEX_CPU* cpu)
+{
+  APEX_CPU* clone = malloc(sizeof(*clone));
+  if (!clone) {
+    return NULL;
   }
-printf("=======DATA MEMORY===========\n");
 
-  for(int i=0;i<99;i++)
-  {
-  printf(" | MEM[%d] | Value=%d | \n",i,cpu->data_memory[i]);
+  *clone = *cpu;
+  clone->trace = NULL;
+  clone->watch = NULL;
+  clone->checkpoints = NULL;
+  clone->cache = NULL;
+  clone->steady = NULL;
+  clone->lsq = NULL;
+  clone->dma = NULL;
+  clone->profile = NULL;
+  clone->vpred = NULL;
+  clone->stack_distance = NULL;
+  clone->host_profile = NULL;
+  clone->callbacks = NULL;
+  atomic_fetch_add(cpu->code_refs, 1);
+  dmem_share(clone, cpu);
+  return clone;
+}
+
+/*
+ * Forks the cpu into n clones. Returns 0 on success; on failure no clone
+ * is left allocated.
+ */
+int
+APEX_cpu_fork(APEX_CPU* cpu, int n, APEX_CPU** clones)
+{
+  for (int i = 0; i < n; ++i) {
+    clones[i] = APEX_cpu_clone(cpu);
+    if (!clones[i]) {
+      while (i--) {
+        APEX_cpu_stop(clones[i]);
+      }
+      return -1;
+    }
   }
   return 0;
-  }
\ No newline at end of file
+}
+
+static void*
+simulate_thread(void* arg)
+{
+  APEX_cpu_simulate(arg);
+  return NULL;
+}
+
+/*
+ * Runs each cpu to completion on its own host thread
+ */
+int
+APEX_cpu_run_parallel(APEX_CPU** cpus, int n)
+{
+  pthread_t threads[n];
+  int started[n];
+
+  for (int i = 0; i < n; ++i) {
+    started[i] = pthread_create(&threads[i], NULL, simulate_thread, cpus[i]) == 0;
+    if (!started[i]) {
+      APEX_cpu_simulate(cpus[i]);
+    }
+  }
+  for (int i = 0; i < n; ++i) {
+    if (started[i]) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+  return 0;
+}
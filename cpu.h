@@ -5,6 +5,28 @@
  *  Contains various CPU and Pipeline Data structures
  */
 
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "libapex.h"
+
+/* Data memory is split into pages that clones share copy-on-write */
+#define DATA_MEMORY_SIZE 4096
+#define DMEM_PAGE_WORDS 256
+#define DMEM_PAGES (DATA_MEMORY_SIZE / DMEM_PAGE_WORDS)
+
+#define INT_REGS 16
+
+/* Vector register file: VECTOR_REGS registers of VECTOR_LANES words */
+#define VECTOR_REGS 8
+#define VECTOR_LANES 4
+
+/* Instructions held by the hardware loop buffer */
+#define LOOP_BUFFER_SIZE 16
+
+/* Most extra cycles a pipeline stage can be split into */
+#define PIPELINE_MAX_EXTRA 3
+
 enum
 {
   F,
@@ -15,6 +37,23 @@ enum
   NUM_STAGES
 };
 
+/* Outcome override for the next conditional branch, used by clones */
+enum
+{
+  BRANCH_FREE,
+  BRANCH_FORCE_TAKEN,
+  BRANCH_FORCE_NOT_TAKEN
+};
+
+/* Pairs of instructions decode can issue as one micro-op */
+enum
+{
+  FUSE_NONE,
+  FUSE_MOVC_ALU,	// MOVC and an ADD/SUB/AND/OR/XOR reading its register
+  FUSE_ALU_BRANCH,	// ADD/SUB and the BZ/BNZ after it
+  FUSE_KINDS
+};
+
 /* Format of an APEX instruction  */
 typedef struct APEX_Instruction
 {
@@ -23,8 +62,23 @@ typedef struct APEX_Instruction
   int rs1;		    // Source-1 Register Address
   int rs2;		    // Source-2 Register Address
   int imm;		    // Literal Value
+  int size;	// Encoded bytes and pc, set once the program is compressed
+  int pc;
 } APEX_Instruction;
 
+/* Second instruction of a fused pair, carried in the latch of the first */
+typedef struct CPU_Fused
+{
+  int kind;	// FUSE_* pair, FUSE_NONE for a single instruction
+  int pc;
+  char opcode[8];
+  int rd;
+  int rs1;
+  int rs2;
+  int imm;
+  int buffer;	// Result of an ALU operation
+} CPU_Fused;
+
 /* Model of CPU stage latch */
 typedef struct CPU_Stage
 {
@@ -46,6 +100,14 @@ typedef struct CPU_Stage
   int flush;
   int arithmetic_instr;
   int bubble;
+  int vs1_value[VECTOR_LANES];	// Vector Source-1 Value
+  int vs2_value[VECTOR_LANES];	// Vector Source-2 Value
+  int vbuffer[VECTOR_LANES];	// Vector result latch
+  int tid;		    // Hardware thread that fetched the instruction
+  int predicted;	// LOAD whose register got a predicted value, VPRED_*
+  int prediction;	// Value it got
+  int saved_zero;	// Zero flag when that LOAD executed
+  CPU_Fused fused;
 } CPU_Stage;
 
 /* Model of APEX CPU */
@@ -64,41 +126,185 @@ typedef struct APEX_CPU
   int ex_halt;
 
   /* Integer register file */
-  int regs[16];
-  int regs_valid[16];
-  int buff_valid[16];
+  int regs[INT_REGS];
+  int regs_valid[INT_REGS];
+  int buff_valid[INT_REGS];
+
+  /* Vector register file */
+  int vregs[VECTOR_REGS][VECTOR_LANES];
+  int vregs_valid[VECTOR_REGS];
 
   /* Array of 5 CPU_stage */
   CPU_Stage stage[5];
 
+  /* Split stages: extra cycles of each stage and the sub-stage latches
+   * between it and the next stage, oldest last
+   */
+  int stage_extra[NUM_STAGES];
+  CPU_Stage transit[NUM_STAGES][PIPELINE_MAX_EXTRA];
+
   /* Code Memory where instructions are stored */
   APEX_Instruction* code_memory;
   int code_memory_size;
+  atomic_int* code_refs;	// Clones sharing code_memory
+
+  /* Mixed-width code: 1 once code memory is laid out with compressed
+   * instructions, then the last fetch word read and fetch statistics
+   */
+  int compressed;
+  int fetch_word;
+  int fetches;
+  int fetch_words;
 
   /* Data Memory */
-  int data_memory[4096];
+  struct APEX_Page* data_pages[DMEM_PAGES];
+  int out_of_memory;	// 1 once a write could not get its page; ends the run
 
   /* Some stats */
   int ins_completed;
+  int retired;		// Instructions written back, no branch adjustment
 
   const char * sim;
 
   int no_cycles;
 
+  /* Pipeline trace, only open in display mode */
+  struct APEX_Trace* trace;
+
+  int vector_completed;
+
+  /* Hardware loop: loop count register and loop buffer, armed by LOOP */
+  int loop_active;
+  int loop_start;
+  int loop_end;
+  int loop_count;
+  APEX_Instruction loop_buffer[LOOP_BUFFER_SIZE];
+
+  /* Hardware loop stats */
+  int loop_iterations;
+  int loop_buffer_fetches;
+
+  /* Macro-op fusion: enabled pairs, one bit per FUSE_* kind, and the
+   * pairs fused so far
+   */
+  int fuse;
+  int fused[FUSE_KINDS];
+
+  /* Forced outcome of the next conditional branch */
+  int force_branch;
+
+  /* Lockstep group this cpu leads, NULL for a normal run */
+  struct LaneGroup* lanes;
+
+  /* Shared memory port of a multicore run, NULL for private data memory */
+  struct APEX_Port* port;
+
+  /* Barrel multithreading: thread contexts and the one now loaded */
+  struct APEX_Barrel* barrel;
+  int thread;
+
+  /* Breakpoints and watchpoints, NULL when none are set */
+  struct APEX_Watch* watch;
+
+  /* Incremental re-simulation: checkpoint directory, NULL when unused,
+   * and the highest code memory index read so far
+   */
+  struct APEX_Checkpoints* checkpoints;
+  int code_reach;
+
+  /* Result cache, NULL when unused */
+  struct APEX_Cache* cache;
+
+  /* Steady-state loop fast-forwarding, NULL when off */
+  struct APEX_Steady* steady;
+
+  /* Data memory latency and load/store queue, NULL for single cycle
+   * data memory
+   */
+  struct APEX_LSQ* lsq;
+
+  /* DMA engine mapped after data memory, NULL when not attached */
+  struct APEX_DMA* dma;
+
+  /* Per-instruction cycle attribution, NULL when off */
+  struct APEX_Profile* profile;
+
+  /* Load value prediction, NULL when off */
+  struct APEX_ValuePredictor* vpred;
+
+  /* LRU stack distances of the data address stream, NULL when off */
+  struct APEX_StackDistance* stack_distance;
+
+  /* Host time instrumentation, NULL when off */
+  struct APEX_HostProfile* host_profile;
+
+  /* Event callbacks of the program embedding the simulator, NULL when
+   * there are none
+   */
+  const APEX_Callbacks* callbacks;
+
 } APEX_CPU;
 
 APEX_Instruction*
 create_code_memory(const char* filename, int* size);
 
+APEX_Instruction*
+create_code_memory_from_buffer(const char* text, size_t len, int* size);
+
+int
+format_code(char* dst, size_t size, const APEX_Instruction* ins);
+
+int
+is_valid_instruction(const APEX_Instruction* ins);
+
+int
+get_code_index(int pc);
+
+int
+code_index(const APEX_CPU* cpu, int pc);
+
+int
+code_pc(const APEX_CPU* cpu, int index);
+
+int
+is_compare_branch(const char* opcode);
+
 APEX_CPU*
 APEX_cpu_init(const char* filename);
 
+APEX_CPU*
+APEX_cpu_init_code(APEX_Instruction* code_memory, int size);
+
 int
 APEX_cpu_run(APEX_CPU* cpu);
 
 void
 APEX_cpu_stop(APEX_CPU* cpu);
 
+int
+APEX_cpu_done(APEX_CPU* cpu);
+
+void
+APEX_cpu_cycle(APEX_CPU* cpu);
+
+int
+APEX_cpu_simulate(APEX_CPU* cpu);
+
+void
+APEX_cpu_print_state(APEX_CPU* cpu);
+
+void
+APEX_cpu_write_state(APEX_CPU* cpu, APEX_Sink sink, void* ctx);
+
+APEX_CPU*
+APEX_cpu_clone(APEX_CPU* cpu);
+
+int
+APEX_cpu_fork(APEX_CPU* cpu, int n, APEX_CPU** clones);
+
+int
+APEX_cpu_run_parallel(APEX_CPU** cpus, int n);
+
 int
 fetch(APEX_CPU* cpu);
 
@@ -0,0 +1,186 @@
+/*
+ *  dma.c
+ *  Contains the memory-mapped DMA engine
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dma.h"
+#include "dmem.h"
+#include "lsq.h"
+
+struct APEX_DMA
+{
+  int bandwidth;	// Words moved per cycle
+
+  /* Device registers; source and destination advance as words move */
+  int src;
+  int dst;
+  int value;
+  int left;	// Words still to move, 0 when idle
+  int fill;	// 1 if the transfer writes value instead of copying
+
+  int port_cycle;	// Last cycle the memory stage used data memory
+
+  /* Statistics */
+  int transfers;
+  int words;
+  int busy_cycles;	// Cycles with a transfer in progress
+  int port_conflicts;	// Of those, cycles the memory stage had the port
+  int wait_stalls;	// Cycles the memory stage waited on the engine
+};
+
+/*
+ * Attaches the engine to cpu, moving bandwidth words per cycle
+ */
+APEX_DMA*
+dma_create(APEX_CPU* cpu, int bandwidth)
+{
+  APEX_DMA* dma = calloc(1, sizeof(*dma));
+  if (!dma) {
+    return NULL;
+  }
+  dma->bandwidth = bandwidth > 0 ? bandwidth : DMA_DEFAULT_BANDWIDTH;
+  dma->port_cycle = -1;
+  cpu->dma = dma;
+  return dma;
+}
+
+void
+dma_destroy(APEX_DMA* dma)
+{
+  free(dma);
+}
+
+/* Returns 1 once no transfer is in progress */
+int
+dma_idle(APEX_CPU* cpu)
+{
+  return cpu->dma->left == 0;
+}
+
+static int
+is_register(int address)
+{
+  return address >= DMA_BASE && address <= DMA_WAIT &&
+         (address - DMA_BASE) % 4 == 0;
+}
+
+static int
+read_register(APEX_DMA* dma, int address)
+{
+  switch (address) {
+    case DMA_SRC:
+      return dma->src;
+    case DMA_DST:
+      return dma->dst;
+    case DMA_VALUE:
+      return dma->value;
+    case DMA_COPY:
+    case DMA_FILL:
+      return dma->left;
+  }
+  return 0;
+}
+
+static void
+write_register(APEX_DMA* dma, int address, int value)
+{
+  switch (address) {
+    case DMA_SRC:
+      dma->src = value;
+      break;
+    case DMA_DST:
+      dma->dst = value;
+      break;
+    case DMA_VALUE:
+      dma->value = value;
+      break;
+    case DMA_COPY:
+    case DMA_FILL:
+      if (value > 0) {
+        dma->left = value;
+        dma->fill = address == DMA_FILL;
+        dma->transfers++;
+      }
+      break;
+  }
+}
+
+/*
+ * Called by the memory stage before it accesses data memory. Serves the
+ * device registers itself, returning LSQ_DONE, or LSQ_HOLD while the
+ * instruction has to wait for the engine. Any other access goes to data
+ * memory and takes the port for the cycle.
+ */
+int
+dma_memory(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  APEX_DMA* dma = cpu->dma;
+  int load = strcmp(stage->opcode, "LOAD") == 0;
+  int store = strcmp(stage->opcode, "STORE") == 0;
+
+  if ((load || store) && is_register(stage->mem_address)) {
+    int waits = load ? stage->mem_address == DMA_WAIT
+                     : stage->mem_address == DMA_COPY ||
+                         stage->mem_address == DMA_FILL;
+    if (waits && dma->left) {
+      dma->wait_stalls++;
+      return LSQ_HOLD;
+    }
+    if (load) {
+      stage->buffer = read_register(dma, stage->mem_address);
+    } else {
+      write_register(dma, stage->mem_address, stage->rs1_value);
+    }
+    return LSQ_DONE;
+  }
+
+  if (load || store || strcmp(stage->opcode, "VLOAD") == 0 ||
+      strcmp(stage->opcode, "VSTORE") == 0) {
+    dma->port_cycle = cpu->clock;
+  }
+  return LSQ_ACCESS;
+}
+
+/*
+ * Moves the words of this cycle, after the pipeline has run, unless the
+ * memory stage used the port
+ */
+void
+dma_cycle(APEX_CPU* cpu)
+{
+  APEX_DMA* dma = cpu->dma;
+
+  if (!dma->left) {
+    return;
+  }
+  dma->busy_cycles++;
+  if (dma->port_cycle == cpu->clock) {
+    dma->port_conflicts++;
+    return;
+  }
+
+  for (int i = 0; i < dma->bandwidth && dma->left; ++i) {
+    int value = dma->fill ? dma->value : dmem_read(cpu, dma->src);
+    dmem_write(cpu, dma->dst, value);
+    if (!dma->fill) {
+      dma->src += DMA_STRIDE;
+    }
+    dma->dst += DMA_STRIDE;
+    dma->left--;
+    dma->words++;
+  }
+}
+
+void
+dma_print(APEX_CPU* cpu)
+{
+  APEX_DMA* dma = cpu->dma;
+
+  printf("\n(apex) >> DMA bandwidth=%d words/cycle, transfers=%d, words=%d, "
+         "busy cycles=%d, port conflicts=%d, wait stalls=%d",
+         dma->bandwidth, dma->transfers, dma->words, dma->busy_cycles,
+         dma->port_conflicts, dma->wait_stalls);
+}
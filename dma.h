@@ -0,0 +1,53 @@
+#ifndef _APEX_DMA_H_
+#define _APEX_DMA_H_
+/**
+ *  dma.h
+ *  Memory-mapped DMA engine.
+ *
+ *  The device registers sit right after data memory. A program stores
+ *  the source, destination and fill value, then starts a transfer by
+ *  storing a word count to DMA_COPY (copy from the source) or DMA_FILL
+ *  (write the value). Words are DMA_STRIDE addresses apart, as LOAD and
+ *  STORE lay out arrays. The transfer runs alongside the pipeline at a
+ *  set number of words per cycle, but data memory has one port: in a
+ *  cycle where the memory stage accesses data memory the engine waits.
+ *  Loading DMA_COPY or DMA_FILL returns the words left, for polling;
+ *  loading DMA_WAIT holds the memory stage until the engine is idle, and
+ *  so does starting a transfer while one is running.
+ */
+#include "cpu.h"
+
+#define DMA_DEFAULT_BANDWIDTH 1	// Words per cycle
+#define DMA_STRIDE 4
+
+/* Device registers */
+#define DMA_BASE DATA_MEMORY_SIZE
+#define DMA_SRC (DMA_BASE + 0)
+#define DMA_DST (DMA_BASE + 4)
+#define DMA_VALUE (DMA_BASE + 8)
+#define DMA_COPY (DMA_BASE + 12)
+#define DMA_FILL (DMA_BASE + 16)
+#define DMA_WAIT (DMA_BASE + 20)
+
+typedef struct APEX_DMA APEX_DMA;
+
+APEX_DMA*
+dma_create(APEX_CPU* cpu, int bandwidth);
+
+void
+dma_destroy(APEX_DMA* dma);
+
+int
+dma_idle(APEX_CPU* cpu);
+
+void
+dma_print(APEX_CPU* cpu);
+
+/* Hooks, called only while the device is attached */
+int
+dma_memory(APEX_CPU* cpu, CPU_Stage* stage);
+
+void
+dma_cycle(APEX_CPU* cpu);
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ *  dmem.c
+ *  Contains the paged, copy-on-write data memory of the APEX cpu
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "dmem.h"
+#include "multicore.h"
+#include "watch.h"
+
+static void
+page_put(APEX_Page* page)
+{
+  if (page &&
+      atomic_fetch_sub_explicit(&page->refs, 1, memory_order_acq_rel) == 1) {
+    free(page);
+  }
+}
+
+/*
+ * Reads one word of data memory. Addresses outside data memory read as 0.
+ */
+int
+dmem_read(APEX_CPU* cpu, int address)
+{
+  if (cpu->port) {
+    return port_read(cpu->port, address);
+  }
+  if (address < 0 || address >= DATA_MEMORY_SIZE) {
+    return 0;
+  }
+
+  APEX_Page* page = cpu->data_pages[address / DMEM_PAGE_WORDS];
+  return page ? page->words[address % DMEM_PAGE_WORDS] : 0;
+}
+
+/*
+ * Writes one word of data memory. A page still shared with another CPU is
+ * copied first, so only pages that are actually written ever diverge.
+ * Writes outside data memory are dropped. Returns -1, and sets
+ * out_of_memory so the run stops, if the page cannot be allocated.
+ */
+int
+dmem_write(APEX_CPU* cpu, int address, int value)
+{
+  if (cpu->watch) {
+    watch_store(cpu, address, value);
+  }
+  if (cpu->port) {
+    port_write(cpu->port, address, value);
+    return 0;
+  }
+  if (address < 0 || address >= DATA_MEMORY_SIZE) {
+    return 0;
+  }
+
+  APEX_Page** slot = &cpu->data_pages[address / DMEM_PAGE_WORDS];
+  APEX_Page* page = *slot;
+
+  if (!page || atomic_load_explicit(&page->refs, memory_order_acquire) > 1) {
+    APEX_Page* copy = malloc(sizeof(*copy));
+    if (!copy) {
+      cpu->out_of_memory = 1;
+      return -1;
+    }
+    if (page) {
+      memcpy(copy->words, page->words, sizeof(copy->words));
+    } else {
+      memset(copy->words, 0, sizeof(copy->words));
+    }
+    atomic_init(&copy->refs, 1);
+    page_put(page);
+    *slot = page = copy;
+  }
+  page->words[address % DMEM_PAGE_WORDS] = value;
+  return 0;
+}
+
+/*
+ * Makes dst reference the same pages as src. Costs one reference count
+ * update per resident page, independent of how much memory is in use.
+ */
+void
+dmem_share(APEX_CPU* dst, APEX_CPU* src)
+{
+  for (int i = 0; i < DMEM_PAGES; ++i) {
+    APEX_Page* page = src->data_pages[i];
+    if (page) {
+      atomic_fetch_add_explicit(&page->refs, 1, memory_order_relaxed);
+    }
+    dst->data_pages[i] = page;
+  }
+}
+
+void
+dmem_release(APEX_CPU* cpu)
+{
+  for (int i = 0; i < DMEM_PAGES; ++i) {
+    page_put(cpu->data_pages[i]);
+    cpu->data_pages[i] = NULL;
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef _APEX_DMEM_H_
+#define _APEX_DMEM_H_
+/**
+ *  dmem.h
+ *  Paged data memory. Pages are reference counted so that cloned CPUs
+ *  share them until one side writes (copy-on-write). A missing page
+ *  reads as all zeros.
+ */
+#include <stdatomic.h>
+
+#include "cpu.h"
+
+typedef struct APEX_Page
+{
+  atomic_int refs;
+  int words[DMEM_PAGE_WORDS];
+} APEX_Page;
+
+int
+dmem_read(APEX_CPU* cpu, int address);
+
+int
+dmem_write(APEX_CPU* cpu, int address, int value);
+
+void
+dmem_share(APEX_CPU* dst, APEX_CPU* src);
+
+void
+dmem_release(APEX_CPU* cpu);
+
+#endif
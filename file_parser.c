@@ -8,6 +8,7 @@
 #include <string.h>
 
 #include "cpu.h"
+#include "vector.h"
 
 /*
  * This function is related to parsing input file
@@ -35,13 +36,14 @@ get_num_from_string(char* buffer)
 static void
 create_APEX_instruction(APEX_Instruction* ins, char* buffer)
 {
-  char* token = strtok(buffer, ",");
+  char* save = NULL;
+  char* token = strtok_r(buffer, ",", &save);
   int token_num = 0;
   char tokens[6][128];
   while (token != NULL) {
     strcpy(tokens[token_num], token);
     token_num++;
-    token = strtok(NULL, ",");
+    token = strtok_r(NULL, ",", &save);
   }
 
   strcpy(ins->opcode, tokens[0]);
@@ -112,6 +114,38 @@ create_APEX_instruction(APEX_Instruction* ins, char* buffer)
 	  ins->imm = get_num_from_string(tokens[1]);  
   }
   
+  if(strcmp(ins->opcode, "BEQ")==0 || strcmp(ins->opcode, "BNE")==0 ||
+     strcmp(ins->opcode, "BLT")==0 || strcmp(ins->opcode, "BGE")==0) {
+	  ins->rs1 = get_num_from_string(tokens[1]);
+	  ins->rs2 = get_num_from_string(tokens[2]);
+	  ins->imm = get_num_from_string(tokens[3]);
+  }
+  
+  if(strcmp(ins->opcode, "VLOAD")==0) {
+    ins->rd = get_num_from_string(tokens[1]);
+    ins->rs1 = get_num_from_string(tokens[2]);
+    ins->imm = get_num_from_string(tokens[3]);
+  }
+  
+  if(strcmp(ins->opcode, "VSTORE")==0) {
+    ins->rs1 = get_num_from_string(tokens[1]);
+    ins->rs2 = get_num_from_string(tokens[2]);
+    ins->imm = get_num_from_string(tokens[3]);
+  }
+  
+  if(strcmp(ins->opcode, "VADD")==0 || strcmp(ins->opcode, "VSUB")==0 ||
+     strcmp(ins->opcode, "VMUL")==0 || strcmp(ins->opcode, "VAND")==0 ||
+     strcmp(ins->opcode, "VOR")==0 || strcmp(ins->opcode, "VXOR")==0) {
+    ins->rd = get_num_from_string(tokens[1]);
+    ins->rs1 = get_num_from_string(tokens[2]);
+    ins->rs2 = get_num_from_string(tokens[3]);
+  }
+  
+  if(strcmp(ins->opcode, "LOOP")==0) {
+	  ins->rs1 = get_num_from_string(tokens[1]);
+	  ins->imm = get_num_from_string(tokens[2]);
+  }
+  
   if(strcmp(ins->opcode, "HALT")==0) {
 	    
   }
@@ -121,25 +155,136 @@ create_APEX_instruction(APEX_Instruction* ins, char* buffer)
   
 
 
+}
+
+/* Register operands of an instruction: none, integer or vector */
+enum
+{
+  OPERAND_NONE,
+  OPERAND_R,
+  OPERAND_V
+};
+
+static const struct
+{
+  const char* opcode;
+  char rd, rs1, rs2;
+} instruction_formats[] = {
+  { "MOVC", OPERAND_R, OPERAND_NONE, OPERAND_NONE },
+  { "STORE", OPERAND_NONE, OPERAND_R, OPERAND_R },
+  { "LOAD", OPERAND_R, OPERAND_R, OPERAND_NONE },
+  { "ADD", OPERAND_R, OPERAND_R, OPERAND_R },
+  { "SUB", OPERAND_R, OPERAND_R, OPERAND_R },
+  { "AND", OPERAND_R, OPERAND_R, OPERAND_R },
+  { "OR", OPERAND_R, OPERAND_R, OPERAND_R },
+  { "XOR", OPERAND_R, OPERAND_R, OPERAND_R },
+  { "MUL", OPERAND_R, OPERAND_R, OPERAND_R },
+  { "JUMP", OPERAND_NONE, OPERAND_R, OPERAND_NONE },
+  { "BZ", OPERAND_NONE, OPERAND_NONE, OPERAND_NONE },
+  { "BNZ", OPERAND_NONE, OPERAND_NONE, OPERAND_NONE },
+  { "BEQ", OPERAND_NONE, OPERAND_R, OPERAND_R },
+  { "BNE", OPERAND_NONE, OPERAND_R, OPERAND_R },
+  { "BLT", OPERAND_NONE, OPERAND_R, OPERAND_R },
+  { "BGE", OPERAND_NONE, OPERAND_R, OPERAND_R },
+  { "LOOP", OPERAND_NONE, OPERAND_R, OPERAND_NONE },
+  { "HALT", OPERAND_NONE, OPERAND_NONE, OPERAND_NONE },
+  { "VLOAD", OPERAND_V, OPERAND_R, OPERAND_NONE },
+  { "VSTORE", OPERAND_NONE, OPERAND_V, OPERAND_R },
+  { "VADD", OPERAND_V, OPERAND_V, OPERAND_V },
+  { "VSUB", OPERAND_V, OPERAND_V, OPERAND_V },
+  { "VMUL", OPERAND_V, OPERAND_V, OPERAND_V },
+  { "VAND", OPERAND_V, OPERAND_V, OPERAND_V },
+  { "VOR", OPERAND_V, OPERAND_V, OPERAND_V },
+  { "VXOR", OPERAND_V, OPERAND_V, OPERAND_V }
+};
+
+static int
+valid_operand(int kind, int reg)
+{
+  switch (kind) {
+    case OPERAND_R:
+      return reg >= 0 && reg < INT_REGS;
+    case OPERAND_V:
+      return reg >= 0 && reg < VECTOR_REGS;
+  }
+  return 1;
 }
 
 /*
- * This function is related to parsing input file
- *
- * Note : You are not supposed to edit this function
+ * Returns 1 if ins is an instruction the simulator runs and every
+ * register it names exists
  */
-APEX_Instruction*
-create_code_memory(const char* filename, int* size)
+int
+is_valid_instruction(const APEX_Instruction* ins)
 {
-  if (!filename) {
-    return NULL;
+  for (size_t i = 0;
+       i < sizeof(instruction_formats) / sizeof(*instruction_formats); ++i) {
+    if (strcmp(ins->opcode, instruction_formats[i].opcode) == 0) {
+      return valid_operand(instruction_formats[i].rd, ins->rd) &&
+             valid_operand(instruction_formats[i].rs1, ins->rs1) &&
+             valid_operand(instruction_formats[i].rs2, ins->rs2);
+    }
   }
+  return 0;
+}
 
-  FILE* fp = fopen(filename, "r");
-  if (!fp) {
-    return NULL;
+/*
+ * Writes ins in the input file syntax, the inverse of
+ * create_APEX_instruction. Returns the length like snprintf.
+ */
+int
+format_code(char* dst, size_t size, const APEX_Instruction* ins)
+{
+  char op[128];
+
+  /* The last token of a line keeps its line break */
+  snprintf(op, sizeof(op), "%.*s", (int)strcspn(ins->opcode, "\r\n"),
+           ins->opcode);
+
+  if (strcmp(op, "STORE") == 0 || is_compare_branch(op)) {
+    return snprintf(dst, size, "%s,R%d,R%d,#%d", op, ins->rs1, ins->rs2,
+                    ins->imm);
+  }
+  if (strcmp(op, "LOAD") == 0) {
+    return snprintf(dst, size, "%s,R%d,R%d,#%d", op, ins->rd, ins->rs1,
+                    ins->imm);
+  }
+  if (strcmp(op, "MOVC") == 0) {
+    return snprintf(dst, size, "%s,R%d,#%d", op, ins->rd, ins->imm);
+  }
+  if (strcmp(op, "ADD") == 0 || strcmp(op, "SUB") == 0 ||
+      strcmp(op, "AND") == 0 || strcmp(op, "OR") == 0 ||
+      strcmp(op, "XOR") == 0 || strcmp(op, "MUL") == 0) {
+    return snprintf(dst, size, "%s,R%d,R%d,R%d", op, ins->rd, ins->rs1,
+                    ins->rs2);
+  }
+  if (strcmp(op, "BZ") == 0 || strcmp(op, "BNZ") == 0) {
+    return snprintf(dst, size, "%s,#%d", op, ins->imm);
   }
+  if (strcmp(op, "JUMP") == 0 || strcmp(op, "LOOP") == 0) {
+    return snprintf(dst, size, "%s,R%d,#%d", op, ins->rs1, ins->imm);
+  }
+  if (strcmp(op, "VLOAD") == 0) {
+    return snprintf(dst, size, "%s,V%d,R%d,#%d", op, ins->rd, ins->rs1,
+                    ins->imm);
+  }
+  if (strcmp(op, "VSTORE") == 0) {
+    return snprintf(dst, size, "%s,V%d,R%d,#%d", op, ins->rs1, ins->rs2,
+                    ins->imm);
+  }
+  if (is_vector_alu(op)) {
+    return snprintf(dst, size, "%s,V%d,V%d,V%d", op, ins->rd, ins->rs1,
+                    ins->rs2);
+  }
+  /* Without the comma the line break would become part of the opcode */
+  return snprintf(dst, size, "%s%s", op,
+                  strcmp(op, ins->opcode) == 0 ? "," : "");
+}
 
+/* Parses one instruction per line of fp and closes it */
+static APEX_Instruction*
+parse_code_memory(FILE* fp, int* size)
+{
   char* line = NULL;
   size_t len = 0;
   ssize_t nread;
@@ -155,7 +300,7 @@ create_code_memory(const char* filename, int* size)
   }
 
   APEX_Instruction* code_memory =
-    malloc(sizeof(*code_memory) * code_memory_size);
+    calloc(code_memory_size, sizeof(*code_memory));
   if (!code_memory) {
     fclose(fp);
     return NULL;
@@ -172,3 +317,40 @@ create_code_memory(const char* filename, int* size)
   fclose(fp);
   return code_memory;
 }
+
+/*
+ * This function is related to parsing input file
+ *
+ * Note : You are not supposed to edit this function
+ */
+APEX_Instruction*
+create_code_memory(const char* filename, int* size)
+{
+  if (!filename) {
+    return NULL;
+  }
+
+  FILE* fp = fopen(filename, "r");
+  if (!fp) {
+    return NULL;
+  }
+  return parse_code_memory(fp, size);
+}
+
+/*
+ * Same as create_code_memory, for a program held in memory as the text
+ * of an input file
+ */
+APEX_Instruction*
+create_code_memory_from_buffer(const char* text, size_t len, int* size)
+{
+  if (!text || !len) {
+    return NULL;
+  }
+
+  FILE* fp = fmemopen((void*)text, len, "r");
+  if (!fp) {
+    return NULL;
+  }
+  return parse_code_memory(fp, size);
+}
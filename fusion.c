@@ -0,0 +1,105 @@
+/*
+ *  fusion.c
+ *  Contains the fusible pairs and the fusion report
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fusion.h"
+
+/* Names used by fusion_configure and the report */
+static const char* pair_name[FUSE_KINDS] = { NULL, "movc-alu", "alu-branch" };
+
+/*
+ * Enables the pairs named in spec, a comma separated list of movc-alu and
+ * alu-branch, or "all". Returns 0 on success.
+ */
+int
+fusion_configure(APEX_CPU* cpu, const char* spec)
+{
+  char* copy = strdup(spec);
+  char* save = NULL;
+  int fuse = 0;
+
+  if (!copy) {
+    return -1;
+  }
+  for (char* item = strtok_r(copy, ",", &save); item;
+       item = strtok_r(NULL, ",", &save)) {
+    int kind = FUSE_NONE + 1;
+
+    if (strcmp(item, "all") == 0) {
+      fuse |= ((1 << FUSE_KINDS) - 1) & ~(1 << FUSE_NONE);
+      continue;
+    }
+    while (kind < FUSE_KINDS && strcmp(item, pair_name[kind]) != 0) {
+      kind++;
+    }
+    if (kind == FUSE_KINDS) {
+      free(copy);
+      return -1;
+    }
+    fuse |= 1 << kind;
+  }
+  free(copy);
+  if (!fuse) {
+    return -1;
+  }
+  cpu->fuse = fuse;
+  return 0;
+}
+
+static int
+is_logic(const char* op)
+{
+  return strcmp(op, "AND") == 0 || strcmp(op, "OR") == 0 ||
+         strcmp(op, "XOR") == 0;
+}
+
+static int
+sets_flag(const char* op)
+{
+  return strcmp(op, "ADD") == 0 || strcmp(op, "SUB") == 0;
+}
+
+/*
+ * Returns the kind of pair first, just decoded, forms with second, the
+ * instruction after it, or FUSE_NONE. Only pairs enabled on cpu count.
+ * The sources of second are not checked.
+ */
+int
+fusion_pair(const APEX_CPU* cpu, const CPU_Stage* first,
+            const APEX_Instruction* second)
+{
+  const char* op = second->opcode;
+
+  if ((cpu->fuse & (1 << FUSE_MOVC_ALU)) &&
+      strcmp(first->opcode, "MOVC") == 0 &&
+      (sets_flag(op) || is_logic(op)) &&
+      (second->rs1 == first->rd || second->rs2 == first->rd)) {
+    return FUSE_MOVC_ALU;
+  }
+  if ((cpu->fuse & (1 << FUSE_ALU_BRANCH)) && sets_flag(first->opcode) &&
+      (strcmp(op, "BZ") == 0 || strcmp(op, "BNZ") == 0)) {
+    return FUSE_ALU_BRANCH;
+  }
+  return FUSE_NONE;
+}
+
+void
+fusion_print(APEX_CPU* cpu)
+{
+  int pairs = 0;
+
+  printf("\n(apex) >> Fused pairs:");
+  for (int kind = FUSE_NONE + 1; kind < FUSE_KINDS; ++kind) {
+    if (cpu->fuse & (1 << kind)) {
+      printf(" %s=%d", pair_name[kind], cpu->fused[kind]);
+      pairs += cpu->fused[kind];
+    }
+  }
+  printf(", %d of %d instructions retired fused (%.1f%%)", 2 * pairs,
+         cpu->retired,
+         cpu->retired ? 100.0 * 2 * pairs / cpu->retired : 0.0);
+}
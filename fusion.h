@@ -0,0 +1,28 @@
+#ifndef _APEX_FUSION_H_
+#define _APEX_FUSION_H_
+/**
+ *  fusion.h
+ *  Macro-op fusion.
+ *
+ *  Decode looks at the instruction fetch would bring in next and, if the
+ *  two form an enabled pair, issues both as one micro-op in a single
+ *  latch. A MOVC and an ALU operation reading its register (movc-alu) run
+ *  together in execute, with the constant in place of the register, and
+ *  write both registers in writeback. An ADD or SUB and a BZ/BNZ right
+ *  after it (alu-branch) resolve the branch on the flag the operation
+ *  just computed, so the branch does not wait for it. Either way the pair
+ *  retires as two instructions.
+ */
+#include "cpu.h"
+
+int
+fusion_configure(APEX_CPU* cpu, const char* spec);
+
+int
+fusion_pair(const APEX_CPU* cpu, const CPU_Stage* first,
+            const APEX_Instruction* second);
+
+void
+fusion_print(APEX_CPU* cpu);
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ *  hash.c
+ *  Contains the FNV-1a hashing of simulator inputs
+ */
+#include <string.h>
+
+#include "hash.h"
+
+uint64_t
+hash_bytes(uint64_t hash, const void* data, size_t size)
+{
+  const unsigned char* p = data;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ p[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+/*
+ * Hashes code memory entries 0..reach. Entries past the end of the
+ * program read as empty, so the number of real entries is hashed too.
+ * Only the opcode string and the operand fields take part.
+ */
+uint64_t
+hash_code(uint64_t hash, const APEX_Instruction* code, int size, int reach)
+{
+  int count = reach + 1 < size ? reach + 1 : size;
+
+  hash = hash_bytes(hash, &count, sizeof(count));
+  for (int i = 0; i < count; ++i) {
+    const APEX_Instruction* ins = &code[i];
+    hash = hash_bytes(hash, ins->opcode, strlen(ins->opcode) + 1);
+    hash = hash_bytes(hash, &ins->rd, sizeof(ins->rd));
+    hash = hash_bytes(hash, &ins->rs1, sizeof(ins->rs1));
+    hash = hash_bytes(hash, &ins->rs2, sizeof(ins->rs2));
+    hash = hash_bytes(hash, &ins->imm, sizeof(ins->imm));
+  }
+  return hash;
+}
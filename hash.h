@@ -0,0 +1,21 @@
+#ifndef _APEX_HASH_H_
+#define _APEX_HASH_H_
+/**
+ *  hash.h
+ *  64-bit FNV-1a hashing of simulator inputs, used to tag checkpoints and
+ *  to key cached results
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+#define HASH_SEED 0xcbf29ce484222325ull
+
+uint64_t
+hash_bytes(uint64_t hash, const void* data, size_t size);
+
+uint64_t
+hash_code(uint64_t hash, const APEX_Instruction* code, int size, int reach);
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ *  hostprof.c
+ *  Contains the host time and memory instrumentation of the simulator
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "dmem.h"
+#include "hostprof.h"
+#include "pipeline.h"
+#include "trace.h"
+
+/* Clock reads timed to estimate the cost of one */
+#define HOSTPROF_CALIBRATION 1000
+
+struct APEX_HostProfile
+{
+  long load_ns;	// Parsing the program and setting up the cpu
+  long ns[HOST_PARTS];
+  long total_ns;	// All simulated cycles
+  long cycles;	// Cycles simulated, not skipped by fast-forward or a cache hit
+  long trace_mark;	// Trace time when the current stage started
+  double read_ns;	// Cost of one clock read
+};
+
+/* Monotonic host time in nanoseconds */
+long
+hostprof_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+APEX_HostProfile*
+hostprof_create(APEX_CPU* cpu, long load_ns)
+{
+  APEX_HostProfile* host = calloc(1, sizeof(*host));
+  if (!host) {
+    return NULL;
+  }
+  host->load_ns = load_ns;
+
+  long start = hostprof_now();
+  for (int i = 0; i < HOSTPROF_CALIBRATION; ++i) {
+    hostprof_now();
+  }
+  host->read_ns = (double)(hostprof_now() - start) / HOSTPROF_CALIBRATION;
+  cpu->host_profile = host;
+  return host;
+}
+
+void
+hostprof_destroy(APEX_HostProfile* host)
+{
+  free(host);
+}
+
+/* Called when a trace is opened on a profiled cpu */
+void
+hostprof_attach_trace(APEX_CPU* cpu)
+{
+  trace_count_time(cpu->trace, &cpu->host_profile->ns[HOST_TRACE]);
+}
+
+/* Called before a stage function runs, returns the time to pass to
+ * hostprof_stage
+ */
+long
+hostprof_stage_start(APEX_CPU* cpu)
+{
+  APEX_HostProfile* host = cpu->host_profile;
+
+  host->trace_mark = host->ns[HOST_TRACE];
+  return hostprof_now();
+}
+
+/* Charges the time since start, less the trace records it queued, to a
+ * stage function
+ */
+void
+hostprof_stage(APEX_CPU* cpu, int stage, long start)
+{
+  APEX_HostProfile* host = cpu->host_profile;
+  long traced = host->ns[HOST_TRACE] - host->trace_mark;
+
+  host->ns[stage] += hostprof_now() - start - traced;
+}
+
+/* Ends a cycle that started at start */
+void
+hostprof_cycle(APEX_CPU* cpu, long start)
+{
+  APEX_HostProfile* host = cpu->host_profile;
+
+  host->total_ns += hostprof_now() - start;
+  host->cycles++;
+}
+
+static void
+print_part(const APEX_HostProfile* host, const char* name, long ns)
+{
+  fprintf(stderr, "APEX_CPU :   %-10s %9.1f ns/cycle %5.1f%%\n", name,
+          host->cycles ? (double)ns / host->cycles : 0.0,
+          host->total_ns ? 100.0 * ns / host->total_ns : 0.0);
+}
+
+/*
+ * Reports host time per simulated cycle for each stage, the trace and
+ * the rest of the cycle, and the memory high-water mark, on stderr
+ */
+void
+hostprof_print(APEX_CPU* cpu)
+{
+  APEX_HostProfile* host = cpu->host_profile;
+  struct rusage usage;
+  long other = host->total_ns;
+  int pages = 0;
+
+  for (int p = 0; p < HOST_OTHER; ++p) {
+    other -= host->ns[p];
+  }
+  for (int i = 0; i < DMEM_PAGES; ++i) {
+    pages += cpu->data_pages[i] != NULL;
+  }
+
+  fprintf(stderr, "APEX_CPU : Host load %.3f ms, %ld cycles in %.3f ms, "
+                  "%.1f ns/cycle\n",
+          host->load_ns / 1e6, host->cycles, host->total_ns / 1e6,
+          host->cycles ? (double)host->total_ns / host->cycles : 0.0);
+  for (int s = 0; s < NUM_STAGES; ++s) {
+    print_part(host, pipeline_stages[s].name, host->ns[s]);
+  }
+  print_part(host, "Trace", host->ns[HOST_TRACE]);
+  print_part(host, "Other", other);
+  fprintf(stderr, "APEX_CPU : Host clock read %.1f ns, included in the "
+                  "times above\n", host->read_ns);
+
+  getrusage(RUSAGE_SELF, &usage);
+  fprintf(stderr, "APEX_CPU : Host peak memory %ld KB, code memory %zu "
+                  "bytes, %d data pages (%zu bytes)\n",
+          usage.ru_maxrss,
+          sizeof(*cpu->code_memory) * cpu->code_memory_size, pages,
+          pages * sizeof(**cpu->data_pages));
+}
@@ -0,0 +1,52 @@
+#ifndef _APEX_HOSTPROF_H_
+#define _APEX_HOSTPROF_H_
+/**
+ *  hostprof.h
+ *  Host time spent by the simulator itself.
+ *
+ *  While enabled, the monotonic clock is read around every stage function
+ *  and every simulated cycle, and the trace adds the time the simulation
+ *  thread spends queueing records. Trace time is taken out of the stage
+ *  that queued the record. What a cycle spends outside the stages and the
+ *  trace (load/store queue, cycle profiler, bookkeeping) is counted as
+ *  other. The report gives nanoseconds per simulated cycle for each part,
+ *  the time to load the program and the peak memory use of the process.
+ */
+#include "cpu.h"
+
+/* Where host time goes; the stages use their own index */
+enum
+{
+  HOST_TRACE = NUM_STAGES,
+  HOST_OTHER,
+  HOST_PARTS
+};
+
+typedef struct APEX_HostProfile APEX_HostProfile;
+
+long
+hostprof_now(void);
+
+APEX_HostProfile*
+hostprof_create(APEX_CPU* cpu, long load_ns);
+
+void
+hostprof_destroy(APEX_HostProfile* host);
+
+void
+hostprof_print(APEX_CPU* cpu);
+
+/* Hooks, called only while enabled */
+void
+hostprof_attach_trace(APEX_CPU* cpu);
+
+long
+hostprof_stage_start(APEX_CPU* cpu);
+
+void
+hostprof_stage(APEX_CPU* cpu, int stage, long start);
+
+void
+hostprof_cycle(APEX_CPU* cpu, long start);
+
+#endif
@@ -0,0 +1,17 @@
+MOVC,R0,#2
+MOVC,R2,#4
+MOVC,R4,#4
+MOVC,R6,#36
+STORE,R0,R2,#0
+ADD,R2,R2,R4
+BNE,R2,R6,#-8
+MOVC,R0,#0
+MOVC,R2,#4
+MOVC,R3,#1
+LOAD,R5,R2,#0
+ADD,R5,R5,R0
+ADD,R0,R0,R3
+STORE,R5,R2,#0
+ADD,R2,R2,R4
+BLT,R2,R6,#-20
+HALT,
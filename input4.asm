@@ -0,0 +1,17 @@
+MOVC,R0,#2
+MOVC,R1,#8
+MOVC,R2,#4
+MOVC,R3,#1
+MOVC,R4,#4
+LOOP,R1,#8
+STORE,R0,R2,#0
+ADD,R2,R2,R4
+MOVC,R0,#0
+MOVC,R2,#4
+LOOP,R1,#20
+LOAD,R5,R2,#0
+ADD,R5,R5,R0
+ADD,R0,R0,R3
+STORE,R5,R2,#0
+ADD,R2,R2,R4
+HALT,
@@ -0,0 +1,30 @@
+MOVC,R0,#2
+MOVC,R2,#4
+STORE,R0,R2,#0
+STORE,R0,R2,#4
+STORE,R0,R2,#8
+STORE,R0,R2,#12
+VLOAD,V0,R2,#0
+VSTORE,V0,R2,#16
+MOVC,R3,#1
+MOVC,R4,#2
+MOVC,R5,#3
+MOVC,R6,#4
+MOVC,R7,#100
+STORE,R3,R7,#4
+STORE,R4,R7,#8
+STORE,R5,R7,#12
+STORE,R6,R7,#16
+STORE,R6,R7,#20
+STORE,R6,R7,#24
+STORE,R6,R7,#28
+VLOAD,V1,R7,#0
+VLOAD,V2,R7,#16
+VLOAD,V3,R2,#0
+VADD,V3,V3,V1
+VSTORE,V3,R2,#0
+VADD,V1,V1,V2
+VLOAD,V4,R2,#16
+VADD,V4,V4,V1
+VSTORE,V4,R2,#16
+HALT,
@@ -0,0 +1,11 @@
+MOVC,R0,#0
+MOVC,R2,#0
+MOVC,R4,#4
+MOVC,R3,#0
+LOAD,R1,R2,#0
+ADD,R3,R3,R1
+ADD,R2,R2,R4
+ADD,R5,R1,R0
+BNZ,#-16
+STORE,R3,R0,#96
+HALT,
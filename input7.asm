@@ -0,0 +1,12 @@
+MOVC,R0,#0
+MOVC,R1,#1
+MOVC,R2,#4
+MOVC,R3,#80
+MOVC,R4,#16
+MOVC,R5,#1
+STORE,R1,R0,#0
+ADD,R0,R0,R2
+ADD,R1,R1,R5
+BLT,R0,R4,#-12
+STORE,R5,R3,#0
+HALT,
@@ -0,0 +1,14 @@
+MOVC,R3,#80
+MOVC,R7,#0
+LOAD,R1,R3,#0
+BEQ,R1,R7,#-4
+MOVC,R0,#0
+MOVC,R4,#16
+MOVC,R2,#4
+MOVC,R6,#0
+LOAD,R5,R0,#0
+ADD,R6,R6,R5
+ADD,R0,R0,R2
+BLT,R0,R4,#-12
+STORE,R6,R3,#4
+HALT,
@@ -0,0 +1,290 @@
+/*
+ *  libapex.c
+ *  Contains the embedding API of the simulator
+ */
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "dma.h"
+#include "dmem.h"
+#include "fusion.h"
+#include "libapex.h"
+#include "lsq.h"
+#include "pipeline.h"
+#include "trace.h"
+
+struct APEX_Sim
+{
+  APEX_CPU* cpu;
+  APEX_Callbacks callbacks;
+  int mem_latency;	// Settings of the memory model, 0 if unset
+  int lsq_entries;
+};
+
+static APEX_Sim*
+create_sim(APEX_Instruction* code_memory, int size, int max_cycles)
+{
+  for (int i = 0; code_memory && i < size; ++i) {
+    if (!is_valid_instruction(&code_memory[i])) {
+      free(code_memory);
+      return NULL;
+    }
+  }
+
+  APEX_Sim* sim = calloc(1, sizeof(*sim));
+  if (!sim) {
+    free(code_memory);
+    return NULL;
+  }
+
+  sim->cpu = APEX_cpu_init_code(code_memory, size);
+  if (!sim->cpu) {
+    free(sim);
+    return NULL;
+  }
+  sim->cpu->sim = "simulate";
+  apex_set_cycle_limit(sim, max_cycles);
+  return sim;
+}
+
+/*
+ * Loads a program from len bytes of input file text. The run stops after
+ * max_cycles cycles, or only at the end of the program if max_cycles is 0.
+ * Returns NULL if the program is empty, a line is not an instruction the
+ * simulator runs or names a register that does not exist, or memory runs
+ * out.
+ */
+APEX_Sim*
+apex_create(const char* program, size_t len, int max_cycles)
+{
+  int size = 0;
+  APEX_Instruction* code_memory =
+    create_code_memory_from_buffer(program, len, &size);
+  return create_sim(code_memory, size, max_cycles);
+}
+
+static int32_t
+read_le32(const unsigned char* p)
+{
+  return (int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+                   (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+/*
+ * Same as apex_create for a program already parsed, as records of
+ * APEX_BINARY_RECORD bytes. Also returns NULL if len is not a whole
+ * number of records or an opcode is not NUL padded.
+ */
+APEX_Sim*
+apex_create_binary(const void* program, size_t len, int max_cycles)
+{
+  const unsigned char* p = program;
+  int size = len / APEX_BINARY_RECORD;
+
+  if (!p || !size || len % APEX_BINARY_RECORD) {
+    return NULL;
+  }
+  APEX_Instruction* code_memory = calloc(size, sizeof(*code_memory));
+  if (!code_memory) {
+    return NULL;
+  }
+  for (int i = 0; i < size; ++i, p += APEX_BINARY_RECORD) {
+    if (p[APEX_BINARY_OPCODE - 1] != '\0') {
+      free(code_memory);
+      return NULL;
+    }
+    memcpy(code_memory[i].opcode, p, APEX_BINARY_OPCODE);
+    code_memory[i].rd = read_le32(p + APEX_BINARY_OPCODE);
+    code_memory[i].rs1 = read_le32(p + APEX_BINARY_OPCODE + 4);
+    code_memory[i].rs2 = read_le32(p + APEX_BINARY_OPCODE + 8);
+    code_memory[i].imm = read_le32(p + APEX_BINARY_OPCODE + 12);
+  }
+  return create_sim(code_memory, size, max_cycles);
+}
+
+void
+apex_destroy(APEX_Sim* sim)
+{
+  if (!sim) {
+    return;
+  }
+  if (sim->cpu->lsq) {
+    lsq_destroy(sim->cpu->lsq);
+  }
+  if (sim->cpu->dma) {
+    dma_destroy(sim->cpu->dma);
+  }
+  APEX_cpu_stop(sim->cpu);
+  free(sim);
+}
+
+/*
+ * Applies one option, written as on the apex_sim command line without
+ * the leading dashes: "stages=<stage>:<cycles>,...", "fuse=<pair>,...",
+ * "dma=<words per cycle>", "mem-latency=<cycles>" or "lsq=<entries>". The
+ * DMA engine and the memory latency model exclude each other. Must be
+ * called before the first cycle. Returns 0 on success.
+ */
+int
+apex_configure(APEX_Sim* sim, const char* option)
+{
+  APEX_CPU* cpu = sim->cpu;
+
+  if (cpu->clock) {
+    return -1;
+  }
+  if (strncmp(option, "stages=", 7) == 0) {
+    return pipeline_configure(cpu, option + 7);
+  }
+  if (strncmp(option, "fuse=", 5) == 0) {
+    return fusion_configure(cpu, option + 5);
+  }
+  if (strncmp(option, "dma=", 4) == 0) {
+    if (cpu->lsq || cpu->dma) {
+      return -1;
+    }
+    return dma_create(cpu, atoi(option + 4)) ? 0 : -1;
+  }
+  if (strncmp(option, "mem-latency=", 12) == 0) {
+    sim->mem_latency = atoi(option + 12);
+  } else if (strncmp(option, "lsq=", 4) == 0) {
+    sim->lsq_entries = atoi(option + 4);
+  } else {
+    return -1;
+  }
+  if (cpu->dma) {
+    return -1;
+  }
+
+  /* The model is rebuilt from both settings */
+  if (cpu->lsq) {
+    lsq_destroy(cpu->lsq);
+    cpu->lsq = NULL;
+  }
+  return lsq_create(cpu, sim->lsq_entries, sim->mem_latency) ? 0 : -1;
+}
+
+/*
+ * Returns an independent copy of a simulation, sharing its code memory.
+ * Callbacks are not copied. A simulation with a memory latency model or a
+ * DMA engine cannot be cloned.
+ */
+APEX_Sim*
+apex_clone(APEX_Sim* sim)
+{
+  if (sim->cpu->lsq || sim->cpu->dma) {
+    return NULL;
+  }
+
+  APEX_Sim* clone = calloc(1, sizeof(*clone));
+  if (!clone) {
+    return NULL;
+  }
+  clone->cpu = APEX_cpu_clone(sim->cpu);
+  if (!clone->cpu) {
+    free(clone);
+    return NULL;
+  }
+  return clone;
+}
+
+/* Replaces the callbacks, NULL removes them */
+void
+apex_set_callbacks(APEX_Sim* sim, const APEX_Callbacks* callbacks)
+{
+  if (callbacks) {
+    sim->callbacks = *callbacks;
+    sim->cpu->callbacks = &sim->callbacks;
+  } else {
+    memset(&sim->callbacks, 0, sizeof(sim->callbacks));
+    sim->cpu->callbacks = NULL;
+  }
+}
+
+/* Replaces the cycle limit given to apex_create, 0 for none */
+void
+apex_set_cycle_limit(APEX_Sim* sim, int max_cycles)
+{
+  sim->cpu->no_cycles = max_cycles > 0 ? max_cycles : -1;
+}
+
+/*
+ * Runs up to the given number of cycles, stopping early at the end of the
+ * program or the cycle limit. Returns the cycles run.
+ */
+int
+apex_step(APEX_Sim* sim, int cycles)
+{
+  APEX_CPU* cpu = sim->cpu;
+  int n = 0;
+
+  /* The trace of a call is complete once the writer is closed */
+  if (sim->callbacks.trace) {
+    cpu->trace = trace_open_sink(sim->callbacks.trace, sim->callbacks.ctx);
+  }
+  while (n < cycles && !APEX_cpu_done(cpu)) {
+    APEX_cpu_cycle(cpu);
+    n++;
+    if (sim->callbacks.cycle) {
+      sim->callbacks.cycle(sim->callbacks.ctx, cpu->clock);
+    }
+  }
+  trace_close(cpu->trace);
+  cpu->trace = NULL;
+  return n;
+}
+
+/*
+ * Runs until the end of the program or the cycle limit. Returns 0 if the
+ * program completed, 1 if the cycle limit stopped it and -1 if data
+ * memory ran out.
+ */
+int
+apex_run(APEX_Sim* sim)
+{
+  apex_step(sim, INT_MAX);
+  if (sim->cpu->out_of_memory) {
+    return -1;
+  }
+  return sim->cpu->ins_completed == sim->cpu->code_memory_size ? 0 : 1;
+}
+
+/* Returns register reg, and sets *valid unless valid is NULL */
+int
+apex_register(APEX_Sim* sim, int reg, int* valid)
+{
+  int in_range = reg >= 0 && reg < 16;
+
+  if (valid) {
+    *valid = in_range && sim->cpu->regs_valid[reg];
+  }
+  return in_range ? sim->cpu->regs[reg] : 0;
+}
+
+int
+apex_memory(APEX_Sim* sim, int address)
+{
+  return dmem_read(sim->cpu, address);
+}
+
+void
+apex_stats(APEX_Sim* sim, APEX_Stats* stats)
+{
+  const APEX_CPU* cpu = sim->cpu;
+
+  stats->cycles = cpu->clock;
+  stats->retired = cpu->retired;
+  stats->completed = cpu->ins_completed == cpu->code_memory_size;
+  stats->loop_iterations = cpu->loop_iterations;
+  stats->loop_buffer_fetches = cpu->loop_buffer_fetches;
+}
+
+/* Writes the same register and memory dump as the simulator prints */
+void
+apex_write_state(APEX_Sim* sim, APEX_Sink sink, void* ctx)
+{
+  APEX_cpu_write_state(sim->cpu, sink, ctx);
+}
@@ -0,0 +1,92 @@
+#ifndef _APEX_LIBAPEX_H_
+#define _APEX_LIBAPEX_H_
+/**
+ *  libapex.h
+ *  Embedding API of the simulator, built as libapex.a.
+ *
+ *  A program is loaded from a buffer holding the text of an input file
+ *  and run in steps or to completion; registers, data memory and
+ *  statistics are read back through the handle. The library never writes
+ *  to stdout or stderr: the trace and the state dump are handed to sinks
+ *  the caller provides. Simulations share no state, so different handles
+ *  can be used from different threads at the same time; one handle must
+ *  not be used from two threads at once.
+ */
+#include <stddef.h>
+
+typedef struct APEX_Sim APEX_Sim;
+
+/* One instruction of a binary program, all fields little-endian */
+#define APEX_BINARY_RECORD 24	// Bytes per instruction
+#define APEX_BINARY_OPCODE 8	// Opcode name, NUL padded, then rd, rs1, rs2, imm
+
+/* Receives len bytes of output text, not NUL terminated */
+typedef void (*APEX_Sink)(void* ctx, const char* text, size_t len);
+
+/* Optional event callbacks, any of them may be NULL */
+typedef struct APEX_Callbacks
+{
+  void* ctx;	// Passed to every callback
+
+  /* Cycle by cycle trace, as display mode prints it. Called from a
+   * writer thread; all text of a step or run has been delivered when it
+   * returns.
+   */
+  APEX_Sink trace;
+
+  /* After every simulated cycle, with the number of cycles run so far */
+  void (*cycle)(void* ctx, int clock);
+
+  /* For every instruction written back, with its pc and input file text */
+  void (*retire)(void* ctx, int clock, int pc, const char* text);
+} APEX_Callbacks;
+
+typedef struct APEX_Stats
+{
+  int cycles;
+  int retired;	// Instructions written back
+  int completed;	// 1 once the program has run to its end
+  int loop_iterations;
+  int loop_buffer_fetches;
+} APEX_Stats;
+
+APEX_Sim*
+apex_create(const char* program, size_t len, int max_cycles);
+
+APEX_Sim*
+apex_create_binary(const void* program, size_t len, int max_cycles);
+
+int
+apex_configure(APEX_Sim* sim, const char* option);
+
+APEX_Sim*
+apex_clone(APEX_Sim* sim);
+
+void
+apex_destroy(APEX_Sim* sim);
+
+void
+apex_set_callbacks(APEX_Sim* sim, const APEX_Callbacks* callbacks);
+
+void
+apex_set_cycle_limit(APEX_Sim* sim, int max_cycles);
+
+int
+apex_step(APEX_Sim* sim, int cycles);
+
+int
+apex_run(APEX_Sim* sim);
+
+int
+apex_register(APEX_Sim* sim, int reg, int* valid);
+
+int
+apex_memory(APEX_Sim* sim, int address);
+
+void
+apex_stats(APEX_Sim* sim, APEX_Stats* stats);
+
+void
+apex_write_state(APEX_Sim* sim, APEX_Sink sink, void* ctx);
+
+#endif
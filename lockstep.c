@@ -0,0 +1,787 @@
+/*
+ *  lockstep.c
+ *  Contains the structure-of-arrays lockstep engine. Group leaders run
+ *  the normal pipeline stages for control and timing; the hooks below
+ *  apply the data path of every stage to all lanes of the group at once.
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "lockstep.h"
+#include "vector.h"
+
+#if defined(__SSE4_1__)
+#define HAVE_SSE_MULLO 1
+#else
+#define HAVE_SSE_MULLO 0
+#endif
+
+/* Lane operations */
+enum
+{
+  LANE_MOV,
+  LANE_ADD,
+  LANE_SUB,
+  LANE_MUL,
+  LANE_AND,
+  LANE_OR,
+  LANE_XOR,
+  LANE_EQ,
+  LANE_NE,
+  LANE_LT,
+  LANE_GE
+};
+
+/* Control decisions that can differ between lanes */
+enum
+{
+  SPLIT_BRANCH,
+  SPLIT_JUMP,
+  SPLIT_LOOP
+};
+
+/* Stage a group leader created mid-cycle continues from */
+enum
+{
+  RESUME_NONE,
+  RESUME_DECODE,
+  RESUME_FETCH
+};
+
+/* Lane-wise data fields of one pipeline latch */
+typedef struct LaneLatch
+{
+  int* rs1_value;
+  int* rs2_value;
+  int* buffer;
+  int* mem_address;
+  int* vs1_value[VECTOR_LANES];
+  int* vs2_value[VECTOR_LANES];
+  int* vbuffer[VECTOR_LANES];
+} LaneLatch;
+
+/* Lanes that follow one control path, driven by one leader */
+typedef struct LaneGroup
+{
+  APEX_Lockstep* ls;
+  APEX_CPU* leader;
+  int* mask;		// -1 for lanes in this group, 0 otherwise
+  int resume;
+} LaneGroup;
+
+struct APEX_Lockstep
+{
+  int n;		// Number of lanes
+  int* pool;
+
+  int* regs[16];
+  int* vregs[VECTOR_REGS][VECTOR_LANES];
+  int* zero;
+  LaneLatch stage[NUM_STAGES];
+  int* memory;		// DATA_MEMORY_SIZE rows of n lanes
+
+  /* Scratch rows */
+  int* zeros;
+  int* ones;
+  int* tmp;
+  int* outcome;
+
+  LaneGroup** groups;
+  int num_groups;
+};
+
+static int
+scalar_op(int op, int a, int b)
+{
+  switch (op) {
+    case LANE_MOV: return a;
+    case LANE_ADD: return (int)((unsigned)a + (unsigned)b);
+    case LANE_SUB: return (int)((unsigned)a - (unsigned)b);
+    case LANE_MUL: return (int)((unsigned)a * (unsigned)b);
+    case LANE_AND: return a & b;
+    case LANE_OR: return a | b;
+    case LANE_XOR: return a ^ b;
+    case LANE_EQ: return a == b;
+    case LANE_NE: return a != b;
+    case LANE_LT: return a < b;
+    default: return a >= b;
+  }
+}
+
+/*
+ * dst[l] = a[l] op b[l] for every lane l with mask[l] set; other lanes of
+ * dst are left alone. Uses AVX2 or SSE2 when the compiler targets them.
+ */
+static void
+lane_op(int op, int* dst, const int* a, const int* b, const int* mask, int n)
+{
+  int l = 0;
+
+#if defined(__AVX2__)
+  const __m256i one8 = _mm256_set1_epi32(1);
+  for (; l + 8 <= n; l += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(a + l));
+    __m256i y = _mm256_loadu_si256((const __m256i*)(b + l));
+    __m256i m = _mm256_loadu_si256((const __m256i*)(mask + l));
+    __m256i old = _mm256_loadu_si256((const __m256i*)(dst + l));
+    __m256i r;
+
+    switch (op) {
+      case LANE_MOV: r = x; break;
+      case LANE_ADD: r = _mm256_add_epi32(x, y); break;
+      case LANE_SUB: r = _mm256_sub_epi32(x, y); break;
+      case LANE_MUL: r = _mm256_mullo_epi32(x, y); break;
+      case LANE_AND: r = _mm256_and_si256(x, y); break;
+      case LANE_OR: r = _mm256_or_si256(x, y); break;
+      case LANE_XOR: r = _mm256_xor_si256(x, y); break;
+      case LANE_EQ: r = _mm256_and_si256(_mm256_cmpeq_epi32(x, y), one8); break;
+      case LANE_NE: r = _mm256_andnot_si256(_mm256_cmpeq_epi32(x, y), one8); break;
+      case LANE_LT: r = _mm256_and_si256(_mm256_cmpgt_epi32(y, x), one8); break;
+      default: r = _mm256_andnot_si256(_mm256_cmpgt_epi32(y, x), one8); break;
+    }
+    _mm256_storeu_si256((__m256i*)(dst + l), _mm256_blendv_epi8(old, r, m));
+  }
+#endif
+
+#if defined(__SSE2__)
+  const __m128i one4 = _mm_set1_epi32(1);
+  for (; l + 4 <= n && (op != LANE_MUL || HAVE_SSE_MULLO); l += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(a + l));
+    __m128i y = _mm_loadu_si128((const __m128i*)(b + l));
+    __m128i m = _mm_loadu_si128((const __m128i*)(mask + l));
+    __m128i old = _mm_loadu_si128((const __m128i*)(dst + l));
+    __m128i r;
+
+    switch (op) {
+      case LANE_MOV: r = x; break;
+      case LANE_ADD: r = _mm_add_epi32(x, y); break;
+      case LANE_SUB: r = _mm_sub_epi32(x, y); break;
+#if HAVE_SSE_MULLO
+      case LANE_MUL: r = _mm_mullo_epi32(x, y); break;
+#endif
+      case LANE_AND: r = _mm_and_si128(x, y); break;
+      case LANE_OR: r = _mm_or_si128(x, y); break;
+      case LANE_XOR: r = _mm_xor_si128(x, y); break;
+      case LANE_EQ: r = _mm_and_si128(_mm_cmpeq_epi32(x, y), one4); break;
+      case LANE_NE: r = _mm_andnot_si128(_mm_cmpeq_epi32(x, y), one4); break;
+      case LANE_LT: r = _mm_and_si128(_mm_cmplt_epi32(x, y), one4); break;
+      default: r = _mm_andnot_si128(_mm_cmplt_epi32(x, y), one4); break;
+    }
+    r = _mm_or_si128(_mm_and_si128(m, r), _mm_andnot_si128(m, old));
+    _mm_storeu_si128((__m128i*)(dst + l), r);
+  }
+#endif
+
+  for (; l < n; ++l) {
+    if (mask[l]) {
+      dst[l] = scalar_op(op, a[l], b[l]);
+    }
+  }
+}
+
+static void
+lane_fill(int* dst, int value, int n)
+{
+  for (int l = 0; l < n; ++l) {
+    dst[l] = value;
+  }
+}
+
+static void
+copy_latch(APEX_Lockstep* ls, int dst, int src, const int* mask)
+{
+  LaneLatch* d = &ls->stage[dst];
+  LaneLatch* s = &ls->stage[src];
+  int n = ls->n;
+
+  lane_op(LANE_MOV, d->rs1_value, s->rs1_value, ls->zeros, mask, n);
+  lane_op(LANE_MOV, d->rs2_value, s->rs2_value, ls->zeros, mask, n);
+  lane_op(LANE_MOV, d->buffer, s->buffer, ls->zeros, mask, n);
+  lane_op(LANE_MOV, d->mem_address, s->mem_address, ls->zeros, mask, n);
+  for (int i = 0; i < VECTOR_LANES; ++i) {
+    lane_op(LANE_MOV, d->vs1_value[i], s->vs1_value[i], ls->zeros, mask, n);
+    lane_op(LANE_MOV, d->vs2_value[i], s->vs2_value[i], ls->zeros, mask, n);
+    lane_op(LANE_MOV, d->vbuffer[i], s->vbuffer[i], ls->zeros, mask, n);
+  }
+}
+
+static int
+is_scalar_alu(const char* opcode)
+{
+  return strcmp(opcode, "ADD") == 0 || strcmp(opcode, "SUB") == 0 ||
+         strcmp(opcode, "AND") == 0 || strcmp(opcode, "OR") == 0 ||
+         strcmp(opcode, "XOR") == 0 || strcmp(opcode, "MUL") == 0;
+}
+
+static int
+alu_lane_op(const char* opcode)
+{
+  if (strcmp(opcode, "ADD") == 0 || strcmp(opcode, "VADD") == 0) {
+    return LANE_ADD;
+  }
+  if (strcmp(opcode, "SUB") == 0 || strcmp(opcode, "VSUB") == 0) {
+    return LANE_SUB;
+  }
+  if (strcmp(opcode, "MUL") == 0 || strcmp(opcode, "VMUL") == 0) {
+    return LANE_MUL;
+  }
+  if (strcmp(opcode, "AND") == 0 || strcmp(opcode, "VAND") == 0) {
+    return LANE_AND;
+  }
+  if (strcmp(opcode, "OR") == 0 || strcmp(opcode, "VOR") == 0) {
+    return LANE_OR;
+  }
+  return LANE_XOR;
+}
+
+static int
+compare_lane_op(const char* opcode)
+{
+  if (strcmp(opcode, "BEQ") == 0) {
+    return LANE_EQ;
+  }
+  if (strcmp(opcode, "BNE") == 0) {
+    return LANE_NE;
+  }
+  if (strcmp(opcode, "BLT") == 0) {
+    return LANE_LT;
+  }
+  return LANE_GE;
+}
+
+static LaneGroup*
+add_group(APEX_Lockstep* ls, APEX_CPU* leader)
+{
+  LaneGroup* group = calloc(1, sizeof(*group));
+  int* mask = calloc(ls->n, sizeof(int));
+  if (!group || !mask || !leader) {
+    fprintf(stderr, "APEX_Error : Out of memory splitting lockstep lanes\n");
+    exit(1);
+  }
+
+  group->ls = ls;
+  group->leader = leader;
+  group->mask = mask;
+  leader->lanes = group;
+  ls->groups[ls->num_groups++] = group;
+  return group;
+}
+
+/* Makes a leader follow the control decision its lanes agreed on */
+static void
+apply_outcome(APEX_CPU* leader, int kind, int value)
+{
+  if (kind == SPLIT_BRANCH) {
+    CPU_Stage* mem = &leader->stage[MEM];
+    mem->mem_address = value ? mem->pc + mem->imm : 0;
+  } else if (kind == SPLIT_JUMP) {
+    leader->pc = value;
+  } else {
+    CPU_Stage* ex = &leader->stage[EX];
+    leader->loop_count = value;
+    leader->loop_active = value > 1 && ex->imm >= 4;
+  }
+}
+
+/*
+ * Every set of lanes whose outcome differs from the group's first lane
+ * moves to a new group whose leader is a clone of this one. Each leader
+ * is then steered to its lanes' outcome.
+ */
+static void
+split_group(LaneGroup* group, const int* outcome, int kind, int resume)
+{
+  APEX_Lockstep* ls = group->ls;
+  int n = ls->n;
+  int first = 0;
+
+  while (first < n && !group->mask[first]) {
+    first++;
+  }
+  if (first == n) {
+    return;
+  }
+
+  for (int l = first + 1; l < n; ++l) {
+    if (!group->mask[l] || outcome[l] == outcome[first]) {
+      continue;
+    }
+
+    int value = outcome[l];
+    LaneGroup* split = add_group(ls, APEX_cpu_clone(group->leader));
+    split->resume = resume;
+    for (int k = l; k < n; ++k) {
+      if (group->mask[k] && outcome[k] == value) {
+        group->mask[k] = 0;
+        split->mask[k] = -1;
+      }
+    }
+    apply_outcome(split->leader, kind, value);
+  }
+  apply_outcome(group->leader, kind, outcome[first]);
+}
+
+/*
+ * This function creates a lockstep engine of the given number of lanes.
+ * cpu becomes the leader of the first group; its own register and memory
+ * contents are not used.
+ */
+APEX_Lockstep*
+lockstep_create(APEX_CPU* cpu, int lanes)
+{
+  if (lanes <= 0) {
+    return NULL;
+  }
+
+  APEX_Lockstep* ls = calloc(1, sizeof(*ls));
+  if (!ls) {
+    return NULL;
+  }
+
+  int rows = 16 + VECTOR_REGS * VECTOR_LANES + 1 +
+             NUM_STAGES * (4 + 3 * VECTOR_LANES) + 4 + DATA_MEMORY_SIZE;
+  ls->n = lanes;
+  ls->pool = calloc((size_t)rows * lanes, sizeof(int));
+  ls->groups = calloc(lanes, sizeof(LaneGroup*));
+  if (!ls->pool || !ls->groups) {
+    free(ls->pool);
+    free(ls->groups);
+    free(ls);
+    return NULL;
+  }
+
+  int* row = ls->pool;
+#define NEXT_ROW() (row += lanes, row - lanes)
+  for (int i = 0; i < 16; ++i) {
+    ls->regs[i] = NEXT_ROW();
+  }
+  for (int i = 0; i < VECTOR_REGS; ++i) {
+    for (int j = 0; j < VECTOR_LANES; ++j) {
+      ls->vregs[i][j] = NEXT_ROW();
+    }
+  }
+  ls->zero = NEXT_ROW();
+  for (int s = 0; s < NUM_STAGES; ++s) {
+    LaneLatch* latch = &ls->stage[s];
+    latch->rs1_value = NEXT_ROW();
+    latch->rs2_value = NEXT_ROW();
+    latch->buffer = NEXT_ROW();
+    latch->mem_address = NEXT_ROW();
+    for (int j = 0; j < VECTOR_LANES; ++j) {
+      latch->vs1_value[j] = NEXT_ROW();
+      latch->vs2_value[j] = NEXT_ROW();
+      latch->vbuffer[j] = NEXT_ROW();
+    }
+  }
+  ls->zeros = NEXT_ROW();
+  ls->ones = NEXT_ROW();
+  ls->tmp = NEXT_ROW();
+  ls->outcome = NEXT_ROW();
+  ls->memory = row;
+#undef NEXT_ROW
+
+  lane_fill(ls->ones, 1, lanes);
+
+  LaneGroup* group = add_group(ls, cpu);
+  lane_fill(group->mask, -1, lanes);
+  return ls;
+}
+
+/* Sets the initial value of one data memory word of one lane */
+void
+lockstep_write(APEX_Lockstep* ls, int lane, int address, int value)
+{
+  if (lane >= 0 && lane < ls->n && address >= 0 &&
+      address < DATA_MEMORY_SIZE) {
+    ls->memory[address * ls->n + lane] = value;
+  }
+}
+
+/*
+ * Creates a lockstep engine from a lane file. Every non-empty line that
+ * does not start with '#' is one lane, listing its initial data memory as
+ * address=value pairs separated by spaces or commas.
+ */
+APEX_Lockstep*
+lockstep_load(APEX_CPU* cpu, const char* filename)
+{
+  FILE* fp = fopen(filename, "r");
+  if (!fp) {
+    return NULL;
+  }
+
+  char* line = NULL;
+  size_t len = 0;
+  int lanes = 0;
+
+  while (getline(&line, &len, fp) != -1) {
+    char* p = line;
+    while (isspace((unsigned char)*p)) {
+      p++;
+    }
+    if (*p && *p != '#') {
+      lanes++;
+    }
+  }
+
+  APEX_Lockstep* ls = lockstep_create(cpu, lanes);
+  if (!ls) {
+    free(line);
+    fclose(fp);
+    return NULL;
+  }
+
+  rewind(fp);
+  int lane = 0;
+  while (getline(&line, &len, fp) != -1) {
+    char* p = line;
+    while (isspace((unsigned char)*p)) {
+      p++;
+    }
+    if (!*p || *p == '#') {
+      continue;
+    }
+    char* save = NULL;
+    for (char* tok = strtok_r(p, " ,\t\r\n", &save); tok;
+         tok = strtok_r(NULL, " ,\t\r\n", &save)) {
+      int address, value;
+      if (sscanf(tok, "%d=%d", &address, &value) == 2) {
+        lockstep_write(ls, lane, address, value);
+      }
+    }
+    lane++;
+  }
+
+  free(line);
+  fclose(fp);
+  return ls;
+}
+
+void
+lockstep_fetch(APEX_CPU* cpu)
+{
+  LaneGroup* group = cpu->lanes;
+  copy_latch(group->ls, DRF, F, group->mask);
+}
+
+/*
+ * Reads the register operands of the instruction in decode for every lane
+ * and moves the latch on to execute. Operands are read even when decode
+ * stalled; the stalled copy never executes, so that is harmless.
+ */
+void
+lockstep_decode(APEX_CPU* cpu)
+{
+  LaneGroup* group = cpu->lanes;
+  APEX_Lockstep* ls = group->ls;
+  CPU_Stage* stage = &cpu->stage[DRF];
+  LaneLatch* latch = &ls->stage[DRF];
+  const char* op = stage->opcode;
+  int n = ls->n;
+
+  if (strcmp(op, "VSTORE") == 0) {
+    for (int i = 0; i < VECTOR_LANES; ++i) {
+      lane_op(LANE_MOV, latch->vs1_value[i], ls->vregs[stage->rs1][i],
+              ls->zeros, group->mask, n);
+    }
+    lane_op(LANE_MOV, latch->rs2_value, ls->regs[stage->rs2], ls->zeros,
+            group->mask, n);
+  } else if (is_vector_alu(op)) {
+    for (int i = 0; i < VECTOR_LANES; ++i) {
+      lane_op(LANE_MOV, latch->vs1_value[i], ls->vregs[stage->rs1][i],
+              ls->zeros, group->mask, n);
+      lane_op(LANE_MOV, latch->vs2_value[i], ls->vregs[stage->rs2][i],
+              ls->zeros, group->mask, n);
+    }
+  } else {
+    int rs1 = strcmp(op, "STORE") == 0 || strcmp(op, "LOAD") == 0 ||
+              strcmp(op, "JUMP") == 0 || strcmp(op, "LOOP") == 0 ||
+              strcmp(op, "VLOAD") == 0 || is_scalar_alu(op) ||
+              is_compare_branch(op);
+    int rs2 = strcmp(op, "STORE") == 0 || is_scalar_alu(op) ||
+              is_compare_branch(op);
+
+    if (rs1) {
+      lane_op(LANE_MOV, latch->rs1_value, ls->regs[stage->rs1], ls->zeros,
+              group->mask, n);
+    }
+    if (rs2) {
+      lane_op(LANE_MOV, latch->rs2_value, ls->regs[stage->rs2], ls->zeros,
+              group->mask, n);
+    }
+  }
+
+  copy_latch(ls, EX, DRF, group->mask);
+
+  /* The loop trip count comes from a register, so lanes may disagree */
+  if (strcmp(op, "LOOP") == 0 && !stage->stalled) {
+    memcpy(ls->outcome, latch->rs1_value, n * sizeof(int));
+    split_group(group, ls->outcome, SPLIT_LOOP, RESUME_FETCH);
+  }
+}
+
+void
+lockstep_execute(APEX_CPU* cpu, int active)
+{
+  LaneGroup* group = cpu->lanes;
+  APEX_Lockstep* ls = group->ls;
+  CPU_Stage* stage = &cpu->stage[EX];
+  LaneLatch* latch = &ls->stage[EX];
+  const char* op = stage->opcode;
+  int* mask = group->mask;
+  int n = ls->n;
+
+  if (!active) {
+    copy_latch(ls, MEM, EX, mask);
+    return;
+  }
+
+  lane_fill(ls->tmp, stage->imm, n);
+
+  if (strcmp(op, "STORE") == 0 || strcmp(op, "VSTORE") == 0) {
+    lane_op(LANE_ADD, latch->mem_address, latch->rs2_value, ls->tmp, mask, n);
+  }
+
+  if (strcmp(op, "LOAD") == 0 || strcmp(op, "VLOAD") == 0) {
+    lane_op(LANE_ADD, latch->mem_address, latch->rs1_value, ls->tmp, mask, n);
+  }
+
+  if (strcmp(op, "MOVC") == 0) {
+    lane_op(LANE_MOV, latch->buffer, ls->tmp, ls->zeros, mask, n);
+  }
+
+  if (is_scalar_alu(op)) {
+    /* MUL produces its result in its second cycle in execute */
+    if (strcmp(op, "MUL") != 0 || stage->nop == 0) {
+      lane_op(alu_lane_op(op), latch->buffer, latch->rs1_value,
+              latch->rs2_value, mask, n);
+    }
+    if (strcmp(op, "ADD") == 0 || strcmp(op, "SUB") == 0 ||
+        strcmp(op, "MUL") == 0) {
+      lane_op(LANE_EQ, ls->zero, latch->buffer, ls->zeros, mask, n);
+    }
+  }
+
+  if (is_vector_alu(op)) {
+    for (int i = 0; i < VECTOR_LANES; ++i) {
+      lane_op(alu_lane_op(op), latch->vbuffer[i], latch->vs1_value[i],
+              latch->vs2_value[i], mask, n);
+    }
+  }
+
+  copy_latch(ls, MEM, EX, mask);
+
+  /* Control decisions */
+  if (strcmp(op, "BZ") == 0) {
+    lane_op(LANE_EQ, ls->outcome, ls->zero, ls->ones, mask, n);
+    for (int l = 0; l < n; ++l) {
+      if (mask[l] && ls->outcome[l]) {
+        ls->zero[l] = 0;
+      }
+    }
+    split_group(group, ls->outcome, SPLIT_BRANCH, RESUME_DECODE);
+  }
+
+  if (strcmp(op, "BNZ") == 0) {
+    lane_op(LANE_EQ, ls->outcome, ls->zero, ls->zeros, mask, n);
+    split_group(group, ls->outcome, SPLIT_BRANCH, RESUME_DECODE);
+  }
+
+  if (is_compare_branch(op)) {
+    lane_op(compare_lane_op(op), ls->outcome, latch->rs1_value,
+            latch->rs2_value, mask, n);
+    split_group(group, ls->outcome, SPLIT_BRANCH, RESUME_DECODE);
+  }
+
+  if (strcmp(op, "JUMP") == 0) {
+    lane_op(LANE_ADD, ls->outcome, latch->rs1_value, ls->tmp, mask, n);
+    split_group(group, ls->outcome, SPLIT_JUMP, RESUME_DECODE);
+  }
+}
+
+static int
+lane_read(APEX_Lockstep* ls, int lane, int address)
+{
+  if (address < 0 || address >= DATA_MEMORY_SIZE) {
+    return 0;
+  }
+  return ls->memory[address * ls->n + lane];
+}
+
+static void
+lane_write(APEX_Lockstep* ls, int lane, int address, int value)
+{
+  if (address >= 0 && address < DATA_MEMORY_SIZE) {
+    ls->memory[address * ls->n + lane] = value;
+  }
+}
+
+void
+lockstep_memory(APEX_CPU* cpu, int active)
+{
+  LaneGroup* group = cpu->lanes;
+  APEX_Lockstep* ls = group->ls;
+  const char* op = cpu->stage[MEM].opcode;
+  LaneLatch* latch = &ls->stage[MEM];
+  int* mask = group->mask;
+  int n = ls->n;
+
+  if (active) {
+    for (int l = 0; l < n; ++l) {
+      if (!mask[l]) {
+        continue;
+      }
+      int address = latch->mem_address[l];
+
+      if (strcmp(op, "STORE") == 0) {
+        lane_write(ls, l, address, latch->rs1_value[l]);
+      } else if (strcmp(op, "LOAD") == 0) {
+        latch->buffer[l] = lane_read(ls, l, address);
+      } else if (strcmp(op, "VSTORE") == 0) {
+        for (int i = 0; i < VECTOR_LANES; ++i) {
+          lane_write(ls, l, address + 4 * i, latch->vs1_value[i][l]);
+        }
+      } else if (strcmp(op, "VLOAD") == 0) {
+        for (int i = 0; i < VECTOR_LANES; ++i) {
+          latch->vbuffer[i][l] = lane_read(ls, l, address + 4 * i);
+        }
+      } else {
+        break;
+      }
+    }
+  }
+  copy_latch(ls, WB, MEM, mask);
+}
+
+void
+lockstep_writeback(APEX_CPU* cpu)
+{
+  LaneGroup* group = cpu->lanes;
+  APEX_Lockstep* ls = group->ls;
+  CPU_Stage* stage = &cpu->stage[WB];
+  LaneLatch* latch = &ls->stage[WB];
+  const char* op = stage->opcode;
+
+  if (strcmp(op, "MOVC") == 0 || strcmp(op, "LOAD") == 0 || is_scalar_alu(op)) {
+    lane_op(LANE_MOV, ls->regs[stage->rd], latch->buffer, ls->zeros,
+            group->mask, ls->n);
+  }
+
+  if (vector_writes_vreg(op)) {
+    for (int i = 0; i < VECTOR_LANES; ++i) {
+      lane_op(LANE_MOV, ls->vregs[stage->rd][i], latch->vbuffer[i], ls->zeros,
+              group->mask, ls->n);
+    }
+  }
+}
+
+/* Finishes the cycle in which a group was split off */
+static void
+resume_group(LaneGroup* group)
+{
+  APEX_CPU* leader = group->leader;
+
+  if (group->resume == RESUME_DECODE) {
+    decode(leader);
+  }
+  if (group->resume != RESUME_NONE) {
+    fetch(leader);
+    leader->clock++;
+  }
+  group->resume = RESUME_NONE;
+}
+
+/*
+ * Runs every group until its leader is done. All groups advance one
+ * cycle per round, so lanes stay in lockstep while their control agrees.
+ */
+int
+lockstep_run(APEX_Lockstep* ls)
+{
+  int running = 1;
+
+  while (running) {
+    running = 0;
+    int count = ls->num_groups;
+
+    for (int g = 0; g < count; ++g) {
+      APEX_CPU* leader = ls->groups[g]->leader;
+      if (!APEX_cpu_done(leader)) {
+        APEX_cpu_cycle(leader);
+        running = 1;
+      }
+    }
+
+    /* Groups split off this cycle may split again while resuming */
+    for (int g = count; g < ls->num_groups; ++g) {
+      resume_group(ls->groups[g]);
+      running = 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Prints, for every lane, its cycle count, registers and the non-zero
+ * words of the data memory range the scalar dump shows
+ */
+void
+lockstep_print(APEX_Lockstep* ls)
+{
+  printf("\n(apex) >> Lockstep Complete: %d lanes, %d control groups\n",
+         ls->n, ls->num_groups);
+
+  for (int l = 0; l < ls->n; ++l) {
+    APEX_CPU* leader = NULL;
+    for (int g = 0; g < ls->num_groups && !leader; ++g) {
+      if (ls->groups[g]->mask[l]) {
+        leader = ls->groups[g]->leader;
+      }
+    }
+
+    printf(" | Lane[%d] | cycles=%d | instructions=%d |", l, leader->clock,
+           leader->ins_completed);
+    for (int i = 0; i < 16; ++i) {
+      printf(" R%d=%d", i, ls->regs[i][l]);
+    }
+    printf(" |\n |   MEM");
+    for (int a = 0; a < 99; ++a) {
+      int value = lane_read(ls, l, a);
+      if (value) {
+        printf(" [%d]=%d", a, value);
+      }
+    }
+    printf("\n");
+  }
+}
+
+/*
+ * Releases the engine and every leader it cloned. The first leader is
+ * handed back to its owner.
+ */
+void
+lockstep_destroy(APEX_Lockstep* ls)
+{
+  if (!ls) {
+    return;
+  }
+
+  for (int g = 0; g < ls->num_groups; ++g) {
+    if (g == 0) {
+      ls->groups[g]->leader->lanes = NULL;
+    } else {
+      APEX_cpu_stop(ls->groups[g]->leader);
+    }
+    free(ls->groups[g]->mask);
+    free(ls->groups[g]);
+  }
+  free(ls->groups);
+  free(ls->pool);
+  free(ls);
+}
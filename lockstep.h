@@ -0,0 +1,51 @@
+#ifndef _APEX_LOCKSTEP_H_
+#define _APEX_LOCKSTEP_H_
+/**
+ *  lockstep.h
+ *  Lockstep engine that runs one program on many data sets at once.
+ *
+ *  Registers, zero flags, latch values and data memory of every lane are
+ *  stored structure-of-arrays and updated with SIMD across lanes. Lanes
+ *  that take the same control path share one control-only APEX_CPU (the
+ *  group leader); when lanes disagree on a branch, JUMP target or LOOP
+ *  count the group is split and each part is masked to its own lanes.
+ */
+#include "cpu.h"
+
+typedef struct APEX_Lockstep APEX_Lockstep;
+
+APEX_Lockstep*
+lockstep_create(APEX_CPU* cpu, int lanes);
+
+APEX_Lockstep*
+lockstep_load(APEX_CPU* cpu, const char* filename);
+
+void
+lockstep_write(APEX_Lockstep* ls, int lane, int address, int value);
+
+int
+lockstep_run(APEX_Lockstep* ls);
+
+void
+lockstep_print(APEX_Lockstep* ls);
+
+void
+lockstep_destroy(APEX_Lockstep* ls);
+
+/* Data path hooks, called by the pipeline stages of a group leader */
+void
+lockstep_fetch(APEX_CPU* cpu);
+
+void
+lockstep_decode(APEX_CPU* cpu);
+
+void
+lockstep_execute(APEX_CPU* cpu, int active);
+
+void
+lockstep_memory(APEX_CPU* cpu, int active);
+
+void
+lockstep_writeback(APEX_CPU* cpu);
+
+#endif
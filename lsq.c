@@ -0,0 +1,345 @@
+/*
+ *  lsq.c
+ *  Contains the data memory latency model and the load/store queue
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dmem.h"
+#include "lsq.h"
+
+/* One queued memory access, oldest first in the queue */
+typedef struct LSQEntry
+{
+  int store;	// 1 for STORE, 0 for LOAD
+  int address;
+  int value;	// Data to store, or data loaded
+  int rd;	// Destination of a load
+  int issued;	// Access sent to memory
+  int done_at;	// Cycle the access is complete, once issued
+  int retired;	// Instruction written back
+  int dead;	// Load whose register a younger instruction wrote first
+} LSQEntry;
+
+struct APEX_LSQ
+{
+  int entries;	// 0 for no queue
+  int latency;
+  LSQEntry* queue;
+  int count;
+  int wait_until;	// End of the access holding the memory stage, -1 if none
+  int port_cycle;	// Last cycle an access was sent to memory
+
+  /* Statistics */
+  int loads;
+  int stores;
+  int forwarded;	// Loads served by a queued store
+  int bypassed;		// Loads sent to memory past older queued stores
+  int peak_loads;	// Most loads outstanding at once
+  int latency_stalls;	// Cycles the memory stage waited on an access
+  int ordering_stalls;	// Cycles an access waited to keep memory order
+  int full_stalls;	// Cycles the memory stage waited for a free entry
+};
+
+/*
+ * Enables the model on cpu: data accesses take latency cycles and, if
+ * entries is not 0, go through a queue of that many entries.
+ */
+APEX_LSQ*
+lsq_create(APEX_CPU* cpu, int entries, int latency)
+{
+  APEX_LSQ* lsq = calloc(1, sizeof(*lsq));
+  if (!lsq) {
+    return NULL;
+  }
+  lsq->entries = entries > 0 ? entries : 0;
+  lsq->latency = latency > 0 ? latency : 1;
+  lsq->wait_until = -1;
+  lsq->port_cycle = -1;
+  if (lsq->entries) {
+    lsq->queue = calloc(lsq->entries, sizeof(*lsq->queue));
+    if (!lsq->queue) {
+      free(lsq);
+      return NULL;
+    }
+  }
+  cpu->lsq = lsq;
+  return lsq;
+}
+
+void
+lsq_destroy(APEX_LSQ* lsq)
+{
+  free(lsq->queue);
+  free(lsq);
+}
+
+/* Returns 1 once every queued access has completed */
+int
+lsq_idle(APEX_CPU* cpu)
+{
+  return cpu->lsq->count == 0;
+}
+
+static int
+writes_register(const char* opcode)
+{
+  return strcmp(opcode, "MOVC") == 0 || strcmp(opcode, "LOAD") == 0 ||
+         strcmp(opcode, "ADD") == 0 || strcmp(opcode, "SUB") == 0 ||
+         strcmp(opcode, "MUL") == 0 || strcmp(opcode, "AND") == 0 ||
+         strcmp(opcode, "OR") == 0 || strcmp(opcode, "XOR") == 0;
+}
+
+static void
+remove_entry(APEX_LSQ* lsq, int i)
+{
+  memmove(&lsq->queue[i], &lsq->queue[i + 1],
+          sizeof(*lsq->queue) * (lsq->count - i - 1));
+  lsq->count--;
+}
+
+/* Holds the memory stage until an access started now has completed */
+static int
+wait_latency(APEX_CPU* cpu, APEX_LSQ* lsq)
+{
+  if (lsq->wait_until < 0) {
+    lsq->wait_until = cpu->clock + lsq->latency - 1;
+    lsq->port_cycle = cpu->clock;
+  }
+  if (cpu->clock < lsq->wait_until) {
+    lsq->latency_stalls++;
+    return LSQ_HOLD;
+  }
+  lsq->wait_until = -1;
+  return LSQ_ACCESS;
+}
+
+static int
+queue_store(APEX_LSQ* lsq, CPU_Stage* stage)
+{
+  if (lsq->count == lsq->entries) {
+    lsq->full_stalls++;
+    return LSQ_HOLD;
+  }
+
+  LSQEntry* entry = &lsq->queue[lsq->count++];
+  memset(entry, 0, sizeof(*entry));
+  entry->store = 1;
+  entry->address = stage->mem_address;
+  entry->value = stage->rs1_value;
+  lsq->stores++;
+  return LSQ_DONE;
+}
+
+static int
+queue_load(APEX_CPU* cpu, APEX_LSQ* lsq, CPU_Stage* stage)
+{
+  if (lsq->count == lsq->entries) {
+    lsq->full_stalls++;
+    return LSQ_HOLD;
+  }
+
+  LSQEntry* entry = &lsq->queue[lsq->count];
+  memset(entry, 0, sizeof(*entry));
+  entry->address = stage->mem_address;
+  entry->rd = stage->rd;
+  entry->issued = 1;
+  lsq->loads++;
+
+  int older_stores = 0;
+  for (int i = lsq->count - 1; i >= 0; --i) {
+    if (!lsq->queue[i].store) {
+      continue;
+    }
+    if (lsq->queue[i].address == entry->address) {
+      entry->value = lsq->queue[i].value;
+      entry->done_at = cpu->clock;
+      lsq->count++;
+      lsq->forwarded++;
+      return LSQ_DONE;
+    }
+    older_stores = 1;
+  }
+
+  /* Older stores are to other addresses, so memory already holds the
+   * value the load must see
+   */
+  entry->value = dmem_read(cpu, entry->address);
+  entry->done_at = cpu->clock + lsq->latency;
+  lsq->count++;
+  lsq->bypassed += older_stores;
+  lsq->port_cycle = cpu->clock;
+
+  int outstanding = 0;
+  for (int i = 0; i < lsq->count; ++i) {
+    outstanding += !lsq->queue[i].store && lsq->queue[i].done_at > cpu->clock;
+  }
+  if (outstanding > lsq->peak_loads) {
+    lsq->peak_loads = outstanding;
+  }
+  return LSQ_DONE;
+}
+
+/*
+ * Called by the memory stage for the instruction it holds. Returns
+ * LSQ_ACCESS, LSQ_DONE or LSQ_HOLD.
+ */
+int
+lsq_memory(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  APEX_LSQ* lsq = cpu->lsq;
+  int scalar = strcmp(stage->opcode, "LOAD") == 0 ||
+               strcmp(stage->opcode, "STORE") == 0;
+  int vector = strcmp(stage->opcode, "VLOAD") == 0 ||
+               strcmp(stage->opcode, "VSTORE") == 0;
+
+  if (!scalar && !vector) {
+    return LSQ_ACCESS;
+  }
+
+  /* Vector transfers are not queued: they wait for the queue to drain
+   * and then access memory like they would without one
+   */
+  if (!lsq->entries || vector) {
+    if (lsq->count) {
+      lsq->ordering_stalls++;
+      return LSQ_HOLD;
+    }
+    return wait_latency(cpu, lsq);
+  }
+
+  if (strcmp(stage->opcode, "STORE") == 0) {
+    return queue_store(lsq, stage);
+  }
+  return queue_load(cpu, lsq, stage);
+}
+
+/* Marks the loads written back before an instruction writing rd, except
+ * the entry pending, so their data does not overwrite it
+ */
+static void
+kill_older_loads(APEX_LSQ* lsq, int rd, int pending)
+{
+  for (int i = 0; i < lsq->count; ++i) {
+    LSQEntry* entry = &lsq->queue[i];
+    if (!entry->store && entry->retired && entry->rd == rd && i != pending) {
+      entry->dead = 1;
+    }
+  }
+}
+
+/*
+ * Called by writeback for every instruction it retires. Returns 1 for a
+ * LOAD whose data has not arrived yet; its register is written when it
+ * does. Otherwise a LOAD gets its data in its latch.
+ */
+int
+lsq_writeback(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  APEX_LSQ* lsq = cpu->lsq;
+  int load = strcmp(stage->opcode, "LOAD") == 0;
+  int store = strcmp(stage->opcode, "STORE") == 0;
+  int pending = -1;	// Entry of a load still waiting for its data
+
+  /* Everything older than stage has retired, so the first entry of its
+   * kind that has not is its own
+   */
+  for (int i = 0; (load || store) && i < lsq->count; ++i) {
+    LSQEntry* entry = &lsq->queue[i];
+    if (entry->retired || entry->store != store) {
+      continue;
+    }
+    if (load && entry->done_at <= cpu->clock) {
+      stage->buffer = entry->value;
+      remove_entry(lsq, i);
+    } else {
+      entry->retired = 1;
+      pending = load ? i : -1;
+    }
+    break;
+  }
+
+  /* A register written now must not be overwritten by an older load */
+  if (writes_register(stage->opcode)) {
+    kill_older_loads(lsq, stage->rd, pending);
+  }
+  if (stage->fused.kind == FUSE_MOVC_ALU) {
+    kill_older_loads(lsq, stage->fused.rd, pending);
+  }
+  return pending >= 0;
+}
+
+/*
+ * Called at the end of every cycle. Completes the accesses due by the
+ * next cycle, then sends the oldest store that has been written back to
+ * memory if no load used the port this cycle.
+ */
+void
+lsq_cycle(APEX_CPU* cpu)
+{
+  APEX_LSQ* lsq = cpu->lsq;
+
+  for (int i = 0; i < lsq->count; ++i) {
+    LSQEntry* entry = &lsq->queue[i];
+    if (!entry->issued || entry->done_at > cpu->clock + 1) {
+      continue;
+    }
+    if (entry->store) {
+      dmem_write(cpu, entry->address, entry->value);
+    } else if (entry->retired) {
+      if (!entry->dead) {
+        cpu->regs[entry->rd] = entry->value;
+      }
+      cpu->regs_valid[entry->rd]++;
+    } else {
+      continue;	// Written back by its LOAD
+    }
+    remove_entry(lsq, i--);
+  }
+
+  if (lsq->port_cycle == cpu->clock) {
+    return;
+  }
+  for (int i = 0; i < lsq->count; ++i) {
+    LSQEntry* entry = &lsq->queue[i];
+    if (!entry->store || entry->issued) {
+      continue;
+    }
+    if (!entry->retired) {
+      return;
+    }
+
+    /* The store may not reach memory before an older load of the same
+     * address has its data
+     */
+    for (int j = 0; j < i; ++j) {
+      if (!lsq->queue[j].store && lsq->queue[j].address == entry->address &&
+          lsq->queue[j].done_at > cpu->clock) {
+        lsq->ordering_stalls++;
+        return;
+      }
+    }
+    entry->issued = 1;
+    entry->done_at = cpu->clock + lsq->latency;
+    lsq->port_cycle = cpu->clock;
+    return;
+  }
+}
+
+void
+lsq_print(APEX_CPU* cpu)
+{
+  APEX_LSQ* lsq = cpu->lsq;
+
+  printf("\n(apex) >> Memory latency=%d cycles, latency stalls=%d",
+         lsq->latency, lsq->latency_stalls);
+  if (lsq->entries) {
+    printf("\n(apex) >> Load/store queue entries=%d, loads=%d, stores=%d, "
+           "forwarded=%d, bypassed=%d, peak outstanding loads=%d, "
+           "ordering stalls=%d, full stalls=%d",
+           lsq->entries, lsq->loads, lsq->stores, lsq->forwarded,
+           lsq->bypassed, lsq->peak_loads, lsq->ordering_stalls,
+           lsq->full_stalls);
+  }
+}
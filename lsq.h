@@ -0,0 +1,51 @@
+#ifndef _APEX_LSQ_H_
+#define _APEX_LSQ_H_
+/**
+ *  lsq.h
+ *  Data memory latency and the load/store queue.
+ *
+ *  With a latency of more than one cycle and no queue, every memory
+ *  instruction holds the memory stage until its access completes. With a
+ *  queue, STORE is buffered until it has been written back and then
+ *  drained to memory in order, LOAD takes its value from the youngest
+ *  older STORE to the same address or otherwise goes to memory past older
+ *  stores, and several loads can be outstanding while the pipeline moves
+ *  on. A load's register becomes valid when its data arrives.
+ */
+#include "cpu.h"
+
+#define LSQ_DEFAULT_ENTRIES 8
+
+/* What the memory stage does with its instruction this cycle */
+enum
+{
+  LSQ_ACCESS,	// Access data memory directly, as without a queue
+  LSQ_DONE,	// The queue took the access
+  LSQ_HOLD	// Keep the instruction in the memory stage
+};
+
+typedef struct APEX_LSQ APEX_LSQ;
+
+APEX_LSQ*
+lsq_create(APEX_CPU* cpu, int entries, int latency);
+
+void
+lsq_destroy(APEX_LSQ* lsq);
+
+int
+lsq_idle(APEX_CPU* cpu);
+
+void
+lsq_print(APEX_CPU* cpu);
+
+/* Hooks, called only while the model is enabled */
+int
+lsq_memory(APEX_CPU* cpu, CPU_Stage* stage);
+
+int
+lsq_writeback(APEX_CPU* cpu, CPU_Stage* stage);
+
+void
+lsq_cycle(APEX_CPU* cpu);
+
+#endif
@@ -1,26 +1,610 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "analyze.h"
+#include "barrel.h"
+#include "cache.h"
+#include "checkpoint.h"
+#include "compress.h"
 #include "cpu.h"
+#include "dma.h"
+#include "fusion.h"
+#include "hostprof.h"
+#include "lockstep.h"
+#include "lsq.h"
+#include "multicore.h"
+#include "pipeline.h"
+#include "profile.h"
+#include "schedule.h"
+#include "stackdist.h"
+#include "steady.h"
+#include "vpred.h"
+#include "watch.h"
+
+/*
+ * Runs the cpu up to the given cycle, then forks it into two clones that
+ * force the next conditional branch taken and not taken, and runs both
+ * to completion in parallel.
+ */
+static int
+run_what_if(APEX_CPU* cpu, int cycle)
+{
+  static const char* outcome[] = { "taken", "not taken" };
+  APEX_CPU* clones[2];
+
+  while (!APEX_cpu_done(cpu) && cpu->clock < cycle) {
+    APEX_cpu_cycle(cpu);
+  }
+
+  if (APEX_cpu_fork(cpu, 2, clones)) {
+    fprintf(stderr, "APEX_Error : Unable to fork CPU\n");
+    return 1;
+  }
+  clones[0]->force_branch = BRANCH_FORCE_TAKEN;
+  clones[1]->force_branch = BRANCH_FORCE_NOT_TAKEN;
+
+  APEX_cpu_run_parallel(clones, 2);
+
+  if (clones[0]->out_of_memory || clones[1]->out_of_memory) {
+    fprintf(stderr, "APEX_Error : Out of memory for data memory\n");
+    APEX_cpu_stop(clones[0]);
+    APEX_cpu_stop(clones[1]);
+    return 1;
+  }
+  for (int i = 0; i < 2; ++i) {
+    printf("\n(apex) >> What-if from cycle %d, next branch %s: %d cycles\n",
+           cycle, outcome[i], clones[i]->clock);
+    APEX_cpu_print_state(clones[i]);
+    APEX_cpu_stop(clones[i]);
+  }
+  return 0;
+}
+
+/*
+ * Runs the program once per lane of the lane file in lockstep
+ */
+static int
+run_lockstep(APEX_CPU* cpu, const char* filename)
+{
+  APEX_Lockstep* ls = lockstep_load(cpu, filename);
+  if (!ls) {
+    fprintf(stderr, "APEX_Error : Unable to load lanes from %s\n", filename);
+    return 1;
+  }
+
+  lockstep_run(ls);
+  lockstep_print(ls);
+  lockstep_destroy(ls);
+  return 0;
+}
+
+/*
+ * Runs the cpu as core 0 of a multicore, next to one core per extra
+ * program, all sharing data memory
+ */
+static int
+run_multicore(APEX_CPU* cpu, const char** programs, int num_programs,
+              int quantum)
+{
+  int n = num_programs + 1;
+  APEX_CPU* cores[n];
+  int ret = 0;
+
+  cores[0] = cpu;
+  for (int i = 1; i < n; ++i) {
+    cores[i] = APEX_cpu_init(programs[i - 1]);
+    if (!cores[i]) {
+      fprintf(stderr, "APEX_Error : Unable to initialize core %d from %s\n",
+              i, programs[i - 1]);
+      n = i;
+      ret = 1;
+      break;
+    }
+    cores[i]->sim = cpu->sim;
+    cores[i]->no_cycles = cpu->no_cycles;
+  }
+
+  APEX_Multicore* mc = ret ? NULL : multicore_create(cores, n, quantum);
+  if (mc) {
+    if (multicore_run(mc)) {
+      fprintf(stderr, "APEX_Error : Out of memory for the access log, "
+                      "multicore run stopped\n");
+      ret = 1;
+    } else {
+      multicore_print(mc);
+    }
+    multicore_destroy(mc);
+  } else if (!ret) {
+    fprintf(stderr, "APEX_Error : Unable to create multicore\n");
+    ret = 1;
+  }
+
+  for (int i = 1; i < n; ++i) {
+    APEX_cpu_stop(cores[i]);
+  }
+  return ret;
+}
+
+/*
+ * Runs the cpu as a barrel core, with its program as thread 0 and one
+ * more hardware thread per extra program
+ */
+static int
+run_barrel(APEX_CPU* cpu, const char** programs, int num_programs,
+           int policy)
+{
+  APEX_Barrel* barrel = barrel_create(cpu, programs, num_programs, policy);
+  if (!barrel) {
+    fprintf(stderr, "APEX_Error : Unable to create %d hardware threads\n",
+            num_programs + 1);
+    return 1;
+  }
+
+  barrel_run(barrel);
+  barrel_print(barrel);
+  barrel_destroy(barrel);
+  return 0;
+}
 
 int
 main(int argc, char const* argv[])
 {
-  if (argc != 4) {
-    fprintf(stderr, "APEX_Help : Usage %s <input_file>\n", argv[0]);
+  int what_if = -1;
+  const char* lanes = NULL;
+  const char* cores[argc];
+  int num_cores = 0;
+  int quantum = 1;
+  const char* threads[argc];
+  int num_threads = 0;
+  int policy = FETCH_SKIP_STALLED;
+  const char* watches[argc];
+  int num_watches = 0;
+  int on_hit = WATCH_STOP;
+  const char* checkpoint_dir = NULL;
+  int checkpoint_interval = 1000;
+  const char* cache_dir = NULL;
+  long cache_size = CACHE_DEFAULT_SIZE;
+  int fast_forward = 0;
+  int analyze = 0;
+  int schedule = 0;
+  const char* schedule_out = NULL;
+  int lsq_entries = 0;
+  int mem_latency = 0;
+  const char* stages = NULL;
+  int profiling = 0;
+  const char* profile_out = NULL;
+  int host_profile = 0;
+  int value_predict = 0;
+  const char* fuse = NULL;
+  int stack_distance = 0;
+  int dma_bandwidth = 0;
+  int compress = 0;
+  const char* compress_out = NULL;
+  int line_size = STACKDIST_DEFAULT_LINE;
+
+  if (argc < 4) {
+    fprintf(stderr,
+            "APEX_Help : Usage %s <input_file> display|simulate <cycles> "
+            "[--what-if=<cycle>] [--lockstep=<lane_file>] "
+            "[--core=<input_file>]... [--quantum=<cycles>] "
+            "[--thread=<input_file>]... [--fetch=rr|skip] "
+            "[--break=pc:<pc>|clock:<cycle>|retired:<count>]... "
+            "[--watch=R<n>|mem:<address>]... [--on-hit=stop|trace] "
+            "[--checkpoints=<dir>] [--checkpoint-every=<cycles>] "
+            "[--cache=<dir>] [--cache-size=<bytes>] [--fast-forward] "
+            "[--analyze[=<iterations>]] [--schedule[=<output_file>]] "
+            "[--mem-latency=<cycles>] [--lsq[=<entries>]] "
+            "[--stages=<stage>:<cycles>,...] [--profile[=<folded_file>]] "
+            "[--host-profile] [--value-predict[=<entries>]] "
+            "[--fuse[=<pair>,...]] [--stack-distance[=<line size>]] "
+            "[--dma[=<words per cycle>]] [--compress[=<listing_file>]]\n",
+            argv[0]);
     exit(1);
   }
 
+  for (int i = 4; i < argc; ++i) {
+    if (strncmp(argv[i], "--what-if=", 10) == 0) {
+      what_if = atoi(argv[i] + 10);
+    } else if (strncmp(argv[i], "--lockstep=", 11) == 0) {
+      lanes = argv[i] + 11;
+    } else if (strncmp(argv[i], "--core=", 7) == 0) {
+      cores[num_cores++] = argv[i] + 7;
+    } else if (strncmp(argv[i], "--quantum=", 10) == 0) {
+      quantum = atoi(argv[i] + 10);
+    } else if (strncmp(argv[i], "--thread=", 9) == 0) {
+      threads[num_threads++] = argv[i] + 9;
+    } else if (strcmp(argv[i], "--fetch=rr") == 0) {
+      policy = FETCH_ROUND_ROBIN;
+    } else if (strcmp(argv[i], "--fetch=skip") == 0) {
+      policy = FETCH_SKIP_STALLED;
+    } else if (strncmp(argv[i], "--break=", 8) == 0) {
+      watches[num_watches++] = argv[i] + 8;
+    } else if (strncmp(argv[i], "--watch=", 8) == 0) {
+      watches[num_watches++] = argv[i] + 8;
+    } else if (strcmp(argv[i], "--on-hit=stop") == 0) {
+      on_hit = WATCH_STOP;
+    } else if (strcmp(argv[i], "--on-hit=trace") == 0) {
+      on_hit = WATCH_TRACE;
+    } else if (strncmp(argv[i], "--checkpoints=", 14) == 0) {
+      checkpoint_dir = argv[i] + 14;
+    } else if (strncmp(argv[i], "--checkpoint-every=", 19) == 0) {
+      checkpoint_interval = atoi(argv[i] + 19);
+    } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+      cache_dir = argv[i] + 8;
+    } else if (strncmp(argv[i], "--cache-size=", 13) == 0) {
+      cache_size = atol(argv[i] + 13);
+    } else if (strcmp(argv[i], "--fast-forward") == 0) {
+      fast_forward = 1;
+    } else if (strcmp(argv[i], "--analyze") == 0) {
+      analyze = ANALYZE_DEFAULT_ITERATIONS;
+    } else if (strncmp(argv[i], "--analyze=", 10) == 0) {
+      analyze = atoi(argv[i] + 10);
+    } else if (strcmp(argv[i], "--schedule") == 0) {
+      schedule = 1;
+    } else if (strncmp(argv[i], "--schedule=", 11) == 0) {
+      schedule = 1;
+      schedule_out = argv[i] + 11;
+    } else if (strncmp(argv[i], "--mem-latency=", 14) == 0) {
+      mem_latency = atoi(argv[i] + 14);
+    } else if (strcmp(argv[i], "--lsq") == 0) {
+      lsq_entries = LSQ_DEFAULT_ENTRIES;
+    } else if (strncmp(argv[i], "--lsq=", 6) == 0) {
+      lsq_entries = atoi(argv[i] + 6);
+    } else if (strncmp(argv[i], "--stages=", 9) == 0) {
+      stages = argv[i] + 9;
+    } else if (strcmp(argv[i], "--profile") == 0) {
+      profiling = 1;
+    } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+      profiling = 1;
+      profile_out = argv[i] + 10;
+    } else if (strcmp(argv[i], "--host-profile") == 0) {
+      host_profile = 1;
+    } else if (strcmp(argv[i], "--value-predict") == 0) {
+      value_predict = VPRED_DEFAULT_ENTRIES;
+    } else if (strncmp(argv[i], "--value-predict=", 16) == 0) {
+      value_predict = atoi(argv[i] + 16);
+    } else if (strcmp(argv[i], "--fuse") == 0) {
+      fuse = "all";
+    } else if (strncmp(argv[i], "--fuse=", 7) == 0) {
+      fuse = argv[i] + 7;
+    } else if (strcmp(argv[i], "--stack-distance") == 0) {
+      stack_distance = 1;
+    } else if (strncmp(argv[i], "--stack-distance=", 17) == 0) {
+      stack_distance = 1;
+      line_size = atoi(argv[i] + 17);
+    } else if (strcmp(argv[i], "--dma") == 0) {
+      dma_bandwidth = DMA_DEFAULT_BANDWIDTH;
+    } else if (strncmp(argv[i], "--dma=", 6) == 0) {
+      dma_bandwidth = atoi(argv[i] + 6);
+    } else if (strcmp(argv[i], "--compress") == 0) {
+      compress = 1;
+    } else if (strncmp(argv[i], "--compress=", 11) == 0) {
+      compress = 1;
+      compress_out = argv[i] + 11;
+    } else {
+      fprintf(stderr, "APEX_Error : Unknown option %s\n", argv[i]);
+      exit(1);
+    }
+  }
+
+  long load_start = hostprof_now();
   APEX_CPU* cpu = APEX_cpu_init(argv[1]);
   if (!cpu) {
     fprintf(stderr, "APEX_Error : Unable to initialize CPU\n");
     exit(1);
   }
-  
+
+  /* Instrumentation is on before anything runs a cycle */
+  APEX_HostProfile* host = NULL;
+  if (host_profile) {
+    if (num_threads || num_cores || lanes || what_if >= 0) {
+      fprintf(stderr, "APEX_Error : --host-profile cannot be combined with "
+                      "threads, cores, lanes or what-if\n");
+      exit(1);
+    }
+    host = hostprof_create(cpu, hostprof_now() - load_start);
+    if (!host) {
+      fprintf(stderr, "APEX_Error : Unable to create host profile\n");
+      exit(1);
+    }
+  }
+
   cpu->sim=argv[2];
   cpu->no_cycles=atoi(argv[3]);
 
-  APEX_cpu_run(cpu);
+  if (stages) {
+    if (num_threads || num_cores || lanes || checkpoint_dir || fast_forward) {
+      fprintf(stderr, "APEX_Error : --stages cannot be combined with "
+                      "threads, cores, lanes, checkpoints or fast-forward\n");
+      exit(1);
+    }
+    if (pipeline_configure(cpu, stages)) {
+      fprintf(stderr, "APEX_Error : Bad stage configuration %s\n", stages);
+      exit(1);
+    }
+  }
+
+  /* A fused pair retires as one event, which breakpoints cannot stop in */
+  if (fuse) {
+    if (num_threads || num_cores || lanes || checkpoint_dir || fast_forward ||
+        num_watches) {
+      fprintf(stderr, "APEX_Error : --fuse cannot be combined with threads, "
+                      "cores, lanes, checkpoints, fast-forward or "
+                      "breakpoints\n");
+      exit(1);
+    }
+    if (fusion_configure(cpu, fuse)) {
+      fprintf(stderr, "APEX_Error : Bad fusion pairs %s\n", fuse);
+      exit(1);
+    }
+  }
+
+  /* Scheduling rewrites code memory before anything else looks at it */
+  if (schedule && sched_program(cpu, schedule_out)) {
+    fprintf(stderr, "APEX_Error : Unable to write scheduled program to %s\n",
+            schedule_out);
+    exit(1);
+  }
+
+  /* Compression moves every pc after the first, so it follows scheduling
+   * and excludes the modes that keep pcs or 4-byte offsets of their own
+   */
+  if (compress) {
+    if (num_threads || num_cores || lanes || checkpoint_dir || analyze ||
+        profiling || num_watches) {
+      fprintf(stderr, "APEX_Error : --compress cannot be combined with "
+                      "threads, cores, lanes, checkpoints, --analyze, "
+                      "--profile or breakpoints\n");
+      exit(1);
+    }
+    int ret = compress_program(cpu, compress_out);
+    if (ret == COMPRESS_RELOCATE) {
+      fprintf(stderr, "APEX_Error : --compress cannot relocate JUMP targets "
+                      "or offsets that are not whole instructions\n");
+      exit(1);
+    }
+    if (ret == COMPRESS_NO_MEMORY) {
+      fprintf(stderr, "APEX_Error : Unable to compress program\n");
+      exit(1);
+    }
+    if (ret == COMPRESS_LISTING) {
+      fprintf(stderr, "APEX_Error : Unable to write compressed listing to "
+                      "%s\n",
+              compress_out);
+      exit(1);
+    }
+  }
+
+  /* Analysis replaces the run */
+  if (analyze) {
+    int ret = analyze_program(cpu, analyze);
+    APEX_cpu_stop(cpu);
+    return ret ? 1 : 0;
+  }
+
+  /* The other run modes do not check breakpoints, and the watched run
+   * replaces cached, checkpointed and fast-forwarded ones
+   */
+  APEX_Watch* watch = NULL;
+  if (num_watches) {
+    if (num_threads || num_cores || lanes || what_if >= 0 || checkpoint_dir ||
+        cache_dir || fast_forward) {
+      fprintf(stderr, "APEX_Error : --break and --watch only apply to a "
+                      "plain single-core run without checkpoints, --cache "
+                      "or --fast-forward\n");
+      exit(1);
+    }
+    watch = watch_create(cpu, on_hit);
+    if (!watch) {
+      fprintf(stderr, "APEX_Error : Unable to set breakpoints\n");
+      exit(1);
+    }
+    for (int i = 0; i < num_watches; ++i) {
+      if (watch_add(watch, watches[i])) {
+        fprintf(stderr, "APEX_Error : Bad breakpoint or watchpoint %s\n",
+                watches[i]);
+        exit(1);
+      }
+    }
+  }
+
+  APEX_Checkpoints* checkpoints = NULL;
+  if (checkpoint_dir) {
+    if (num_threads || num_cores || lanes || what_if >= 0) {
+      fprintf(stderr, "APEX_Error : --checkpoints only applies to a plain "
+                      "single-core run\n");
+      exit(1);
+    }
+    checkpoints = checkpoint_open(cpu, checkpoint_dir, checkpoint_interval);
+    if (!checkpoints) {
+      fprintf(stderr, "APEX_Error : Unable to use checkpoint directory %s\n",
+              checkpoint_dir);
+      exit(1);
+    }
+  }
+
+  APEX_Cache* cache = NULL;
+  if (cache_dir) {
+    if (num_threads || num_cores || lanes || what_if >= 0) {
+      fprintf(stderr, "APEX_Error : --cache only applies to a plain "
+                      "single-core run\n");
+      exit(1);
+    }
+    cache = cache_open(cpu, cache_dir, cache_size);
+    if (!cache) {
+      fprintf(stderr, "APEX_Error : Unable to use cache directory %s\n",
+              cache_dir);
+      exit(1);
+    }
+  }
+
+  /* Skipping needs the whole cpu to itself, and checkpoints and
+   * breakpoints run cycle by cycle
+   */
+  APEX_Steady* steady = NULL;
+  if (fast_forward) {
+    if (num_threads || num_cores || lanes || what_if >= 0 || checkpoints ||
+        watch) {
+      fprintf(stderr, "APEX_Error : --fast-forward only applies to a plain "
+                      "single-core run without checkpoints or "
+                      "breakpoints\n");
+      exit(1);
+    }
+    steady = steady_create(cpu);
+    if (!steady) {
+      fprintf(stderr, "APEX_Error : Unable to enable fast-forwarding\n");
+      exit(1);
+    }
+  }
+
+  /* The queue lives outside the cpu, where clones, checkpoints, cached
+   * results and the other run modes do not see it
+   */
+  APEX_LSQ* lsq = NULL;
+  if (lsq_entries || mem_latency) {
+    if (num_threads || num_cores || lanes || what_if >= 0 || checkpoints ||
+        cache || steady) {
+      fprintf(stderr, "APEX_Error : --mem-latency and --lsq only apply to "
+                      "a plain single-core run\n");
+      exit(1);
+    }
+    lsq = lsq_create(cpu, lsq_entries, mem_latency);
+    if (!lsq) {
+      fprintf(stderr, "APEX_Error : Unable to create load/store queue\n");
+      exit(1);
+    }
+  }
+
+  /* The engine shares the data memory port of the memory stage, and no
+   * clone, checkpoint or cached result holds its registers
+   */
+  APEX_DMA* dma = NULL;
+  if (dma_bandwidth) {
+    if (num_threads || num_cores || lanes || what_if >= 0 || checkpoints ||
+        cache || steady || lsq) {
+      fprintf(stderr, "APEX_Error : --dma only applies to a plain "
+                      "single-core run with single cycle data memory\n");
+      exit(1);
+    }
+    dma = dma_create(cpu, dma_bandwidth);
+    if (!dma) {
+      fprintf(stderr, "APEX_Error : Unable to attach DMA engine\n");
+      exit(1);
+    }
+  }
+
+  /* Only the cycles this cpu runs itself can be charged to its program */
+  APEX_Profile* profile = NULL;
+  if (profiling) {
+    if (num_threads || num_cores || lanes || what_if >= 0 || checkpoints ||
+        cache || steady) {
+      fprintf(stderr, "APEX_Error : --profile only applies to a plain "
+                      "single-core run\n");
+      exit(1);
+    }
+    profile = profile_create(cpu);
+    if (!profile) {
+      fprintf(stderr, "APEX_Error : Unable to create profile\n");
+      exit(1);
+    }
+  }
+
+  /* Predictions are checked in the memory stage, so the data has to be
+   * there; the baseline run it is compared with is a clone taken here
+   */
+  APEX_ValuePredictor* vpred = NULL;
+  if (value_predict) {
+    if (num_threads || num_cores || lanes || what_if >= 0 || checkpoints ||
+        cache || steady || watch || lsq || dma || profile) {
+      fprintf(stderr, "APEX_Error : --value-predict only applies to a plain "
+                      "single-core run with single cycle data memory, "
+                      "without breakpoints, --dma or --profile\n");
+      exit(1);
+    }
+    vpred = vpred_create(cpu, value_predict);
+    if (!vpred) {
+      fprintf(stderr, "APEX_Error : Unable to create value predictor\n");
+      exit(1);
+    }
+  }
+
+  /* Runs that skip or share cycles would leave holes in the stream */
+  APEX_StackDistance* stackdist = NULL;
+  if (stack_distance) {
+    if (num_threads || num_cores || lanes || what_if >= 0 || checkpoints ||
+        cache || steady) {
+      fprintf(stderr, "APEX_Error : --stack-distance only applies to a "
+                      "plain single-core run\n");
+      exit(1);
+    }
+    stackdist = stackdist_create(cpu, line_size);
+    if (!stackdist) {
+      fprintf(stderr, "APEX_Error : Bad line size %d, must be a power of "
+                      "two up to %d\n",
+              line_size, DATA_MEMORY_SIZE);
+      exit(1);
+    }
+  }
+
+  int ret = 0;
+  if (num_threads) {
+    ret = run_barrel(cpu, threads, num_threads, policy);
+  } else if (num_cores) {
+    ret = run_multicore(cpu, cores, num_cores, quantum);
+  } else if (lanes) {
+    ret = run_lockstep(cpu, lanes);
+  } else if (what_if >= 0) {
+    ret = run_what_if(cpu, what_if);
+  } else {
+    ret = APEX_cpu_run(cpu);
+  }
+  if (watch) {
+    cpu->watch = NULL;
+    watch_destroy(watch);
+  }
+  if (checkpoints) {
+    cpu->checkpoints = NULL;
+    checkpoint_close(checkpoints);
+  }
+  if (cache) {
+    cpu->cache = NULL;
+    cache_close(cache);
+  }
+  if (steady) {
+    cpu->steady = NULL;
+    steady_destroy(steady);
+  }
+  if (lsq) {
+    cpu->lsq = NULL;
+    lsq_destroy(lsq);
+  }
+  if (dma) {
+    cpu->dma = NULL;
+    dma_destroy(dma);
+  }
+  if (vpred) {
+    cpu->vpred = NULL;
+    vpred_destroy(vpred);
+  }
+  if (stackdist) {
+    cpu->stack_distance = NULL;
+    stackdist_destroy(stackdist);
+  }
+  if (profile) {
+    if (profile_out && profile_write_folded(cpu, profile_out, argv[1])) {
+      fprintf(stderr, "APEX_Error : Unable to write profile to %s\n",
+              profile_out);
+      ret = 1;
+    }
+    cpu->profile = NULL;
+    profile_destroy(profile);
+  }
+  if (host) {
+    hostprof_print(cpu);
+    cpu->host_profile = NULL;
+    hostprof_destroy(host);
+  }
   APEX_cpu_stop(cpu);
-  return 0;
-}
\ No newline at end of file
+  return ret;
+}
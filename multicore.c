@@ -0,0 +1,431 @@
+/*
+ *  multicore.c
+ *  Contains the shared data memory, the MSI coherence model of the private
+ *  L1s and the quantum synchronized host threads of a multicore run
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multicore.h"
+
+/* MSI line states */
+enum
+{
+  LINE_I,
+  LINE_S,
+  LINE_M
+};
+
+/* One data memory access, logged for the coherence model */
+typedef struct Access
+{
+  int cycle;
+  int address;
+  int value;
+  int write;
+} Access;
+
+typedef struct APEX_Port
+{
+  struct APEX_Multicore* mc;
+  APEX_CPU* cpu;
+  int core;
+
+  /* Writes of the current quantum, seen only by this core until committed */
+  int overlay[DATA_MEMORY_SIZE];
+  unsigned char written[DATA_MEMORY_SIZE];
+  int written_list[DATA_MEMORY_SIZE];
+  int num_written;
+
+  /* Accesses of the current quantum, in program order */
+  Access* log;
+  int log_size;
+  int log_cap;
+  int log_head;
+
+  /* Private L1, direct mapped */
+  int tag[L1_LINES];
+  unsigned char state[L1_LINES];
+
+  /* Stats */
+  int loads;
+  int stores;
+  int hits;
+  int misses;
+  int upgrades;
+  int invalidations;
+  int writebacks;
+} APEX_Port;
+
+struct APEX_Multicore
+{
+  APEX_Port* ports;
+  int num_cores;
+  int quantum;
+  int quantum_end;
+  int quanta;
+  int finished;
+  int out_of_memory;
+  int workers;
+
+  int memory[DATA_MEMORY_SIZE];
+
+  pthread_barrier_t barrier;
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  int started;
+};
+
+typedef struct Worker
+{
+  APEX_Multicore* mc;
+  int id;
+} Worker;
+
+/*
+ * Records an access for the coherence replay. If the log cannot grow the
+ * core is stopped out of memory, which ends the run at the next barrier.
+ */
+static void
+log_access(APEX_Port* port, int address, int value, int write)
+{
+  if (port->log_size == port->log_cap) {
+    int cap = port->log_cap ? 2 * port->log_cap : 64;
+    Access* log = realloc(port->log, cap * sizeof(*log));
+    if (!log) {
+      port->cpu->out_of_memory = 1;
+      return;
+    }
+    port->log = log;
+    port->log_cap = cap;
+  }
+  Access* a = &port->log[port->log_size++];
+  a->cycle = port->cpu->clock;
+  a->address = address;
+  a->value = value;
+  a->write = write;
+}
+
+/*
+ * Reads one word of shared memory. The core sees its own writes of this
+ * quantum, and otherwise memory as committed at the last barrier.
+ */
+int
+port_read(APEX_Port* port, int address)
+{
+  if (address < 0 || address >= DATA_MEMORY_SIZE) {
+    return 0;
+  }
+
+  int value = port->written[address] ? port->overlay[address]
+                                     : port->mc->memory[address];
+  log_access(port, address, value, 0);
+  return value;
+}
+
+/*
+ * Writes one word of shared memory. The write is buffered until the end
+ * of the quantum.
+ */
+void
+port_write(APEX_Port* port, int address, int value)
+{
+  if (address < 0 || address >= DATA_MEMORY_SIZE) {
+    return;
+  }
+
+  if (!port->written[address]) {
+    port->written[address] = 1;
+    port->written_list[port->num_written++] = address;
+  }
+  port->overlay[address] = value;
+  log_access(port, address, value, 1);
+}
+
+static int
+l1_holds(APEX_Port* port, int line)
+{
+  int set = line % L1_LINES;
+  return port->state[set] != LINE_I && port->tag[set] == line;
+}
+
+/* Makes room for line in the L1 of port, writing back a modified victim */
+static void
+l1_fill(APEX_Port* port, int line, int state)
+{
+  int set = line % L1_LINES;
+  if (port->state[set] == LINE_M) {
+    port->writebacks++;
+  }
+  port->tag[set] = line;
+  port->state[set] = state;
+}
+
+/*
+ * Runs one access through the MSI protocol. A read miss downgrades a
+ * modified copy elsewhere to shared; a write invalidates all other copies.
+ */
+static void
+coherence_access(APEX_Multicore* mc, APEX_Port* port, Access* a)
+{
+  int line = a->address / L1_LINE_WORDS;
+  int set = line % L1_LINES;
+  int hit = l1_holds(port, line);
+
+  if (!a->write) {
+    port->loads++;
+    if (hit) {
+      port->hits++;
+      return;
+    }
+    port->misses++;
+    for (int i = 0; i < mc->num_cores; ++i) {
+      APEX_Port* other = &mc->ports[i];
+      if (other != port && l1_holds(other, line) &&
+          other->state[set] == LINE_M) {
+        other->writebacks++;
+        other->state[set] = LINE_S;
+      }
+    }
+    l1_fill(port, line, LINE_S);
+    return;
+  }
+
+  port->stores++;
+  if (hit && port->state[set] == LINE_M) {
+    port->hits++;
+  } else {
+    if (hit) {
+      port->upgrades++;
+      port->state[set] = LINE_M;
+    } else {
+      port->misses++;
+      l1_fill(port, line, LINE_M);
+    }
+    for (int i = 0; i < mc->num_cores; ++i) {
+      APEX_Port* other = &mc->ports[i];
+      if (other != port && l1_holds(other, line)) {
+        if (other->state[set] == LINE_M) {
+          other->writebacks++;
+        }
+        other->state[set] = LINE_I;
+        other->invalidations++;
+      }
+    }
+  }
+  mc->memory[a->address] = a->value;
+}
+
+/*
+ * Ends a quantum. The access logs of all cores are merged in (cycle, core)
+ * order and replayed through the coherence model, which also commits the
+ * writes, so the outcome is the same however the host threads ran.
+ */
+static void
+commit_quantum(APEX_Multicore* mc)
+{
+  for (;;) {
+    APEX_Port* next = NULL;
+    for (int i = 0; i < mc->num_cores; ++i) {
+      APEX_Port* port = &mc->ports[i];
+      if (port->log_head < port->log_size &&
+          (!next || port->log[port->log_head].cycle <
+                      next->log[next->log_head].cycle)) {
+        next = port;
+      }
+    }
+    if (!next) {
+      break;
+    }
+    coherence_access(mc, next, &next->log[next->log_head++]);
+  }
+
+  mc->finished = 1;
+  for (int i = 0; i < mc->num_cores; ++i) {
+    APEX_Port* port = &mc->ports[i];
+    for (int j = 0; j < port->num_written; ++j) {
+      port->written[port->written_list[j]] = 0;
+    }
+    port->num_written = 0;
+    port->log_size = 0;
+    port->log_head = 0;
+    if (!APEX_cpu_done(port->cpu)) {
+      mc->finished = 0;
+    }
+    if (port->cpu->out_of_memory) {
+      mc->out_of_memory = 1;
+    }
+  }
+  if (mc->out_of_memory) {
+    mc->finished = 1;
+  }
+  mc->quanta++;
+  mc->quantum_end += mc->quantum;
+}
+
+/* Runs the cores of one worker quantum by quantum until all cores are done */
+static void
+run_worker(APEX_Multicore* mc, int id)
+{
+  while (!mc->finished) {
+    for (int i = id; i < mc->num_cores; i += mc->workers) {
+      APEX_CPU* cpu = mc->ports[i].cpu;
+      while (!APEX_cpu_done(cpu) && cpu->clock < mc->quantum_end) {
+        APEX_cpu_cycle(cpu);
+      }
+    }
+
+    if (mc->workers == 1) {
+      commit_quantum(mc);
+    } else {
+      if (pthread_barrier_wait(&mc->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+        commit_quantum(mc);
+      }
+      pthread_barrier_wait(&mc->barrier);
+    }
+  }
+}
+
+static void*
+worker_thread(void* arg)
+{
+  Worker* worker = arg;
+  APEX_Multicore* mc = worker->mc;
+
+  pthread_mutex_lock(&mc->lock);
+  while (!mc->started) {
+    pthread_cond_wait(&mc->start, &mc->lock);
+  }
+  pthread_mutex_unlock(&mc->lock);
+
+  if (mc->started > 0) {
+    run_worker(mc, worker->id);
+  }
+  return NULL;
+}
+
+/*
+ * Attaches the cores to a new shared memory. A store becomes visible to
+ * the other cores at the end of the quantum it was made in, so quantum is
+ * the coherence latency in cycles.
+ */
+APEX_Multicore*
+multicore_create(APEX_CPU** cores, int num_cores, int quantum)
+{
+  APEX_Multicore* mc = calloc(1, sizeof(*mc));
+  if (!mc) {
+    return NULL;
+  }
+
+  mc->ports = calloc(num_cores, sizeof(*mc->ports));
+  if (!mc->ports) {
+    free(mc);
+    return NULL;
+  }
+
+  mc->num_cores = num_cores;
+  mc->quantum = quantum > 0 ? quantum : 1;
+  mc->quantum_end = mc->quantum;
+  pthread_mutex_init(&mc->lock, NULL);
+  pthread_cond_init(&mc->start, NULL);
+
+  for (int i = 0; i < num_cores; ++i) {
+    mc->ports[i].mc = mc;
+    mc->ports[i].cpu = cores[i];
+    mc->ports[i].core = i;
+    cores[i]->port = &mc->ports[i];
+  }
+  return mc;
+}
+
+/*
+ * Runs all cores to completion, one host thread per core. If threads
+ * can not be created the remaining cores are shared by the threads that
+ * were, with the same result. Returns -1 if a core ran out of memory for
+ * its access log, which stops all cores.
+ */
+int
+multicore_run(APEX_Multicore* mc)
+{
+  int n = mc->num_cores;
+  pthread_t threads[n];
+  Worker workers[n];
+  int created = 0;
+
+  for (int i = 1; i < n; ++i) {
+    workers[i].mc = mc;
+    workers[i].id = i;
+    if (pthread_create(&threads[i], NULL, worker_thread, &workers[i])) {
+      break;
+    }
+    created++;
+  }
+
+  mc->workers = created + 1;
+  int started = 1;
+  if (mc->workers > 1 &&
+      pthread_barrier_init(&mc->barrier, NULL, mc->workers)) {
+    started = -1;
+  }
+
+  pthread_mutex_lock(&mc->lock);
+  mc->started = started;
+  pthread_cond_broadcast(&mc->start);
+  pthread_mutex_unlock(&mc->lock);
+
+  if (started < 0) {
+    mc->workers = 1;
+  }
+  run_worker(mc, 0);
+
+  for (int i = 1; i <= created; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  if (created && started > 0) {
+    pthread_barrier_destroy(&mc->barrier);
+  }
+  return mc->out_of_memory ? -1 : 0;
+}
+
+void
+multicore_print(APEX_Multicore* mc)
+{
+  printf("\n(apex) >> Multicore Simulation Complete: %d cores, quantum %d "
+         "cycles, %d quanta, %d host threads\n",
+         mc->num_cores, mc->quantum, mc->quanta, mc->workers);
+
+  for (int i = 0; i < mc->num_cores; ++i) {
+    APEX_Port* port = &mc->ports[i];
+    APEX_CPU* cpu = port->cpu;
+
+    printf("\n=====CORE %d: %d cycles============\n", i, cpu->clock);
+    printf(" | L1 | loads=%d | stores=%d | hits=%d | misses=%d | upgrades=%d "
+           "| invalidations=%d | writebacks=%d | \n",
+           port->loads, port->stores, port->hits, port->misses,
+           port->upgrades, port->invalidations, port->writebacks);
+    for (int j = 0; j < 16; j++) {
+      printf(" | Register[%d] | Value=%d | status=%s | \n", j, cpu->regs[j],
+             (cpu->regs_valid[j]) ? "Valid" : "Invalid");
+    }
+  }
+
+  printf("=======SHARED DATA MEMORY====\n");
+  for (int i = 0; i < 99; i++) {
+    printf(" | MEM[%d] | Value=%d | \n", i, mc->memory[i]);
+  }
+}
+
+void
+multicore_destroy(APEX_Multicore* mc)
+{
+  for (int i = 0; i < mc->num_cores; ++i) {
+    mc->ports[i].cpu->port = NULL;
+    free(mc->ports[i].log);
+  }
+  pthread_mutex_destroy(&mc->lock);
+  pthread_cond_destroy(&mc->start);
+  free(mc->ports);
+  free(mc);
+}
@@ -0,0 +1,42 @@
+#ifndef _APEX_MULTICORE_H_
+#define _APEX_MULTICORE_H_
+/**
+ *  multicore.h
+ *  Several APEX cores, each with its own program and private L1, sharing
+ *  one data memory kept coherent with MSI.
+ *
+ *  Every core runs on its own host thread for a quantum of cycles. During
+ *  a quantum a core sees shared memory as it was at the start of the
+ *  quantum plus its own writes. At the quantum barrier all accesses are
+ *  replayed in (cycle, core) order through the coherence model and the
+ *  writes are committed, so results do not depend on host scheduling and
+ *  a store becomes visible to other cores within one quantum.
+ */
+#include "cpu.h"
+
+/* Private L1 geometry, direct mapped */
+#define L1_LINES 64
+#define L1_LINE_WORDS 16
+
+typedef struct APEX_Multicore APEX_Multicore;
+
+APEX_Multicore*
+multicore_create(APEX_CPU** cores, int num_cores, int quantum);
+
+int
+multicore_run(APEX_Multicore* mc);
+
+void
+multicore_print(APEX_Multicore* mc);
+
+void
+multicore_destroy(APEX_Multicore* mc);
+
+/* Data memory accesses of a core attached to a multicore */
+int
+port_read(struct APEX_Port* port, int address);
+
+void
+port_write(struct APEX_Port* port, int address, int value);
+
+#endif
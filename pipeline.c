@@ -0,0 +1,210 @@
+/*
+ *  pipeline.c
+ *  Contains the stage table and the sub-stage latches of split stages
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "hostprof.h"
+#include "pipeline.h"
+#include "trace.h"
+#include "vector.h"
+#include "vpred.h"
+
+const APEX_StageInfo pipeline_stages[NUM_STAGES] = {
+  { "F", "Fetch", { "Fetch 2", "Fetch 3", "Fetch 4" }, fetch },
+  { "DRF", "Decode/RF", { "Decode/RF 2", "Decode/RF 3", "Decode/RF 4" },
+    decode },
+  { "EX", "Execute", { "Execute 2", "Execute 3", "Execute 4" }, execute },
+  { "MEM", "Memory", { "Memory 2", "Memory 3", "Memory 4" }, memory },
+  { "WB", "Writeback", { NULL }, writeback }
+};
+
+/*
+ * Splits stages of a freshly initialized cpu as given by spec, a comma
+ * separated list of <stage>:<cycles> such as "EX:3,MEM:2". Writeback
+ * cannot be split. Returns 0 on success.
+ */
+int
+pipeline_configure(APEX_CPU* cpu, const char* spec)
+{
+  char* copy = strdup(spec);
+  char* save = NULL;
+  int ret = 0;
+
+  if (!copy) {
+    return -1;
+  }
+  for (char* item = strtok_r(copy, ",", &save); item && !ret;
+       item = strtok_r(NULL, ",", &save)) {
+    char* colon = strchr(item, ':');
+    int s = 0;
+
+    if (colon) {
+      *colon = '\0';
+      while (s < WB && strcmp(item, pipeline_stages[s].option) != 0) {
+        s++;
+      }
+    }
+    int cycles = colon ? atoi(colon + 1) : 0;
+    if (!colon || s == WB || cycles < 1 || cycles > PIPELINE_MAX_EXTRA + 1) {
+      ret = -1;
+      break;
+    }
+
+    /* Sub-stages start out like the stage they lead to */
+    cpu->stage_extra[s] = cycles - 1;
+    for (int k = 0; k < cpu->stage_extra[s]; ++k) {
+      cpu->transit[s][k] = cpu->stage[s + 1];
+    }
+  }
+  free(copy);
+  return ret;
+}
+
+/* Number of pipeline stages, counting every sub-stage */
+int
+pipeline_depth(const APEX_CPU* cpu)
+{
+  int depth = NUM_STAGES;
+  for (int s = 0; s < NUM_STAGES; ++s) {
+    depth += cpu->stage_extra[s];
+  }
+  return depth;
+}
+
+/* Returns 1 if latch holds an instruction rather than a bubble */
+static int
+latch_live(const CPU_Stage* latch)
+{
+  return latch->opcode[0] && !latch->busy && !latch->stalled && !latch->nop;
+}
+
+/*
+ * Runs the stages of one cycle from the last to the first. Once a stage
+ * holds its instruction the stages before it keep their latches and are
+ * only traced. Sub-stages without a live instruction trace as EMPTY.
+ */
+void
+pipeline_step(APEX_CPU* cpu)
+{
+  int held = 0;
+
+  for (int s = NUM_STAGES - 1; s >= 0; --s) {
+    const APEX_StageInfo* info = &pipeline_stages[s];
+
+    if (cpu->trace) {
+      for (int k = cpu->stage_extra[s] - 1; k >= 0; --k) {
+        if (latch_live(&cpu->transit[s][k])) {
+          trace_stage(cpu->trace, info->sub_names[k], &cpu->transit[s][k]);
+        } else {
+          trace_empty(cpu->trace, info->sub_names[k]);
+        }
+      }
+    }
+    if (!held) {
+      long start = cpu->host_profile ? hostprof_stage_start(cpu) : 0;
+      held = info->run(cpu);
+      if (cpu->host_profile) {
+        hostprof_stage(cpu, s, start);
+      }
+    } else if (cpu->trace) {
+      trace_stage(cpu->trace, info->name, &cpu->stage[s]);
+    }
+  }
+}
+
+/*
+ * Hands latch from stage to the next one. Through a split stage the
+ * latch enters the first sub-stage and the last sub-stage moves on.
+ */
+void
+pipeline_pass(APEX_CPU* cpu, int stage, const CPU_Stage* latch)
+{
+  int n = cpu->stage_extra[stage];
+  CPU_Stage* line = cpu->transit[stage];
+
+  if (!n) {
+    cpu->stage[stage + 1] = *latch;
+    return;
+  }
+  cpu->stage[stage + 1] = line[n - 1];
+  memmove(&line[1], &line[0], sizeof(*line) * (n - 1));
+  line[0] = *latch;
+}
+
+/* Gives back the destination register of a squashed decoded instruction */
+void
+pipeline_release(APEX_CPU* cpu, const CPU_Stage* latch)
+{
+  const char* op = latch->opcode;
+
+  if (strcmp(op, "ADD") == 0 || strcmp(op, "SUB") == 0 ||
+      strcmp(op, "MUL") == 0 || strcmp(op, "AND") == 0 ||
+      strcmp(op, "OR") == 0 || strcmp(op, "XOR") == 0 ||
+      strcmp(op, "MOVC") == 0 || strcmp(op, "LOAD") == 0) {
+    cpu->regs_valid[latch->rd]++;
+  }
+  if (latch->fused.kind == FUSE_MOVC_ALU) {
+    cpu->regs_valid[latch->fused.rd]++;
+  }
+  if (vector_writes_vreg(op)) {
+    cpu->vregs_valid[latch->rd]++;
+  }
+}
+
+/*
+ * Called when a taken branch or a mispredicted LOAD in the memory stage
+ * squashes the younger instructions. Empties the sub-stages from fetch up
+ * to memory and gives back the destination registers of the decoded
+ * instructions there.
+ */
+void
+pipeline_squash(APEX_CPU* cpu)
+{
+  if (cpu->vpred) {
+    vpred_squash(cpu);
+  }
+  if (!cpu->stage_extra[F] && !cpu->stage_extra[DRF] &&
+      !cpu->stage_extra[EX]) {
+    return;
+  }
+
+  for (int s = F; s < MEM; ++s) {
+    for (int k = 0; k < cpu->stage_extra[s]; ++k) {
+      CPU_Stage* latch = &cpu->transit[s][k];
+      /* Stall bubbles, the copy MUL hands on in its first cycle and
+       * predicted LOADs hold no register
+       */
+      if (s > F && !latch->stalled && !latch->nop && !latch->predicted) {
+        pipeline_release(cpu, latch);
+      }
+      strcpy(latch->opcode, "");
+      latch->pc = 0;
+      latch->arithmetic_instr = 0;
+    }
+  }
+
+  /* Fetch may be stalled on a squashed instruction, and a younger HALT
+   * may already have executed
+   */
+  cpu->stage[F].stalled = 0;
+  cpu->stage[EX].flush = 0;
+}
+
+/*
+ * Returns 1 if an ADD, SUB or MUL is in a sub-stage between decode and
+ * writeback, so the zero flag a BZ/BNZ would read is not final
+ */
+int
+pipeline_flag_pending(const APEX_CPU* cpu)
+{
+  for (int s = DRF; s < WB; ++s) {
+    for (int k = 0; k < cpu->stage_extra[s]; ++k) {
+      if (cpu->transit[s][k].arithmetic_instr == 1) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
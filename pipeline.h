@@ -0,0 +1,50 @@
+#ifndef _APEX_PIPELINE_H_
+#define _APEX_PIPELINE_H_
+/**
+ *  pipeline.h
+ *  Stage descriptors and stage splitting.
+ *
+ *  Every stage is described by an entry of a table that names it and
+ *  points to its function, and a cycle runs the table from the last stage
+ *  to the first. A stage can be configured to take several cycles: its
+ *  function still does its work in the first one, and the latch it hands
+ *  on then moves through one sub-stage latch per extra cycle before it
+ *  reaches the next stage. Valid bits, the zero flag check of BZ/BNZ and
+ *  the squash behind a taken branch cover the sub-stages, so hazards and
+ *  flush distances follow the configured depth.
+ */
+#include "cpu.h"
+
+/* Description of one pipeline stage */
+typedef struct APEX_StageInfo
+{
+  const char* option;	// Name used by pipeline_configure
+  const char* name;	// Name in the trace
+  const char* sub_names[PIPELINE_MAX_EXTRA];	// Trace names of sub-stages
+  int (*run)(APEX_CPU* cpu);	// Returns 1 to hold the stages before it
+} APEX_StageInfo;
+
+extern const APEX_StageInfo pipeline_stages[NUM_STAGES];
+
+int
+pipeline_configure(APEX_CPU* cpu, const char* spec);
+
+int
+pipeline_depth(const APEX_CPU* cpu);
+
+void
+pipeline_step(APEX_CPU* cpu);
+
+void
+pipeline_pass(APEX_CPU* cpu, int stage, const CPU_Stage* latch);
+
+void
+pipeline_release(APEX_CPU* cpu, const CPU_Stage* latch);
+
+void
+pipeline_squash(APEX_CPU* cpu);
+
+int
+pipeline_flag_pending(const APEX_CPU* cpu);
+
+#endif
@@ -0,0 +1,228 @@
+/*
+ *  profile.c
+ *  Contains the per-instruction cycle attribution profiler
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analyze.h"
+#include "profile.h"
+
+/* Instructions ranked in the report */
+#define PROFILE_HOT 5
+
+static const char* kind_name[PROFILE_KINDS] = { "useful", "RAW stall",
+                                                "MUL busy", "flush",
+                                                "memory" };
+
+/* Frame names in the folded output */
+static const char* kind_frame[PROFILE_KINDS] = { "useful", "raw_stall",
+                                                 "mul_busy", "flush",
+                                                 "memory" };
+
+struct APEX_Profile
+{
+  int size;	// Instructions in code memory
+  int* cycles;	// PROFILE_KINDS counters per instruction
+  int total;
+  int unattributed;	// Cycles with no instruction in writeback
+  int redirect;	// Last taken branch or LOOP retired, -1 if none
+  int halted;	// HALT retired, only queued accesses are left
+};
+
+APEX_Profile*
+profile_create(APEX_CPU* cpu)
+{
+  APEX_Profile* profile = calloc(1, sizeof(*profile));
+  if (!profile) {
+    return NULL;
+  }
+  profile->size = cpu->code_memory_size;
+  profile->cycles =
+    calloc(profile->size ? profile->size : 1,
+           sizeof(*profile->cycles) * PROFILE_KINDS);
+  if (!profile->cycles) {
+    free(profile);
+    return NULL;
+  }
+  profile->redirect = -1;
+  cpu->profile = profile;
+  return profile;
+}
+
+void
+profile_destroy(APEX_Profile* profile)
+{
+  free(profile->cycles);
+  free(profile);
+}
+
+/* Returns 1 if the instruction sent fetch elsewhere and emptied the
+ * latches behind it
+ */
+static int
+redirects(const CPU_Stage* stage)
+{
+  const char* op = stage->opcode;
+
+  if (strcmp(op, "LOOP") == 0) {
+    return 1;
+  }
+  return (strcmp(op, "BZ") == 0 || strcmp(op, "BNZ") == 0 ||
+          is_compare_branch(op) || stage->fused.kind == FUSE_ALU_BRANCH) &&
+         stage->mem_address != 0;
+}
+
+/*
+ * Charges the cycle about to run to the instruction in the writeback
+ * latch, or to the one that caused the bubble there
+ */
+void
+profile_cycle(APEX_CPU* cpu)
+{
+  APEX_Profile* profile = cpu->profile;
+  const CPU_Stage* stage = &cpu->stage[WB];
+  int index = get_code_index(stage->pc);
+  int kind = PROFILE_USEFUL;
+
+  profile->total++;
+  if (stage->busy || profile->halted) {
+    index = -1;
+  } else if (stage->pc == 0 || stage->opcode[0] == '\0') {
+    kind = PROFILE_FLUSH;
+    index = profile->redirect;
+  } else if (stage->stalled) {
+    kind = PROFILE_RAW;
+  } else if (stage->nop) {
+    kind = strcmp(stage->opcode, "MUL") == 0 ? PROFILE_MUL : PROFILE_MEMORY;
+  } else {
+    if (redirects(stage)) {
+      profile->redirect = index;
+    }
+    profile->halted = strncmp(stage->opcode, "HALT", 4) == 0;
+  }
+
+  if (index < 0 || index >= profile->size) {
+    profile->unattributed++;
+    return;
+  }
+  profile->cycles[index * PROFILE_KINDS + kind]++;
+}
+
+static int
+instruction_cycles(const APEX_Profile* profile, int index)
+{
+  int sum = 0;
+  for (int k = 0; k < PROFILE_KINDS; ++k) {
+    sum += profile->cycles[index * PROFILE_KINDS + k];
+  }
+  return sum;
+}
+
+/*
+ * Prints the cycle split of the run, then the program with the cycles
+ * charged to each instruction and a rank for the hottest ones
+ */
+void
+profile_print(APEX_CPU* cpu)
+{
+  APEX_Profile* profile = cpu->profile;
+  int by_kind[PROFILE_KINDS] = { 0 };
+  int hot[PROFILE_HOT];
+  int num_hot = 0;
+  char text[128];
+
+  for (int i = 0; i < profile->size; ++i) {
+    for (int k = 0; k < PROFILE_KINDS; ++k) {
+      by_kind[k] += profile->cycles[i * PROFILE_KINDS + k];
+    }
+
+    /* Insert into the ranking, hottest first, earlier pc on a tie */
+    int cycles = instruction_cycles(profile, i);
+    int pos = num_hot;
+    while (pos > 0 && instruction_cycles(profile, hot[pos - 1]) < cycles) {
+      pos--;
+    }
+    if (cycles == 0 || pos == PROFILE_HOT) {
+      continue;
+    }
+    if (num_hot < PROFILE_HOT) {
+      num_hot++;
+    }
+    memmove(&hot[pos + 1], &hot[pos], sizeof(*hot) * (num_hot - pos - 1));
+    hot[pos] = i;
+  }
+
+  printf("\n(apex) >> Cycle profile: %d cycles", profile->total);
+  for (int k = 0; k < PROFILE_KINDS; ++k) {
+    printf(", %s=%d", kind_name[k], by_kind[k]);
+  }
+  printf(", no instruction=%d", profile->unattributed);
+
+  printf("\n(apex) >> %-4s %7s %6s %7s %7s %7s %7s %7s  %s", "rank",
+         "cycles", "%", "useful", "raw", "mul", "flush", "memory", "source");
+  for (int i = 0; i < profile->size; ++i) {
+    int cycles = instruction_cycles(profile, i);
+    char rank[8] = "";
+
+    for (int h = 0; h < num_hot; ++h) {
+      if (hot[h] == i) {
+        snprintf(rank, sizeof(rank), "#%d", h + 1);
+      }
+    }
+    format_code(text, sizeof(text), &cpu->code_memory[i]);
+    printf("\n(apex) >> %-4s %7d %5.1f%%", rank, cycles,
+           profile->total ? 100.0 * cycles / profile->total : 0.0);
+    for (int k = 0; k < PROFILE_KINDS; ++k) {
+      printf(" %7d", profile->cycles[i * PROFILE_KINDS + k]);
+    }
+    printf("  pc(%d) %s", 4000 + 4 * i, text);
+  }
+}
+
+/*
+ * Writes the profile as folded stacks, one line per instruction and
+ * kind of cycle with program, basic block, instruction and kind as
+ * frames, as flame graph tools read them. Returns 0 on success.
+ */
+int
+profile_write_folded(APEX_CPU* cpu, const char* filename, const char* program)
+{
+  APEX_Profile* profile = cpu->profile;
+  unsigned char* leader = malloc(profile->size ? profile->size : 1);
+  const char* slash = strrchr(program, '/');
+  char text[128];
+  FILE* fp;
+
+  if (!leader) {
+    return -1;
+  }
+  fp = fopen(filename, "w");
+  if (!fp) {
+    free(leader);
+    return -1;
+  }
+  program = slash ? slash + 1 : program;
+  analyze_leaders(cpu->code_memory, profile->size, leader);
+
+  int block = 0;
+  for (int i = 0; i < profile->size; ++i) {
+    if (leader[i]) {
+      block = i;
+    }
+    format_code(text, sizeof(text), &cpu->code_memory[i]);
+    for (int k = 0; k < PROFILE_KINDS; ++k) {
+      int cycles = profile->cycles[i * PROFILE_KINDS + k];
+      if (cycles) {
+        fprintf(fp, "%s;block pc(%d);pc(%d) %s;%s %d\n", program,
+                4000 + 4 * block, 4000 + 4 * i, text, kind_frame[k], cycles);
+      }
+    }
+  }
+  if (profile->unattributed) {
+    fprintf(fp, "%s;no instruction %d\n", program, profile->unattributed);
+  }
+  free(leader);
+  return fclose(fp) ? -1 : 0;
+}
@@ -0,0 +1,49 @@
+#ifndef _APEX_PROFILE_H_
+#define _APEX_PROFILE_H_
+/**
+ *  profile.h
+ *  Per-instruction cycle attribution.
+ *
+ *  Every cycle is charged to one instruction by looking at what the
+ *  writeback stage holds: an instruction that retires makes the cycle
+ *  useful, and a bubble carries its cause down the pipeline. A stalled
+ *  copy is a RAW stall of the instruction decode held back, the copy MUL
+ *  hands on in its first EX cycle is MUL busy, the empty latches behind a
+ *  taken branch are its flush, and the copy of a memory instruction held
+ *  by the memory stage waits on memory. Cycles without any instruction,
+ *  while the pipeline fills or the load/store queue drains, are charged
+ *  to no instruction.
+ */
+#include "cpu.h"
+
+/* What a cycle was spent on */
+enum
+{
+  PROFILE_USEFUL,
+  PROFILE_RAW,
+  PROFILE_MUL,
+  PROFILE_FLUSH,
+  PROFILE_MEMORY,
+  PROFILE_KINDS
+};
+
+typedef struct APEX_Profile APEX_Profile;
+
+APEX_Profile*
+profile_create(APEX_CPU* cpu);
+
+void
+profile_destroy(APEX_Profile* profile);
+
+void
+profile_print(APEX_CPU* cpu);
+
+int
+profile_write_folded(APEX_CPU* cpu, const char* filename,
+                     const char* program);
+
+/* Hook, called at the start of every cycle while profiling */
+void
+profile_cycle(APEX_CPU* cpu);
+
+#endif
@@ -0,0 +1,309 @@
+/*
+ *  schedule.c
+ *  Contains the list scheduler for basic blocks of code memory
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analyze.h"
+#include "schedule.h"
+#include "vector.h"
+
+/* Longest block that is scheduled; longer blocks are left as they are */
+#define SCHED_MAX_BLOCK 128
+
+/* Loop iterations the model runs to compare two orders of a loop body */
+#define SCHED_LOOP_ITERATIONS 16
+
+/* What one instruction reads and writes */
+typedef struct Access
+{
+  int reads[2];
+  int num_reads;
+  int write;	// -1 if none
+  int load;
+  int store;
+  int sets_flag;
+  int latency;	// Cycles until a reader may decode
+} Access;
+
+static void
+access_of(const APEX_Instruction* ins, Access* acc)
+{
+  const char* op = ins->opcode;
+
+  memset(acc, 0, sizeof(*acc));
+  acc->write = -1;
+  acc->latency = 1;
+
+  if (strcmp(op, "STORE") == 0) {
+    acc->reads[acc->num_reads++] = ins->rs1;
+    acc->reads[acc->num_reads++] = ins->rs2;
+    acc->store = 1;
+  } else if (strcmp(op, "LOAD") == 0) {
+    acc->reads[acc->num_reads++] = ins->rs1;
+    acc->write = ins->rd;
+    acc->load = 1;
+  } else if (strcmp(op, "MOVC") == 0) {
+    acc->write = ins->rd;
+  } else if (strcmp(op, "ADD") == 0 || strcmp(op, "SUB") == 0 ||
+             strcmp(op, "MUL") == 0 || strcmp(op, "AND") == 0 ||
+             strcmp(op, "OR") == 0 || strcmp(op, "XOR") == 0) {
+    acc->reads[acc->num_reads++] = ins->rs1;
+    acc->reads[acc->num_reads++] = ins->rs2;
+    acc->write = ins->rd;
+    acc->sets_flag = strcmp(op, "ADD") == 0 || strcmp(op, "SUB") == 0 ||
+                     strcmp(op, "MUL") == 0;
+  } else if (strcmp(op, "VLOAD") == 0) {
+    acc->reads[acc->num_reads++] = ins->rs1;
+    acc->write = 16 + ins->rd;
+    acc->load = 1;
+  } else if (strcmp(op, "VSTORE") == 0) {
+    acc->reads[acc->num_reads++] = 16 + ins->rs1;
+    acc->reads[acc->num_reads++] = ins->rs2;
+    acc->store = 1;
+  } else if (is_vector_alu(op)) {
+    acc->reads[acc->num_reads++] = 16 + ins->rs1;
+    acc->reads[acc->num_reads++] = 16 + ins->rs2;
+    acc->write = vector_writes_vreg(op) ? 16 + ins->rd : -1;
+  }
+
+  if (acc->write >= 0) {
+    acc->latency = strcmp(op, "MUL") == 0 ? 4 : 3;
+  }
+}
+
+/* Returns 1 if the instruction must stay at the end of its block */
+static int
+ends_block(const APEX_Instruction* ins)
+{
+  return strcmp(ins->opcode, "BZ") == 0 || strcmp(ins->opcode, "BNZ") == 0 ||
+         is_compare_branch(ins->opcode) || strcmp(ins->opcode, "JUMP") == 0 ||
+         strcmp(ins->opcode, "LOOP") == 0 ||
+         strncmp(ins->opcode, "HALT", 4) == 0;
+}
+
+/* Returns 1 if j, later in program order than i, must stay after it */
+static int
+depends(const Access* i, const Access* j)
+{
+  for (int r = 0; r < j->num_reads; ++r) {
+    if (i->write >= 0 && j->reads[r] == i->write) {
+      return 1;	// RAW
+    }
+  }
+  for (int r = 0; r < i->num_reads; ++r) {
+    if (i->reads[r] == j->write && j->write >= 0) {
+      return 1;	// WAR
+    }
+  }
+  if (i->write >= 0 && i->write == j->write) {
+    return 1;	// WAW
+  }
+  return (i->store && (j->load || j->store)) || (i->load && j->store);
+}
+
+/* Model cost of a block order: cycles for a straight block, cycles over
+ * a number of iterations for a loop. Sets *stale to the reads that would
+ * see a stale register.
+ */
+static int
+cost(const APEX_Instruction* code, int n, int kind, int* stale)
+{
+  APEX_Timing timing;
+  int iterations = kind == ANALYZE_STRAIGHT ? 1 : SCHED_LOOP_ITERATIONS;
+
+  if (analyze_timing(code, n, kind, iterations, &timing)) {
+    *stale = 1;
+    return 0;
+  }
+  *stale = timing.stale_reads;
+  return timing.cycles;
+}
+
+/*
+ * Reorders code[first..last] in place. Each step places, among the
+ * instructions whose predecessors are all placed, the one the model can
+ * decode earliest, preferring the longest latency path to the end of the
+ * block. Returns the model cycles saved, 0 if the block was kept.
+ */
+static int
+schedule_block(APEX_Instruction* code, int first, int last)
+{
+  static Access acc[SCHED_MAX_BLOCK];
+  static unsigned char dep[SCHED_MAX_BLOCK][SCHED_MAX_BLOCK];
+  static APEX_Instruction order[SCHED_MAX_BLOCK];
+  int preds[SCHED_MAX_BLOCK] = { 0 };
+  int height[SCHED_MAX_BLOCK] = { 0 };
+  int placed[SCHED_MAX_BLOCK] = { 0 };
+  int n = last - first + 1;
+  int body = ends_block(&code[last]) ? n - 1 : n;
+  int kind = analyze_block_kind(code, first, last);
+  int flag_setter = -1;
+
+  if (n > SCHED_MAX_BLOCK || body < 2) {
+    return 0;
+  }
+
+  for (int i = 0; i < body; ++i) {
+    access_of(&code[first + i], &acc[i]);
+    if (acc[i].sets_flag) {
+      flag_setter = i;
+    }
+  }
+
+  /* Only the last flag setter's value reaches a BZ/BNZ or the next
+   * block, so the others just have to stay before it
+   */
+  for (int j = 0; j < body; ++j) {
+    for (int i = 0; i < j; ++i) {
+      dep[i][j] = depends(&acc[i], &acc[j]) ||
+                  (j == flag_setter && acc[i].sets_flag);
+      preds[j] += dep[i][j];
+    }
+  }
+  for (int i = body - 1; i >= 0; --i) {
+    for (int j = i + 1; j < body; ++j) {
+      if (dep[i][j] && height[j] + acc[i].latency > height[i]) {
+        height[i] = height[j] + acc[i].latency;
+      }
+    }
+  }
+
+  for (int step = 0; step < body; ++step) {
+    int best = -1;
+    int best_decode = 0;
+    int best_stale = 0;
+
+    for (int c = 0; c < body; ++c) {
+      if (placed[c] || preds[c]) {
+        continue;
+      }
+      APEX_Timing timing;
+      order[step] = code[first + c];
+      if (analyze_timing(order, step + 1, ANALYZE_STRAIGHT, 1, &timing)) {
+        return 0;
+      }
+      int stale = timing.stale_reads > 0;
+      if (best < 0 || stale < best_stale ||
+          (stale == best_stale &&
+           (timing.last_decode < best_decode ||
+            (timing.last_decode == best_decode &&
+             height[c] > height[best])))) {
+        best = c;
+        best_decode = timing.last_decode;
+        best_stale = stale;
+      }
+    }
+
+    order[step] = code[first + best];
+    placed[best] = 1;
+    for (int j = best + 1; j < body; ++j) {
+      preds[j] -= dep[best][j];
+    }
+  }
+  if (body < n) {
+    order[body] = code[last];
+  }
+
+  int old_stale;
+  int new_stale;
+  int old_cost = cost(&code[first], n, kind, &old_stale);
+  int new_cost = cost(order, n, kind, &new_stale);
+
+  /* A read behind two writes of its register sees a stale value, so a
+   * block that has one, or would get one, keeps its order
+   */
+  if (old_stale || new_stale || new_cost >= old_cost) {
+    return 0;
+  }
+  memcpy(&code[first], order, sizeof(*order) * n);
+  return old_cost - new_cost;
+}
+
+/* Writes code memory in the input file syntax */
+static int
+write_program(const APEX_CPU* cpu, const char* filename)
+{
+  FILE* fp = fopen(filename, "w");
+  char text[128];
+
+  if (!fp) {
+    return -1;
+  }
+  for (int i = 0; i < cpu->code_memory_size; ++i) {
+    format_code(text, sizeof(text), &cpu->code_memory[i]);
+    fprintf(fp, "%s\n", text);
+  }
+  return fclose(fp) ? -1 : 0;
+}
+
+/*
+ * Schedules every basic block of the cpu's code memory, reports the
+ * blocks that changed and, if filename is not NULL, writes the scheduled
+ * program there. Must run before the cpu starts. Returns 0 on success.
+ *
+ * Blocks keep their first and last instruction addresses, so branch
+ * targets and offsets stay valid. JUMP targets are computed at run time
+ * and could land inside a block, so programs with JUMP are left alone.
+ */
+int
+sched_program(APEX_CPU* cpu, const char* filename)
+{
+  int n = cpu->code_memory_size;
+  unsigned char* leader = malloc(n ? n : 1);
+  int has_jump = 0;
+  int blocks = 0;
+  int saved = 0;
+  int loop_saved = 0;
+
+  if (!leader) {
+    return -1;
+  }
+  for (int i = 0; i < n; ++i) {
+    has_jump |= strcmp(cpu->code_memory[i].opcode, "JUMP") == 0;
+  }
+  analyze_leaders(cpu->code_memory, n, leader);
+
+  for (int first = 0; first < n && !has_jump;) {
+    int last = first;
+    while (last + 1 < n && !leader[last + 1]) {
+      last++;
+    }
+
+    int gain = schedule_block(cpu->code_memory, first, last);
+    if (gain > 0) {
+      int kind = analyze_block_kind(cpu->code_memory, first, last);
+      fprintf(stderr, "APEX_CPU : Scheduled block pc(%d)..pc(%d), ",
+              4000 + 4 * first, 4000 + 4 * last);
+      /* A loop's gain is modelled over SCHED_LOOP_ITERATIONS, not the
+       * iterations the program actually runs, so it is only an estimate
+       */
+      if (kind != ANALYZE_STRAIGHT) {
+        fprintf(stderr, "an estimated %d cycles saved over %d iterations\n",
+                gain, SCHED_LOOP_ITERATIONS);
+        loop_saved += gain;
+      } else {
+        fprintf(stderr, "%d cycles saved\n", gain);
+        saved += gain;
+      }
+      blocks++;
+    }
+    first = last + 1;
+  }
+  free(leader);
+
+  if (has_jump) {
+    fprintf(stderr, "APEX_CPU : Program has JUMP, not scheduled\n");
+  } else {
+    fprintf(stderr, "APEX_CPU : Scheduled %d blocks, %d cycles saved",
+            blocks, saved);
+    if (loop_saved > 0) {
+      fprintf(stderr, " plus an estimated %d in loops over %d iterations",
+              loop_saved, SCHED_LOOP_ITERATIONS);
+    }
+    fprintf(stderr, "\n");
+  }
+  return filename ? write_program(cpu, filename) : 0;
+}
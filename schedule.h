@@ -0,0 +1,19 @@
+#ifndef _APEX_SCHEDULE_H_
+#define _APEX_SCHEDULE_H_
+/**
+ *  schedule.h
+ *  Hazard-aware instruction scheduling of code memory.
+ *
+ *  Without forwarding, decode stalls on every dependent pair that is too
+ *  close together. This pass reorders the instructions of each basic block
+ *  within its dependency DAG (registers, STORE/LOAD order and the zero
+ *  flag read by BZ/BNZ) so that independent work fills those stall cycles,
+ *  using the timing model of the static analyzer to pick each instruction.
+ *  A block is only replaced if the model says it got faster.
+ */
+#include "cpu.h"
+
+int
+sched_program(APEX_CPU* cpu, const char* filename);
+
+#endif
@@ -0,0 +1,510 @@
+/*
+ *  server.c
+ *  Contains the simulation daemon: connections, job queue, worker pool
+ *  and program cache
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "hash.h"
+#include "libapex.h"
+#include "server.h"
+
+/* Fixed fields of a job frame after its length */
+#define JOB_HEADER 3
+
+/* Fixed fields of a result frame after its length, before the state */
+#define RESULT_FIELDS (4 + 16 + 1)
+
+typedef struct Connection
+{
+  int fd;
+  pthread_mutex_t write_lock;	// Results of concurrent jobs go out whole
+  atomic_int refs;	// Reader plus jobs not answered yet
+} Connection;
+
+typedef struct Job
+{
+  Connection* conn;
+  uint32_t id;
+  uint32_t flags;
+  uint32_t max_cycles;
+  char* options;
+  const unsigned char* program;
+  uint32_t program_len;
+  unsigned char* frame;	// Owns options and program
+  struct Job* next;
+} Job;
+
+/* A parsed program, never run, that jobs clone */
+typedef struct CacheEntry
+{
+  uint64_t hash;
+  uint32_t flags;	// SERVER_BINARY of the program
+  unsigned char* program;
+  uint32_t len;
+  APEX_Sim* sim;
+  long used;	// Server tick of the last lookup
+} CacheEntry;
+
+struct APEX_Server
+{
+  int fd;
+  int num_threads;
+
+  pthread_mutex_t queue_lock;
+  pthread_cond_t queue_ready;
+  Job* head;
+  Job* tail;
+  int stopping;	// Set to make the workers exit once the queue is empty
+
+  pthread_mutex_t cache_lock;
+  CacheEntry* cache;
+  int cache_size;
+  int cache_count;
+  long tick;
+};
+
+static uint32_t
+get_le32(const unsigned char* p)
+{
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static void
+put_le32(unsigned char* p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static int
+read_full(int fd, void* buf, size_t len)
+{
+  for (size_t done = 0; done < len;) {
+    ssize_t n = read(fd, (char*)buf + done, len - done);
+    if (n <= 0) {
+      return -1;
+    }
+    done += n;
+  }
+  return 0;
+}
+
+static int
+write_full(int fd, const void* buf, size_t len)
+{
+  for (size_t done = 0; done < len;) {
+    ssize_t n = write(fd, (const char*)buf + done, len - done);
+    if (n <= 0) {
+      return -1;
+    }
+    done += n;
+  }
+  return 0;
+}
+
+static void
+release_connection(Connection* conn)
+{
+  if (atomic_fetch_sub(&conn->refs, 1) == 1) {
+    close(conn->fd);
+    pthread_mutex_destroy(&conn->write_lock);
+    free(conn);
+  }
+}
+
+/*
+ * Sets sim to a copy of the cached parse of a program, parsing it into
+ * the cache first and evicting the least recently used program if needed.
+ * Returns SERVER_COMPLETED on success, SERVER_BAD_PROGRAM if the program
+ * does not parse or SERVER_NO_MEMORY.
+ */
+static uint32_t
+cached_program(APEX_Server* server, const Job* job, APEX_Sim** sim)
+{
+  uint32_t binary = job->flags & SERVER_BINARY;
+  uint64_t hash = hash_bytes(HASH_SEED, job->program, job->program_len);
+
+  pthread_mutex_lock(&server->cache_lock);
+  server->tick++;
+  for (int i = 0; i < server->cache_count; ++i) {
+    CacheEntry* e = &server->cache[i];
+    if (e->hash == hash && e->flags == binary && e->len == job->program_len &&
+        memcmp(e->program, job->program, e->len) == 0) {
+      e->used = server->tick;
+      *sim = apex_clone(e->sim);
+      pthread_mutex_unlock(&server->cache_lock);
+      return *sim ? SERVER_COMPLETED : SERVER_NO_MEMORY;
+    }
+  }
+  pthread_mutex_unlock(&server->cache_lock);
+
+  /* Parse outside the lock; two jobs may both miss and both insert */
+  APEX_Sim* parsed =
+    binary ? apex_create_binary(job->program, job->program_len, 0)
+           : apex_create((const char*)job->program, job->program_len, 0);
+  if (!parsed) {
+    return SERVER_BAD_PROGRAM;
+  }
+  unsigned char* copy = malloc(job->program_len ? job->program_len : 1);
+  *sim = apex_clone(parsed);
+  if (!copy || !*sim) {
+    apex_destroy(parsed);
+    apex_destroy(*sim);
+    free(copy);
+    return SERVER_NO_MEMORY;
+  }
+  memcpy(copy, job->program, job->program_len);
+
+  pthread_mutex_lock(&server->cache_lock);
+  CacheEntry* slot = &server->cache[0];
+  if (server->cache_count < server->cache_size) {
+    slot = &server->cache[server->cache_count++];
+  } else {
+    for (int i = 1; i < server->cache_count; ++i) {
+      if (server->cache[i].used < slot->used) {
+        slot = &server->cache[i];
+      }
+    }
+    apex_destroy(slot->sim);
+    free(slot->program);
+  }
+  slot->hash = hash;
+  slot->flags = binary;
+  slot->program = copy;
+  slot->len = job->program_len;
+  slot->sim = parsed;
+  slot->used = server->tick;
+  pthread_mutex_unlock(&server->cache_lock);
+  return SERVER_COMPLETED;
+}
+
+typedef struct Buffer
+{
+  unsigned char* data;
+  size_t len;
+  size_t cap;
+} Buffer;
+
+/* Sink appending the state dump to a result frame */
+static void
+append(void* ctx, const char* text, size_t len)
+{
+  Buffer* buf = ctx;
+
+  if (buf->len + len > buf->cap) {
+    size_t cap = (buf->len + len) * 2;
+    unsigned char* data = realloc(buf->data, cap);
+    if (!data) {
+      return;
+    }
+    buf->data = data;
+    buf->cap = cap;
+  }
+  memcpy(buf->data + buf->len, text, len);
+  buf->len += len;
+}
+
+/* Runs a job, fills in its result fields after the id and returns its
+ * status
+ */
+static uint32_t
+run_job(APEX_Server* server, const Job* job, unsigned char* fields,
+        Buffer* state)
+{
+  APEX_Sim* sim = NULL;
+  char* save = NULL;
+  uint32_t status = cached_program(server, job, &sim);
+  uint32_t valid = 0;
+
+  if (status != SERVER_COMPLETED) {
+    return status;
+  }
+  for (char* opt = strtok_r(job->options, " ", &save); opt;
+       opt = strtok_r(NULL, " ", &save)) {
+    if (apex_configure(sim, opt)) {
+      apex_destroy(sim);
+      return SERVER_BAD_OPTION;
+    }
+  }
+
+  /* The parse is cached with no limit, the job brings its own; no job
+   * runs past SERVER_MAX_CYCLES
+   */
+  uint32_t limit = job->max_cycles;
+  if (!limit || limit > SERVER_MAX_CYCLES) {
+    limit = SERVER_MAX_CYCLES;
+  }
+  apex_set_cycle_limit(sim, (int)limit);
+  int ran = apex_run(sim);
+  if (ran < 0) {
+    status = SERVER_NO_MEMORY;
+  } else if (ran) {
+    status = SERVER_CYCLE_LIMIT;
+  }
+
+  APEX_Stats stats;
+  apex_stats(sim, &stats);
+  put_le32(fields + 8, stats.cycles);
+  put_le32(fields + 12, stats.retired);
+  for (int r = 0; r < 16; ++r) {
+    int ok;
+    put_le32(fields + 16 + 4 * r, apex_register(sim, r, &ok));
+    valid |= (uint32_t)ok << r;
+  }
+  put_le32(fields + 16 + 4 * 16, valid);
+  if (job->flags & SERVER_STATE) {
+    apex_write_state(sim, append, state);
+  }
+  apex_destroy(sim);
+  return status;
+}
+
+static void
+answer(APEX_Server* server, Job* job)
+{
+  unsigned char fields[4 * (1 + RESULT_FIELDS + 1)] = { 0 };
+  Buffer state = { NULL, 0, 0 };
+  unsigned char* f = fields + 4;	// After the length
+
+  put_le32(f, job->id);
+  put_le32(f + 4, run_job(server, job, f, &state));
+  put_le32(f + 4 * RESULT_FIELDS, state.len);
+  put_le32(fields, 4 * (RESULT_FIELDS + 1) + state.len);
+
+  pthread_mutex_lock(&job->conn->write_lock);
+  if (write_full(job->conn->fd, fields, sizeof(fields)) == 0 && state.len) {
+    write_full(job->conn->fd, state.data, state.len);
+  }
+  pthread_mutex_unlock(&job->conn->write_lock);
+  free(state.data);
+}
+
+static void*
+worker_thread(void* arg)
+{
+  APEX_Server* server = arg;
+
+  while (1) {
+    pthread_mutex_lock(&server->queue_lock);
+    while (!server->head && !server->stopping) {
+      pthread_cond_wait(&server->queue_ready, &server->queue_lock);
+    }
+    if (!server->head) {
+      pthread_mutex_unlock(&server->queue_lock);
+      return NULL;
+    }
+    Job* job = server->head;
+    server->head = job->next;
+    if (!server->head) {
+      server->tail = NULL;
+    }
+    pthread_mutex_unlock(&server->queue_lock);
+
+    answer(server, job);
+    release_connection(job->conn);
+    free(job->frame);
+    free(job);
+  }
+  return NULL;
+}
+
+/* Splits a job frame of len bytes. Returns 0 if its lengths add up. */
+static int
+parse_job(Job* job, unsigned char* frame, uint32_t len)
+{
+  if (len < 4 * (JOB_HEADER + 2)) {
+    return -1;
+  }
+  job->frame = frame;
+  job->id = get_le32(frame);
+  job->flags = get_le32(frame + 4);
+  job->max_cycles = get_le32(frame + 8);
+
+  uint32_t options_len = get_le32(frame + 12);
+  if (options_len > len - 4 * (JOB_HEADER + 2)) {
+    return -1;
+  }
+  /* The options are made a string in place of their length field */
+  unsigned char* options = frame + 16;
+  unsigned char* rest = options + options_len;
+  job->program_len = get_le32(rest);
+  if (job->program_len != len - 4 * (JOB_HEADER + 2) - options_len) {
+    return -1;
+  }
+  memmove(frame + 12, options, options_len);
+  frame[12 + options_len] = '\0';
+  job->options = (char*)frame + 12;
+  job->program = rest + 4;
+  return 0;
+}
+
+typedef struct Reader
+{
+  APEX_Server* server;
+  Connection* conn;
+} Reader;
+
+/* Reads the jobs of one connection into the queue until it closes */
+static void*
+reader_thread(void* arg)
+{
+  Reader* reader = arg;
+  APEX_Server* server = reader->server;
+  Connection* conn = reader->conn;
+  unsigned char head[4];
+
+  free(reader);
+  while (read_full(conn->fd, head, sizeof(head)) == 0) {
+    uint32_t len = get_le32(head);
+    unsigned char* frame = len <= SERVER_MAX_FRAME ? malloc(len ? len : 1)
+                                                   : NULL;
+    Job* job = calloc(1, sizeof(*job));
+
+    if (!frame || !job || read_full(conn->fd, frame, len) ||
+        parse_job(job, frame, len)) {
+      free(frame);
+      free(job);
+      break;
+    }
+    job->conn = conn;
+    atomic_fetch_add(&conn->refs, 1);
+
+    pthread_mutex_lock(&server->queue_lock);
+    if (server->tail) {
+      server->tail->next = job;
+    } else {
+      server->head = job;
+    }
+    server->tail = job;
+    pthread_cond_signal(&server->queue_ready);
+    pthread_mutex_unlock(&server->queue_lock);
+  }
+
+  /* Results of queued jobs can still be written, but nothing is read */
+  shutdown(conn->fd, SHUT_RD);
+  release_connection(conn);
+  return NULL;
+}
+
+/* Stops and joins the first started of the workers, then frees server */
+static void
+destroy_server(APEX_Server* server, pthread_t* workers, int started)
+{
+  pthread_mutex_lock(&server->queue_lock);
+  server->stopping = 1;
+  pthread_cond_broadcast(&server->queue_ready);
+  pthread_mutex_unlock(&server->queue_lock);
+  for (int i = 0; i < started; ++i) {
+    pthread_join(workers[i], NULL);
+  }
+
+  if (server->fd >= 0) {
+    close(server->fd);
+  }
+  pthread_mutex_destroy(&server->queue_lock);
+  pthread_cond_destroy(&server->queue_ready);
+  pthread_mutex_destroy(&server->cache_lock);
+  free(server->cache);
+  free(server);
+}
+
+/*
+ * Binds the socket at path, replacing a stale one, and starts the worker
+ * threads. Returns NULL on failure.
+ */
+APEX_Server*
+server_create(const char* path, int threads, int cache_entries)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  APEX_Server* server = calloc(1, sizeof(*server));
+
+  if (!server || strlen(path) >= sizeof(addr.sun_path) || threads < 1 ||
+      cache_entries < 1) {
+    free(server);
+    return NULL;
+  }
+  server->cache_size = cache_entries;
+  server->cache = calloc(cache_entries, sizeof(*server->cache));
+  server->num_threads = threads;
+  pthread_mutex_init(&server->queue_lock, NULL);
+  pthread_cond_init(&server->queue_ready, NULL);
+  pthread_mutex_init(&server->cache_lock, NULL);
+
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  server->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (!server->cache || server->fd < 0 ||
+      bind(server->fd, (struct sockaddr*)&addr, sizeof(addr))) {
+    destroy_server(server, NULL, 0);
+    return NULL;
+  }
+  if (listen(server->fd, 64)) {
+    destroy_server(server, NULL, 0);
+    unlink(path);
+    return NULL;
+  }
+
+  /* Workers are joined if not all of them start */
+  pthread_t* workers = malloc(threads * sizeof(*workers));
+  int started = 0;
+  while (workers && started < threads &&
+         pthread_create(&workers[started], NULL, worker_thread, server) == 0) {
+    started++;
+  }
+  if (started < threads) {
+    destroy_server(server, workers, started);
+    free(workers);
+    unlink(path);
+    return NULL;
+  }
+  for (int i = 0; i < threads; ++i) {
+    pthread_detach(workers[i]);
+  }
+  free(workers);
+  return server;
+}
+
+/* Accepts connections until accept fails. Returns -1 then. */
+int
+server_run(APEX_Server* server)
+{
+  while (1) {
+    int fd = accept(server->fd, NULL, NULL);
+    if (fd < 0) {
+      return -1;
+    }
+
+    Connection* conn = calloc(1, sizeof(*conn));
+    Reader* reader = malloc(sizeof(*reader));
+    pthread_t thread;
+    if (!conn || !reader) {
+      free(conn);
+      free(reader);
+      close(fd);
+      continue;
+    }
+    conn->fd = fd;
+    pthread_mutex_init(&conn->write_lock, NULL);
+    atomic_init(&conn->refs, 1);
+    reader->server = server;
+    reader->conn = conn;
+    if (pthread_create(&thread, NULL, reader_thread, reader)) {
+      free(reader);
+      release_connection(conn);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef _APEX_SERVER_H_
+#define _APEX_SERVER_H_
+/**
+ *  server.h
+ *  Simulation daemon on a Unix domain socket, run by apexd.
+ *
+ *  Clients send jobs as frames and get one result frame per job; a
+ *  connection can have many jobs in flight, and their results come back
+ *  as they finish, tagged with the id of the job. Jobs run on a fixed
+ *  pool of threads. Parsed programs are kept in an LRU cache keyed by
+ *  their bytes, so a job for a cached program starts from a copy of it.
+ *
+ *  All fields are 32-bit little-endian. A job frame is
+ *
+ *    length      bytes that follow
+ *    id          returned with the result
+ *    flags       SERVER_BINARY, SERVER_STATE
+ *    max_cycles  0 for SERVER_MAX_CYCLES, which also caps larger limits
+ *    options_len options: space separated apex_configure options
+ *    program_len program: input file text, or binary records with
+ *                SERVER_BINARY (see libapex.h); one with an unknown
+ *                opcode or register is SERVER_BAD_PROGRAM
+ *
+ *  and a result frame is
+ *
+ *    length      bytes that follow
+ *    id
+ *    status      SERVER_* status
+ *    cycles
+ *    retired
+ *    regs        16 registers
+ *    valid       bit n set if register n is valid
+ *    state_len   state: the register and memory dump, with SERVER_STATE
+ */
+
+/* Job flags */
+#define SERVER_BINARY 0x1
+#define SERVER_STATE 0x2
+
+/* Largest frame accepted */
+#define SERVER_MAX_FRAME (16 << 20)
+
+/* Cycle limit of jobs that ask for none or for more */
+#define SERVER_MAX_CYCLES 10000000
+
+#define SERVER_DEFAULT_CACHE 64
+
+/* Result status */
+enum
+{
+  SERVER_COMPLETED,
+  SERVER_CYCLE_LIMIT,
+  SERVER_BAD_PROGRAM,
+  SERVER_BAD_OPTION,
+  SERVER_NO_MEMORY
+};
+
+typedef struct APEX_Server APEX_Server;
+
+APEX_Server*
+server_create(const char* path, int threads, int cache_entries);
+
+int
+server_run(APEX_Server* server);
+
+#endif
@@ -0,0 +1,288 @@
+/*
+ *  stackdist.c
+ *  Contains the LRU stack distance analysis and miss ratio curves
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stackdist.h"
+
+/* Set-associative columns of the report, besides fully associative */
+static const int report_ways[] = { 1, 2, 4, 8 };
+#define REPORT_WAYS (int)(sizeof(report_ways) / sizeof(*report_ways))
+
+/* Access times of one cache set. The tree is 1 at the time of the last
+ * access to each line, so the lines touched after time t are the sum
+ * over (t, now].
+ */
+typedef struct Recency
+{
+  int size;	// Times before the set is compacted
+  int now;	// Time of the latest access, 0 before the first
+  int* tree;	// Binary indexed tree, 1-based
+  int* line;	// Line last accessed at each time, -1 if accessed again since
+} Recency;
+
+/* The sets of a cache with 1 << level sets */
+typedef struct Level
+{
+  Recency* sets;
+  int* last;	// Time of the last access to each line in its set, 0 if none
+  long* distance;	// Accesses by stack distance within the set
+} Level;
+
+struct APEX_StackDistance
+{
+  int line_size;	// Addresses per line
+  int lines;	// Lines in data memory
+  int levels;	// Set counts 1, 2, ... lines
+  Level* level;
+  long accesses;
+  long cold;	// First accesses to a line
+};
+
+static void
+tree_add(Recency* r, int t, int delta)
+{
+  for (; t <= r->size; t += t & -t) {
+    r->tree[t] += delta;
+  }
+}
+
+static int
+tree_sum(const Recency* r, int t)
+{
+  int sum = 0;
+  for (; t > 0; t -= t & -t) {
+    sum += r->tree[t];
+  }
+  return sum;
+}
+
+/*
+ * Renumbers the live times of a set 1..m, keeping their order, and
+ * rebuilds the tree. A set holds at most half as many lines as it has
+ * times, so this runs at most once every size / 2 accesses.
+ */
+static void
+compact(Recency* r, int* last)
+{
+  int m = 0;
+
+  for (int t = 1; t <= r->size; ++t) {
+    if (r->line[t] >= 0) {
+      r->line[++m] = r->line[t];
+      last[r->line[m]] = m;
+    }
+  }
+  for (int t = 1; t <= r->size; ++t) {
+    if (t > m) {
+      r->line[t] = -1;
+    }
+    r->tree[t] = t <= m;
+  }
+  for (int t = 1; t <= r->size; ++t) {
+    int parent = t + (t & -t);
+    if (parent <= r->size) {
+      r->tree[parent] += r->tree[t];
+    }
+  }
+  r->now = m;
+}
+
+/*
+ * Enables the analysis on cpu with lines of line_size addresses, a power
+ * of two no larger than data memory. Returns NULL for any other size.
+ */
+APEX_StackDistance*
+stackdist_create(APEX_CPU* cpu, int line_size)
+{
+  if (line_size <= 0 || line_size > DATA_MEMORY_SIZE ||
+      (line_size & (line_size - 1))) {
+    return NULL;
+  }
+
+  APEX_StackDistance* sd = calloc(1, sizeof(*sd));
+  if (!sd) {
+    return NULL;
+  }
+  sd->line_size = line_size;
+  sd->lines = DATA_MEMORY_SIZE / line_size;
+  while ((1 << sd->levels) <= sd->lines) {
+    sd->levels++;
+  }
+  sd->level = calloc(sd->levels, sizeof(*sd->level));
+  if (!sd->level) {
+    free(sd);
+    return NULL;
+  }
+
+  for (int k = 0; k < sd->levels; ++k) {
+    Level* level = &sd->level[k];
+    int sets = 1 << k;
+    int size = 2 * (sd->lines / sets);
+
+    level->sets = calloc(sets, sizeof(*level->sets));
+    level->last = calloc(sd->lines, sizeof(*level->last));
+    level->distance = calloc(sd->lines / sets, sizeof(*level->distance));
+    if (!level->sets || !level->last || !level->distance) {
+      stackdist_destroy(sd);
+      return NULL;
+    }
+    for (int s = 0; s < sets; ++s) {
+      Recency* r = &level->sets[s];
+      r->size = size;
+      r->tree = calloc(size + 1, sizeof(*r->tree));
+      r->line = malloc((size + 1) * sizeof(*r->line));
+      if (!r->tree || !r->line) {
+        stackdist_destroy(sd);
+        return NULL;
+      }
+      memset(r->line, -1, (size + 1) * sizeof(*r->line));
+    }
+  }
+  cpu->stack_distance = sd;
+  return sd;
+}
+
+void
+stackdist_destroy(APEX_StackDistance* sd)
+{
+  for (int k = 0; k < sd->levels; ++k) {
+    Level* level = &sd->level[k];
+    if (level->sets) {
+      for (int s = 0; s < (1 << k); ++s) {
+        free(level->sets[s].tree);
+        free(level->sets[s].line);
+      }
+    }
+    free(level->sets);
+    free(level->last);
+    free(level->distance);
+  }
+  free(sd->level);
+  free(sd);
+}
+
+static void
+access_line(APEX_StackDistance* sd, int line)
+{
+  sd->accesses++;
+  for (int k = 0; k < sd->levels; ++k) {
+    Level* level = &sd->level[k];
+    Recency* r = &level->sets[line & ((1 << k) - 1)];
+    int t = level->last[line];
+
+    if (t) {
+      level->distance[tree_sum(r, r->now) - tree_sum(r, t)]++;
+      tree_add(r, t, -1);
+      r->line[t] = -1;
+    } else if (k == 0) {
+      sd->cold++;
+    }
+    if (r->now == r->size) {
+      compact(r, level->last);
+    }
+    r->now++;
+    tree_add(r, r->now, 1);
+    r->line[r->now] = line;
+    level->last[line] = r->now;
+  }
+}
+
+static void
+access_address(APEX_StackDistance* sd, int address)
+{
+  /* Data memory drops accesses outside it, and so does the cache */
+  if (address >= 0 && address < DATA_MEMORY_SIZE) {
+    access_line(sd, address / sd->line_size);
+  }
+}
+
+void
+stackdist_memory(APEX_CPU* cpu, const CPU_Stage* stage)
+{
+  APEX_StackDistance* sd = cpu->stack_distance;
+
+  if (strcmp(stage->opcode, "LOAD") == 0 ||
+      strcmp(stage->opcode, "STORE") == 0) {
+    access_address(sd, stage->mem_address);
+  } else if (strcmp(stage->opcode, "VLOAD") == 0 ||
+             strcmp(stage->opcode, "VSTORE") == 0) {
+    for (int i = 0; i < VECTOR_LANES; ++i) {
+      access_address(sd, stage->mem_address + 4 * i);
+    }
+  }
+}
+
+/* Misses of an LRU cache of 1 << level sets and the given ways */
+static long
+misses(const APEX_StackDistance* sd, int level, int ways)
+{
+  const Level* l = &sd->level[level];
+  long hits = 0;
+
+  for (int d = 0; d < ways && d < sd->lines >> level; ++d) {
+    hits += l->distance[d];
+  }
+  return sd->accesses - hits;
+}
+
+static double
+ratio(const APEX_StackDistance* sd, long n)
+{
+  return sd->accesses ? 100.0 * n / sd->accesses : 0.0;
+}
+
+/*
+ * Prints the miss ratio of every power of two capacity, direct mapped,
+ * set-associative and fully associative, up to the first capacity where
+ * only the cold misses are left
+ */
+void
+stackdist_print(APEX_CPU* cpu)
+{
+  APEX_StackDistance* sd = cpu->stack_distance;
+
+  printf("\n(apex) >> Stack distance: accesses=%ld, line=%d addresses, "
+         "distinct lines=%ld (cold miss ratio %.1f%%)",
+         sd->accesses, sd->line_size, sd->cold, ratio(sd, sd->cold));
+  printf("\n(apex) >> %6s %9s", "lines", "addresses");
+  for (int w = 0; w < REPORT_WAYS; ++w) {
+    char name[16] = "direct";
+    if (report_ways[w] > 1) {
+      snprintf(name, sizeof(name), "%d-way", report_ways[w]);
+    }
+    printf(" %7s", name);
+  }
+  printf(" %7s", "full");
+
+  for (int k = 0; k < sd->levels; ++k) {
+    int capacity = 1 << k;
+    long full = misses(sd, 0, capacity);
+    int cold_only = full == sd->cold;
+
+    printf("\n(apex) >> %6d %9d", capacity, capacity * sd->line_size);
+    for (int w = 0; w < REPORT_WAYS; ++w) {
+      int ways = report_ways[w];
+      if (ways > capacity) {
+        printf(" %7s", "-");
+        continue;
+      }
+
+      /* log2 of the set count */
+      int level = 0;
+      while ((ways << level) < capacity) {
+        level++;
+      }
+      long n = misses(sd, level, ways);
+      cold_only = cold_only && n == sd->cold;
+      printf(" %6.1f%%", ratio(sd, n));
+    }
+    printf(" %6.1f%%", ratio(sd, full));
+    if (cold_only) {
+      break;
+    }
+  }
+}
@@ -0,0 +1,38 @@
+#ifndef _APEX_STACKDIST_H_
+#define _APEX_STACKDIST_H_
+/**
+ *  stackdist.h
+ *  LRU stack distance analysis of the data address stream.
+ *
+ *  Every address the memory stage accesses is mapped to a cache line,
+ *  and the number of distinct lines touched since the last access to the
+ *  same line is counted, once for the whole memory and once for every
+ *  set of every power of two number of sets. An LRU cache of A ways
+ *  hits an access exactly when that count, within the set the cache
+ *  would map the line to, is below A; so a single run gives the miss
+ *  ratio of every capacity and associativity. The counts come from a
+ *  binary indexed tree over access times that marks the last access of
+ *  each line, which takes O(log n) per access and level.
+ */
+#include "cpu.h"
+
+#define STACKDIST_DEFAULT_LINE 16
+
+typedef struct APEX_StackDistance APEX_StackDistance;
+
+APEX_StackDistance*
+stackdist_create(APEX_CPU* cpu, int line_size);
+
+void
+stackdist_destroy(APEX_StackDistance* sd);
+
+void
+stackdist_print(APEX_CPU* cpu);
+
+/* Hook, called for every instruction the memory stage lets through while
+ * the analysis is on
+ */
+void
+stackdist_memory(APEX_CPU* cpu, const CPU_Stage* stage);
+
+#endif
@@ -0,0 +1,447 @@
+/*
+ *  steady.c
+ *  Contains the steady-state loop detection and extrapolation
+ */
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dmem.h"
+#include "steady.h"
+
+/* Longest loop iteration, in instructions, that is logged */
+#define STEADY_MAX_ENTRIES 256
+
+/* Integer registers, four values per latch and seven counters */
+#define STEADY_DATA (16 + 4 * NUM_STAGES + 7)
+
+/* How an instruction processed by the memory stage is replayed */
+enum
+{
+  KIND_MOVC,
+  KIND_ADD,	// ADD and SUB, which set the zero flag like MUL
+  KIND_MUL,
+  KIND_BITWISE,	// AND, OR, XOR
+  KIND_LOAD,
+  KIND_STORE,
+  KIND_BZ,
+  KIND_BNZ,
+  KIND_BEQ,
+  KIND_BNE,
+  KIND_BLT,
+  KIND_BGE,
+  KIND_OTHER	// Anything else stops extrapolation
+};
+
+/* Values of an entry: rs1_value, rs2_value, buffer, mem_address */
+enum
+{
+  VALUE_RS1,
+  VALUE_RS2,
+  VALUE_BUFFER,
+  VALUE_ADDRESS,
+  NUM_VALUES
+};
+
+typedef struct SteadyEntry
+{
+  int pc;
+  int kind;
+  int taken;
+  int value[NUM_VALUES];
+} SteadyEntry;
+
+/* Instructions processed by the memory stage between two anchors */
+typedef struct SteadyIteration
+{
+  int num_entries;
+  int overflow;
+  SteadyEntry entries[STEADY_MAX_ENTRIES];
+} SteadyIteration;
+
+struct APEX_Steady
+{
+  int anchor;	// pc of the backward branch taken this cycle, 0 if none
+  int branch;	// pc of the loop branch being observed, 0 if none
+  int num_seen;	// Anchors of that branch kept, up to 3
+
+  /* The cpu at the last three anchors and the iterations between them;
+   * iter[num_seen - 1] is the one in progress
+   */
+  APEX_CPU seen[3];
+  SteadyIteration iter[3];
+};
+
+static int
+kind_of(const char* opcode)
+{
+  static const struct
+  {
+    const char* opcode;
+    int kind;
+  } kinds[] = {
+    { "MOVC", KIND_MOVC },   { "ADD", KIND_ADD },     { "SUB", KIND_ADD },
+    { "MUL", KIND_MUL },     { "AND", KIND_BITWISE }, { "OR", KIND_BITWISE },
+    { "XOR", KIND_BITWISE }, { "LOAD", KIND_LOAD },   { "STORE", KIND_STORE },
+    { "BZ", KIND_BZ },       { "BNZ", KIND_BNZ },     { "BEQ", KIND_BEQ },
+    { "BNE", KIND_BNE },     { "BLT", KIND_BLT },     { "BGE", KIND_BGE },
+  };
+
+  for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); ++i) {
+    if (strcmp(opcode, kinds[i].opcode) == 0) {
+      return kinds[i].kind;
+    }
+  }
+  return KIND_OTHER;
+}
+
+static int
+is_branch(int kind)
+{
+  return kind >= KIND_BZ && kind <= KIND_BGE;
+}
+
+/*
+ * Attaches steady-state detection to the cpu
+ */
+APEX_Steady*
+steady_create(APEX_CPU* cpu)
+{
+  APEX_Steady* steady = calloc(1, sizeof(*steady));
+  if (!steady) {
+    return NULL;
+  }
+  cpu->steady = steady;
+  return steady;
+}
+
+/*
+ * Called by the memory stage for every instruction it processes. Logs the
+ * instruction and notes a taken backward branch as an anchor.
+ */
+void
+steady_memory(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  APEX_Steady* steady = cpu->steady;
+  SteadyIteration* iter =
+    &steady->iter[steady->num_seen ? steady->num_seen - 1 : 0];
+
+  if (strcmp(stage->opcode, "") == 0) {
+    return;
+  }
+  if (iter->num_entries == STEADY_MAX_ENTRIES) {
+    iter->overflow = 1;
+    return;
+  }
+
+  SteadyEntry* entry = &iter->entries[iter->num_entries++];
+  entry->pc = stage->pc;
+  entry->kind = kind_of(stage->opcode);
+  entry->taken = is_branch(entry->kind) && stage->mem_address != 0;
+  entry->value[VALUE_RS1] = stage->rs1_value;
+  entry->value[VALUE_RS2] = stage->rs2_value;
+  entry->value[VALUE_BUFFER] = stage->buffer;
+  entry->value[VALUE_ADDRESS] = stage->mem_address;
+
+  if (entry->taken && stage->mem_address <= stage->pc) {
+    steady->anchor = stage->pc;
+  }
+}
+
+/* Collects the integer fields of the cpu that may change by a constant
+ * amount per iteration
+ */
+static void
+data_fields(APEX_CPU* cpu, int** fields)
+{
+  int n = 0;
+
+  for (int i = 0; i < 16; ++i) {
+    fields[n++] = &cpu->regs[i];
+  }
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    fields[n++] = &cpu->stage[i].rs1_value;
+    fields[n++] = &cpu->stage[i].rs2_value;
+    fields[n++] = &cpu->stage[i].buffer;
+    fields[n++] = &cpu->stage[i].mem_address;
+  }
+  fields[n++] = &cpu->clock;
+  fields[n++] = &cpu->retired;
+  fields[n++] = &cpu->vector_completed;
+  fields[n++] = &cpu->loop_iterations;
+  fields[n++] = &cpu->loop_buffer_fetches;
+  fields[n++] = &cpu->fetches;
+  fields[n++] = &cpu->fetch_words;
+}
+
+static int
+same_stage(const CPU_Stage* a, const CPU_Stage* b)
+{
+  return a->pc == b->pc && strcmp(a->opcode, b->opcode) == 0 &&
+         a->rs1 == b->rs1 && a->rs2 == b->rs2 && a->rd == b->rd &&
+         a->imm == b->imm && a->busy == b->busy && a->stalled == b->stalled &&
+         a->mul_flag == b->mul_flag && a->nop == b->nop &&
+         a->temp_pc == b->temp_pc && a->flush == b->flush &&
+         a->arithmetic_instr == b->arithmetic_instr &&
+         a->bubble == b->bubble && a->tid == b->tid &&
+         memcmp(a->vs1_value, b->vs1_value, sizeof(a->vs1_value)) == 0 &&
+         memcmp(a->vs2_value, b->vs2_value, sizeof(a->vs2_value)) == 0 &&
+         memcmp(a->vbuffer, b->vbuffer, sizeof(a->vbuffer)) == 0;
+}
+
+/* Returns 1 if everything but the data fields is the same in a and b */
+static int
+same_control(const APEX_CPU* a, const APEX_CPU* b)
+{
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    if (!same_stage(&a->stage[i], &b->stage[i])) {
+      return 0;
+    }
+  }
+  return a->zero == b->zero && a->pc == b->pc && a->temp_pc == b->temp_pc &&
+         a->ex_halt == b->ex_halt && a->ins_completed == b->ins_completed &&
+         memcmp(a->regs_valid, b->regs_valid, sizeof(a->regs_valid)) == 0 &&
+         memcmp(a->buff_valid, b->buff_valid, sizeof(a->buff_valid)) == 0 &&
+         memcmp(a->vregs, b->vregs, sizeof(a->vregs)) == 0 &&
+         memcmp(a->vregs_valid, b->vregs_valid, sizeof(a->vregs_valid)) == 0 &&
+         a->loop_active == b->loop_active &&
+         a->loop_start == b->loop_start && a->loop_end == b->loop_end &&
+         a->loop_count == b->loop_count &&
+         a->force_branch == b->force_branch && a->code_reach == b->code_reach &&
+         a->fetch_word == b->fetch_word;
+}
+
+/* Value v advanced by n steps of delta, with the wraparound of the
+ * simulated adders
+ */
+static int
+advance(int v, unsigned delta, long n)
+{
+  return (int)((unsigned)v + delta * (unsigned)n);
+}
+
+/* Checks that the two iterations run the same instructions with values
+ * that change by a constant amount, and that every result stays affine
+ * when its operands keep changing that way. Fills in the deltas.
+ */
+static int
+affine_iterations(const SteadyIteration* a, const SteadyIteration* b,
+                  unsigned (*delta)[NUM_VALUES])
+{
+  if (a->overflow || b->overflow || a->num_entries != b->num_entries) {
+    return 0;
+  }
+
+  for (int i = 0; i < a->num_entries; ++i) {
+    const SteadyEntry* x = &a->entries[i];
+    const SteadyEntry* y = &b->entries[i];
+
+    if (x->pc != y->pc || x->kind != y->kind || x->taken != y->taken ||
+        x->kind == KIND_OTHER) {
+      return 0;
+    }
+    for (int k = 0; k < NUM_VALUES; ++k) {
+      delta[i][k] = (unsigned)y->value[k] - (unsigned)x->value[k];
+    }
+    if (x->kind == KIND_BITWISE &&
+        (delta[i][VALUE_RS1] || delta[i][VALUE_RS2])) {
+      return 0;
+    }
+    if (x->kind == KIND_MUL && delta[i][VALUE_RS1] && delta[i][VALUE_RS2]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int
+branch_taken(int kind, int zero, int a, int b)
+{
+  switch (kind) {
+    case KIND_BZ:
+      return zero;
+    case KIND_BNZ:
+      return !zero;
+    case KIND_BEQ:
+      return a == b;
+    case KIND_BNE:
+      return a != b;
+    case KIND_BLT:
+      return a < b;
+    default:
+      return a >= b;
+  }
+}
+
+/*
+ * Replays iteration n after the last observed one on data memory and the
+ * zero flag. Returns 0, with memory left as it was, if a load would read
+ * a value off the pattern or a branch would go the other way.
+ */
+static int
+replay(APEX_CPU* cpu, const SteadyIteration* iter,
+       unsigned (*delta)[NUM_VALUES], long n, int* zero)
+{
+  static int undo[STEADY_MAX_ENTRIES][2];
+  int num_undo = 0;
+  int flag = *zero;
+  int ok = 1;
+
+  for (int i = 0; ok && i < iter->num_entries; ++i) {
+    const SteadyEntry* entry = &iter->entries[i];
+    int value[NUM_VALUES];
+
+    for (int k = 0; k < NUM_VALUES; ++k) {
+      value[k] = advance(entry->value[k], delta[i][k], n);
+    }
+
+    switch (entry->kind) {
+      case KIND_LOAD:
+        ok = dmem_read(cpu, value[VALUE_ADDRESS]) == value[VALUE_BUFFER];
+        break;
+      case KIND_STORE:
+        undo[num_undo][0] = value[VALUE_ADDRESS];
+        undo[num_undo][1] = dmem_read(cpu, value[VALUE_ADDRESS]);
+        num_undo++;
+        dmem_write(cpu, value[VALUE_ADDRESS], value[VALUE_RS1]);
+        break;
+      case KIND_ADD:
+      case KIND_MUL:
+        flag = value[VALUE_BUFFER] == 0;
+        break;
+      case KIND_MOVC:
+      case KIND_BITWISE:
+        break;
+      default:
+        ok = branch_taken(entry->kind, flag, value[VALUE_RS1],
+                          value[VALUE_RS2]) == entry->taken;
+        if (entry->kind == KIND_BZ && entry->taken) {
+          flag = 0;
+        }
+        break;
+    }
+  }
+
+  if (!ok) {
+    while (num_undo--) {
+      dmem_write(cpu, undo[num_undo][0], undo[num_undo][1]);
+    }
+    return 0;
+  }
+  *zero = flag;
+  return 1;
+}
+
+/*
+ * Called at an anchor with the last three anchors of the same branch in
+ * seen[]. Returns the number of iterations skipped.
+ */
+static long
+fast_forward(APEX_Steady* steady, APEX_CPU* cpu)
+{
+  static unsigned delta[STEADY_MAX_ENTRIES][NUM_VALUES];
+  int* fields[3][STEADY_DATA];
+  unsigned step[STEADY_DATA];
+
+  if (!same_control(&steady->seen[0], &steady->seen[1]) ||
+      !same_control(&steady->seen[1], &steady->seen[2]) ||
+      !affine_iterations(&steady->iter[0], &steady->iter[1], delta)) {
+    return 0;
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    data_fields(&steady->seen[i], fields[i]);
+  }
+  for (int k = 0; k < STEADY_DATA; ++k) {
+    step[k] = (unsigned)*fields[1][k] - (unsigned)*fields[0][k];
+    if ((unsigned)*fields[2][k] - (unsigned)*fields[1][k] != step[k]) {
+      return 0;
+    }
+  }
+
+  /* Stop on the cycle limit exactly, as a simulated run would */
+  int period = cpu->clock - steady->seen[1].clock;
+  long limit = cpu->no_cycles > cpu->clock ? cpu->no_cycles : INT_MAX;
+  long max = period > 0 ? (limit - cpu->clock) / period : 0;
+
+  int zero = cpu->zero;
+  long n = 0;
+  while (n < max &&
+         replay(cpu, &steady->iter[1], delta, n + 1, &zero)) {
+    n++;
+  }
+
+  data_fields(cpu, fields[0]);
+  for (int k = 0; k < STEADY_DATA; ++k) {
+    *fields[0][k] = advance(*fields[0][k], step[k], n);
+  }
+  return n;
+}
+
+/* Starts observing the loop closed by the branch at pc */
+static void
+observe(APEX_Steady* steady, int pc)
+{
+  steady->branch = pc;
+  steady->num_seen = 0;
+}
+
+/* Records the anchor the cpu is at and tries to skip ahead from it */
+static void
+anchor(APEX_Steady* steady, APEX_CPU* cpu)
+{
+  if (steady->anchor != steady->branch) {
+    observe(steady, steady->anchor);
+  }
+  steady->anchor = 0;
+
+  if (steady->num_seen == 3) {
+    steady->seen[0] = steady->seen[1];
+    steady->seen[1] = steady->seen[2];
+    steady->iter[0] = steady->iter[1];
+    steady->iter[1] = steady->iter[2];
+    steady->num_seen = 2;
+  }
+  steady->seen[steady->num_seen++] = *cpu;
+  steady->iter[steady->num_seen - 1].num_entries = 0;
+  steady->iter[steady->num_seen - 1].overflow = 0;
+
+  if (steady->num_seen < 3) {
+    return;
+  }
+
+  int start = cpu->clock;
+  long n = fast_forward(steady, cpu);
+  if (n > 0) {
+    fprintf(stderr,
+            "APEX_CPU : Loop at pc(%d) steady after cycle %d, skipped %ld "
+            "iterations of %d cycles\n",
+            steady->branch, start, n, start - steady->seen[1].clock);
+    observe(steady, 0);
+  }
+}
+
+/*
+ * Runs the cpu to completion, fast-forwarding loops that reach a steady
+ * state. The end state is the same as a cycle by cycle run.
+ */
+int
+steady_simulate(APEX_CPU* cpu)
+{
+  APEX_Steady* steady = cpu->steady;
+
+  while (!APEX_cpu_done(cpu)) {
+    APEX_cpu_cycle(cpu);
+    if (steady->anchor) {
+      anchor(steady, cpu);
+    }
+  }
+  return 0;
+}
+
+void
+steady_destroy(APEX_Steady* steady)
+{
+  free(steady);
+}
@@ -0,0 +1,31 @@
+#ifndef _APEX_STEADY_H_
+#define _APEX_STEADY_H_
+/**
+ *  steady.h
+ *  Fast-forwarding of loops that reach a steady state.
+ *
+ *  Every time a backward branch is taken, the pipeline is compared with
+ *  the previous two times the same branch was taken. When the latches,
+ *  stall flags and valid bits repeat and every register, latch value and
+ *  memory access changes by a constant amount per iteration, the remaining
+ *  iterations are computed instead of simulated, up to the first one that
+ *  would leave the loop or read memory that does not fit the pattern.
+ */
+#include "cpu.h"
+
+typedef struct APEX_Steady APEX_Steady;
+
+APEX_Steady*
+steady_create(APEX_CPU* cpu);
+
+int
+steady_simulate(APEX_CPU* cpu);
+
+void
+steady_destroy(APEX_Steady* steady);
+
+/* Hook, called only while fast-forwarding is enabled */
+void
+steady_memory(APEX_CPU* cpu, CPU_Stage* stage);
+
+#endif
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Runs each program under split stages and compares the final registers
+# and data memory with the 5-stage run. Usage: tests/check.sh [apex_sim]
+sim=${1:-./apex_sim}
+dir=$(dirname "$0")
+status=0
+
+state() {
+  "$sim" "$@" 2>/dev/null | sed -n '/REGISTER/,$p'
+}
+
+for program in "$dir"/mul_shadow.asm; do
+  expected=$(state "$program" simulate 1000)
+  for stages in EX:2 EX:3 EX:4 DRF:2,EX:2 F:2,DRF:2,EX:2; do
+    if [ "$(state "$program" simulate 1000 --stages=$stages)" != "$expected" ]; then
+      echo "FAIL $program --stages=$stages"
+      status=1
+    fi
+  done
+done
+[ $status = 0 ] && echo "check OK"
+exit $status
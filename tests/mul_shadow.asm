@@ -0,0 +1,13 @@
+MOVC,R1,#8
+MOVC,R3,#7
+MOVC,R2,#2
+SUB,R8,R1,R1
+MOVC,R10,#1
+BZ,#12
+MUL,R12,R3,R3
+MOVC,R11,#99
+MOVC,R13,#98
+STORE,R3,R0,#40
+MUL,R12,R3,R2
+STORE,R12,R0,#44
+HALT,
@@ -0,0 +1,380 @@
+/*
+ *  trace.c
+ *  Contains the asynchronous trace writer. Stage functions only copy the
+ *  latch fields they want printed into a ring slot; all formatting and
+ *  I/O happens on the writer thread.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hostprof.h"
+#include "trace.h"
+#include "vector.h"
+
+/* Ring capacity in records, must be a power of two. When the ring is full
+ * the simulation thread yields until the writer frees a slot, so memory
+ * use stays bounded and no trace line is ever dropped.
+ */
+#define TRACE_RING_SIZE (1 << 16)
+
+/* Size of the writer's output buffer */
+#define TRACE_WRITE_BUFFER (1 << 20)
+
+/* Longest line a single record can format to */
+#define TRACE_MAX_LINE 256
+
+/* Writer publishes its progress after this many records */
+#define TRACE_BATCH 256
+
+enum
+{
+  TRACE_CLOCK,
+  TRACE_STAGE,
+  TRACE_EMPTY,
+  TRACE_TEXT
+};
+
+/* One trace line, as captured by the simulation thread */
+typedef struct TraceRecord
+{
+  int kind;
+  int clock;
+  const char* text; // Stage name or literal line, must be a string literal
+  int pc;
+  char opcode[16];
+  char fused[8];	// Opcode fused with this one, "" if none
+  int rd;
+  int rs1;
+  int rs2;
+  int imm;
+} TraceRecord;
+
+struct APEX_Trace
+{
+  TraceRecord ring[TRACE_RING_SIZE];
+
+  /* Producer and consumer indices live on separate cache lines */
+  _Alignas(64) atomic_ulong head;
+  unsigned long cached_tail;
+  _Alignas(64) atomic_ulong tail;
+  atomic_int closing;
+
+  pthread_t writer;
+  FILE* out;	// NULL when writing to sink
+  APEX_Sink sink;
+  void* sink_ctx;
+  char* buf;
+  size_t len;
+
+  /* Host time the simulation thread spends queueing, NULL if not counted */
+  long* host_ns;
+  long slot_start;
+};
+
+static int
+format_instruction(char* dst, const TraceRecord* rec)
+{
+  const char* op = rec->opcode;
+
+  if (strcmp(op, "STORE") == 0) {
+    return sprintf(dst, "%s,R%d,R%d,#%d ", op, rec->rs1, rec->rs2, rec->imm);
+  }
+
+  if (strcmp(op, "LOAD") == 0) {
+    return sprintf(dst, "%s,R%d,R%d,#%d ", op, rec->rd, rec->rs1, rec->imm);
+  }
+
+  if (strcmp(op, "MOVC") == 0) {
+    return sprintf(dst, "%s,R%d,#%d ", op, rec->rd, rec->imm);
+  }
+
+  if (strcmp(op, "ADD") == 0 || strcmp(op, "SUB") == 0 ||
+      strcmp(op, "AND") == 0 || strcmp(op, "OR") == 0 ||
+      strcmp(op, "XOR") == 0 || strcmp(op, "MUL") == 0) {
+    return sprintf(dst, "%s,R%d,R%d,R%d", op, rec->rd, rec->rs1, rec->rs2);
+  }
+
+  if (strcmp(op, "BZ") == 0 || strcmp(op, "BNZ") == 0) {
+    return sprintf(dst, "%s,#%d", op, rec->imm);
+  }
+
+  if (strcmp(op, "VLOAD") == 0) {
+    return sprintf(dst, "%s,V%d,R%d,#%d ", op, rec->rd, rec->rs1, rec->imm);
+  }
+
+  if (strcmp(op, "VSTORE") == 0) {
+    return sprintf(dst, "%s,V%d,R%d,#%d ", op, rec->rs1, rec->rs2, rec->imm);
+  }
+
+  if (is_vector_alu(op)) {
+    return sprintf(dst, "%s,V%d,V%d,V%d", op, rec->rd, rec->rs1, rec->rs2);
+  }
+
+  if (is_compare_branch(op)) {
+    return sprintf(dst, "%s,R%d,R%d,#%d", op, rec->rs1, rec->rs2, rec->imm);
+  }
+
+  if (strcmp(op, "JUMP") == 0 || strcmp(op, "LOOP") == 0) {
+    return sprintf(dst, "%s,R%d,#%d", op, rec->rs1, rec->imm);
+  }
+
+  if (strcmp(op, "HALT") == 0) {
+    return sprintf(dst, "%s", op);
+  }
+
+  if (strcmp(op, "") == 0) {
+    return sprintf(dst, "EMPTY");
+  }
+
+  return 0;
+}
+
+static int
+format_record(char* dst, const TraceRecord* rec)
+{
+  int n = 0;
+
+  switch (rec->kind) {
+    case TRACE_CLOCK:
+      n = sprintf(dst,
+                  "--------------------------------\n"
+                  "Clock Cycle #: %d\n"
+                  "--------------------------------\n",
+                  rec->clock);
+      break;
+
+    case TRACE_STAGE:
+      n = sprintf(dst, "%-15s: pc(%d) ", rec->text, rec->pc);
+      n += format_instruction(dst + n, rec);
+      if (rec->fused[0]) {
+        n -= dst[n - 1] == ' ';
+        n += sprintf(dst + n, " + %s", rec->fused);
+      }
+      dst[n++] = '\n';
+      break;
+
+    case TRACE_EMPTY:
+      n = sprintf(dst, "%-15s: EMPTY\n", rec->text);
+      break;
+
+    case TRACE_TEXT:
+      n = strlen(rec->text);
+      memcpy(dst, rec->text, n);
+      break;
+  }
+  return n;
+}
+
+static void
+flush_buffer(APEX_Trace* trace)
+{
+  if (trace->len) {
+    if (trace->sink) {
+      trace->sink(trace->sink_ctx, trace->buf, trace->len);
+    } else {
+      fwrite(trace->buf, 1, trace->len, trace->out);
+    }
+    trace->len = 0;
+  }
+}
+
+static void*
+trace_writer(void* arg)
+{
+  APEX_Trace* trace = arg;
+  struct timespec idle = { 0, 50000 };
+
+  while (1) {
+    unsigned long tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+    unsigned long head = atomic_load_explicit(&trace->head, memory_order_acquire);
+
+    if (tail == head) {
+      if (atomic_load_explicit(&trace->closing, memory_order_acquire) &&
+          tail == atomic_load_explicit(&trace->head, memory_order_acquire)) {
+        break;
+      }
+      nanosleep(&idle, NULL);
+      continue;
+    }
+
+    int batch = 0;
+    while (tail != head) {
+      if (trace->len + TRACE_MAX_LINE > TRACE_WRITE_BUFFER) {
+        flush_buffer(trace);
+      }
+      trace->len +=
+        format_record(trace->buf + trace->len,
+                      &trace->ring[tail & (TRACE_RING_SIZE - 1)]);
+      tail++;
+
+      if (++batch == TRACE_BATCH) {
+        atomic_store_explicit(&trace->tail, tail, memory_order_release);
+        batch = 0;
+      }
+    }
+    atomic_store_explicit(&trace->tail, tail, memory_order_release);
+  }
+
+  flush_buffer(trace);
+  if (trace->out) {
+    fflush(trace->out);
+  }
+  return NULL;
+}
+
+/*
+ * Returns the next free ring slot, waiting for the writer if the ring is
+ * full. Only the simulation thread calls this.
+ */
+static TraceRecord*
+next_slot(APEX_Trace* trace)
+{
+  unsigned long head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+
+  if (trace->host_ns) {
+    trace->slot_start = hostprof_now();
+  }
+  if (head - trace->cached_tail == TRACE_RING_SIZE) {
+    trace->cached_tail =
+      atomic_load_explicit(&trace->tail, memory_order_acquire);
+    while (head - trace->cached_tail == TRACE_RING_SIZE) {
+      sched_yield();
+      trace->cached_tail =
+        atomic_load_explicit(&trace->tail, memory_order_acquire);
+    }
+  }
+  return &trace->ring[head & (TRACE_RING_SIZE - 1)];
+}
+
+static void
+publish(APEX_Trace* trace)
+{
+  unsigned long head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+  atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+  if (trace->host_ns) {
+    *trace->host_ns += hostprof_now() - trace->slot_start;
+  }
+}
+
+/*
+ * This function creates the trace ring and starts the writer thread.
+ * Everything already buffered on out is flushed first so that trace
+ * lines follow earlier output.
+ */
+static APEX_Trace*
+open_trace(FILE* out, APEX_Sink sink, void* ctx)
+{
+  APEX_Trace* trace = calloc(1, sizeof(*trace));
+  if (!trace) {
+    return NULL;
+  }
+
+  trace->buf = malloc(TRACE_WRITE_BUFFER);
+  if (!trace->buf) {
+    free(trace);
+    return NULL;
+  }
+  trace->out = out;
+  trace->sink = sink;
+  trace->sink_ctx = ctx;
+  if (out) {
+    fflush(out);
+  }
+
+  if (pthread_create(&trace->writer, NULL, trace_writer, trace) != 0) {
+    free(trace->buf);
+    free(trace);
+    return NULL;
+  }
+  return trace;
+}
+
+APEX_Trace*
+trace_open(FILE* out)
+{
+  return open_trace(out, NULL, NULL);
+}
+
+/* Same as trace_open, with the text handed to sink on the writer thread */
+APEX_Trace*
+trace_open_sink(APEX_Sink sink, void* ctx)
+{
+  return open_trace(NULL, sink, ctx);
+}
+
+void
+trace_clock(APEX_Trace* trace, int clock)
+{
+  TraceRecord* rec = next_slot(trace);
+  rec->kind = TRACE_CLOCK;
+  rec->clock = clock;
+  publish(trace);
+}
+
+void
+trace_stage(APEX_Trace* trace, const char* name, const CPU_Stage* stage)
+{
+  TraceRecord* rec = next_slot(trace);
+  rec->kind = TRACE_STAGE;
+  rec->text = name;
+  rec->pc = stage->pc;
+  strncpy(rec->opcode, stage->opcode, sizeof(rec->opcode) - 1);
+  rec->opcode[sizeof(rec->opcode) - 1] = '\0';
+  if (stage->fused.kind) {
+    memcpy(rec->fused, stage->fused.opcode, sizeof(rec->fused));
+  } else {
+    rec->fused[0] = '\0';
+  }
+  rec->rd = stage->rd;
+  rec->rs1 = stage->rs1;
+  rec->rs2 = stage->rs2;
+  rec->imm = stage->imm;
+  publish(trace);
+}
+
+/* Queues a stage that holds no instruction, name must be a string literal */
+void
+trace_empty(APEX_Trace* trace, const char* name)
+{
+  TraceRecord* rec = next_slot(trace);
+  rec->kind = TRACE_EMPTY;
+  rec->text = name;
+  publish(trace);
+}
+
+void
+trace_text(APEX_Trace* trace, const char* text)
+{
+  TraceRecord* rec = next_slot(trace);
+  rec->kind = TRACE_TEXT;
+  rec->text = text;
+  publish(trace);
+}
+
+/* Adds the time spent queueing records from now on to *ns */
+void
+trace_count_time(APEX_Trace* trace, long* ns)
+{
+  trace->host_ns = ns;
+}
+
+/*
+ * This function drains the ring, stops the writer thread and releases
+ * the trace.
+ */
+void
+trace_close(APEX_Trace* trace)
+{
+  if (!trace) {
+    return;
+  }
+  atomic_store_explicit(&trace->closing, 1, memory_order_release);
+  pthread_join(trace->writer, NULL);
+  free(trace->buf);
+  free(trace);
+}
@@ -0,0 +1,39 @@
+#ifndef _APEX_TRACE_H_
+#define _APEX_TRACE_H_
+/**
+ *  trace.h
+ *  Asynchronous pipeline trace. The simulation thread pushes small
+ *  fixed-size records into a single-producer/single-consumer ring and a
+ *  background writer thread formats them into large buffered writes.
+ */
+#include <stdio.h>
+
+#include "cpu.h"
+
+typedef struct APEX_Trace APEX_Trace;
+
+APEX_Trace*
+trace_open(FILE* out);
+
+APEX_Trace*
+trace_open_sink(APEX_Sink sink, void* ctx);
+
+void
+trace_clock(APEX_Trace* trace, int clock);
+
+void
+trace_stage(APEX_Trace* trace, const char* name, const CPU_Stage* stage);
+
+void
+trace_empty(APEX_Trace* trace, const char* name);
+
+void
+trace_text(APEX_Trace* trace, const char* text);
+
+void
+trace_count_time(APEX_Trace* trace, long* ns);
+
+void
+trace_close(APEX_Trace* trace);
+
+#endif
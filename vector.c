@@ -0,0 +1,91 @@
+/*
+ *  vector.c
+ *  Contains the lane operations of the APEX vector instructions, done
+ *  with host SIMD where the compiler targets it
+ */
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "vector.h"
+
+int
+is_vector_alu(const char* opcode)
+{
+  return strcmp(opcode, "VADD") == 0 || strcmp(opcode, "VSUB") == 0 ||
+         strcmp(opcode, "VMUL") == 0 || strcmp(opcode, "VAND") == 0 ||
+         strcmp(opcode, "VOR") == 0 || strcmp(opcode, "VXOR") == 0;
+}
+
+int
+is_vector_opcode(const char* opcode)
+{
+  return strcmp(opcode, "VLOAD") == 0 || strcmp(opcode, "VSTORE") == 0 ||
+         is_vector_alu(opcode);
+}
+
+/* Returns 1 if the instruction writes vector register rd */
+int
+vector_writes_vreg(const char* opcode)
+{
+  return strcmp(opcode, "VLOAD") == 0 || is_vector_alu(opcode);
+}
+
+#if defined(__SSE2__) && VECTOR_LANES == 4
+
+void
+vector_alu(const char* opcode, int* dst, const int* a, const int* b)
+{
+  __m128i x = _mm_loadu_si128((const __m128i*)a);
+  __m128i y = _mm_loadu_si128((const __m128i*)b);
+  __m128i r;
+
+  if (strcmp(opcode, "VADD") == 0) {
+    r = _mm_add_epi32(x, y);
+  } else if (strcmp(opcode, "VSUB") == 0) {
+    r = _mm_sub_epi32(x, y);
+  } else if (strcmp(opcode, "VMUL") == 0) {
+#if defined(__SSE4_1__)
+    r = _mm_mullo_epi32(x, y);
+#else
+    /* SSE2 has only 32x32->64 multiplies of the even lanes */
+    __m128i even = _mm_mul_epu32(x, y);
+    __m128i odd = _mm_mul_epu32(_mm_srli_si128(x, 4), _mm_srli_si128(y, 4));
+    r = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                           _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+  } else if (strcmp(opcode, "VAND") == 0) {
+    r = _mm_and_si128(x, y);
+  } else if (strcmp(opcode, "VOR") == 0) {
+    r = _mm_or_si128(x, y);
+  } else {
+    r = _mm_xor_si128(x, y);
+  }
+  _mm_storeu_si128((__m128i*)dst, r);
+}
+
+#else
+
+void
+vector_alu(const char* opcode, int* dst, const int* a, const int* b)
+{
+  for (int i = 0; i < VECTOR_LANES; ++i) {
+    if (strcmp(opcode, "VADD") == 0) {
+      dst[i] = a[i] + b[i];
+    } else if (strcmp(opcode, "VSUB") == 0) {
+      dst[i] = a[i] - b[i];
+    } else if (strcmp(opcode, "VMUL") == 0) {
+      dst[i] = a[i] * b[i];
+    } else if (strcmp(opcode, "VAND") == 0) {
+      dst[i] = a[i] & b[i];
+    } else if (strcmp(opcode, "VOR") == 0) {
+      dst[i] = a[i] | b[i];
+    } else {
+      dst[i] = a[i] ^ b[i];
+    }
+  }
+}
+
+#endif
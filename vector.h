@@ -0,0 +1,22 @@
+#ifndef _APEX_VECTOR_H_
+#define _APEX_VECTOR_H_
+/**
+ *  vector.h
+ *  Packed SIMD extension: VECTOR_REGS registers of VECTOR_LANES 32-bit
+ *  lanes. Lane i of VLOAD/VSTORE addresses base + imm + 4 * i.
+ */
+#include "cpu.h"
+
+int
+is_vector_opcode(const char* opcode);
+
+int
+is_vector_alu(const char* opcode);
+
+int
+vector_writes_vreg(const char* opcode);
+
+void
+vector_alu(const char* opcode, int* dst, const int* a, const int* b);
+
+#endif
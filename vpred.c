@@ -0,0 +1,264 @@
+/*
+ *  vpred.c
+ *  Contains the load value predictor
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "vpred.h"
+
+/* Confidence a table needs to predict, and the most it can have */
+#define VPRED_CONFIDENT 2
+#define VPRED_MAX_CONFIDENCE 3
+
+typedef struct LastValueEntry
+{
+  int pc;	// LOAD the entry belongs to, 0 if unused
+  int value;
+  int confidence;
+} LastValueEntry;
+
+typedef struct StrideEntry
+{
+  int pc;
+  int value;	// Last value loaded
+  int stride;
+  int confidence;
+  int inflight;	// Decoded, not yet checked in the memory stage
+} StrideEntry;
+
+struct APEX_ValuePredictor
+{
+  int entries;
+  LastValueEntry* last;
+  StrideEntry* stride;
+
+  /* Registers holding a value that has not been checked yet, and the
+   * value they held before
+   */
+  int pending[16];
+  int saved[16];
+
+  /* Same program and pipeline without prediction, run at the end */
+  APEX_CPU* baseline;
+
+  /* Statistics */
+  int loads;
+  int predicted;
+  int correct;
+  int last_predicted;
+  int last_correct;
+  int stride_predicted;
+  int stride_correct;
+  int replays;
+};
+
+/*
+ * Enables value prediction on cpu, with tables of the given number of
+ * entries. Must be called before the first cycle.
+ */
+APEX_ValuePredictor*
+vpred_create(APEX_CPU* cpu, int entries)
+{
+  APEX_ValuePredictor* vp = calloc(1, sizeof(*vp));
+  if (!vp) {
+    return NULL;
+  }
+  vp->entries = entries > 0 ? entries : VPRED_DEFAULT_ENTRIES;
+  vp->last = calloc(vp->entries, sizeof(*vp->last));
+  vp->stride = calloc(vp->entries, sizeof(*vp->stride));
+  vp->baseline = APEX_cpu_clone(cpu);
+  if (!vp->last || !vp->stride || !vp->baseline) {
+    vpred_destroy(vp);
+    return NULL;
+  }
+
+  cpu->vpred = vp;
+  return vp;
+}
+
+void
+vpred_destroy(APEX_ValuePredictor* vp)
+{
+  if (vp->baseline) {
+    APEX_cpu_stop(vp->baseline);
+  }
+  free(vp->last);
+  free(vp->stride);
+  free(vp);
+}
+
+static int
+slot(APEX_ValuePredictor* vp, int pc)
+{
+  return get_code_index(pc) % vp->entries;
+}
+
+/*
+ * Called by decode for a LOAD that has its source. Returns 1 if the
+ * destination register was given a predicted value, in which case it
+ * must stay valid.
+ */
+int
+vpred_decode(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  APEX_ValuePredictor* vp = cpu->vpred;
+  LastValueEntry* last = &vp->last[slot(vp, stage->pc)];
+  StrideEntry* stride = &vp->stride[slot(vp, stage->pc)];
+  int ahead = 0;	// Older instances of this LOAD not trained yet
+
+  if (stride->pc == stage->pc) {
+    ahead = stride->inflight++;
+  }
+
+  /* Only a register with no older write in flight can take a value, and
+   * a loop armed behind the LOAD could not be undone
+   */
+  stage->predicted = VPRED_NONE;
+  if (cpu->regs_valid[stage->rd] != 1 || vp->pending[stage->rd] ||
+      cpu->loop_active) {
+    return 0;
+  }
+
+  if (stride->pc == stage->pc && stride->stride &&
+      stride->confidence >= VPRED_CONFIDENT) {
+    stage->predicted = VPRED_STRIDE;
+    stage->prediction = stride->value + stride->stride * (ahead + 1);
+  } else if (last->pc == stage->pc && last->confidence >= VPRED_CONFIDENT) {
+    stage->predicted = VPRED_LAST_VALUE;
+    stage->prediction = last->value;
+  } else {
+    return 0;
+  }
+
+  vp->pending[stage->rd] = 1;
+  vp->saved[stage->rd] = cpu->regs[stage->rd];
+  cpu->regs[stage->rd] = stage->prediction;
+  return 1;
+}
+
+static void
+train(APEX_ValuePredictor* vp, int pc, int value)
+{
+  LastValueEntry* last = &vp->last[slot(vp, pc)];
+  StrideEntry* stride = &vp->stride[slot(vp, pc)];
+
+  if (last->pc == pc && last->value == value) {
+    if (last->confidence < VPRED_MAX_CONFIDENCE) {
+      last->confidence++;
+    }
+  } else {
+    last->pc = pc;
+    last->confidence = 0;
+  }
+  last->value = value;
+
+  if (stride->pc != pc) {
+    stride->pc = pc;
+    stride->stride = 0;
+    stride->confidence = 0;
+    stride->inflight = 0;
+  } else {
+    if (value - stride->value == stride->stride) {
+      if (stride->confidence < VPRED_MAX_CONFIDENCE) {
+        stride->confidence++;
+      }
+    } else {
+      stride->stride = value - stride->value;
+      stride->confidence = 0;
+    }
+    if (stride->inflight) {
+      stride->inflight--;
+    }
+  }
+  stride->value = value;
+}
+
+/*
+ * Called by the memory stage once a LOAD has its value. Trains the
+ * tables and checks a prediction. Returns 1 if the prediction was wrong;
+ * the register then holds the loaded value and the caller must squash the
+ * instructions behind the LOAD.
+ */
+int
+vpred_memory(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  APEX_ValuePredictor* vp = cpu->vpred;
+  int hit = stage->predicted && stage->prediction == stage->buffer;
+
+  vp->loads++;
+  train(vp, stage->pc, stage->buffer);
+  if (!stage->predicted) {
+    return 0;
+  }
+
+  vp->predicted++;
+  vp->correct += hit;
+  if (stage->predicted == VPRED_STRIDE) {
+    vp->stride_predicted++;
+    vp->stride_correct += hit;
+  } else {
+    vp->last_predicted++;
+    vp->last_correct += hit;
+  }
+  vp->pending[stage->rd] = 0;
+  if (hit) {
+    return 0;
+  }
+
+  cpu->regs[stage->rd] = stage->buffer;
+  vp->replays++;
+  return 1;
+}
+
+/*
+ * Called when the instructions behind the memory stage are squashed.
+ * Every LOAD whose prediction is unchecked is among them, so their
+ * registers get back the values they held and no instance is in flight.
+ */
+void
+vpred_squash(APEX_CPU* cpu)
+{
+  APEX_ValuePredictor* vp = cpu->vpred;
+
+  for (int r = 0; r < 16; ++r) {
+    if (vp->pending[r]) {
+      cpu->regs[r] = vp->saved[r];
+      vp->pending[r] = 0;
+    }
+  }
+  for (int i = 0; i < vp->entries; ++i) {
+    vp->stride[i].inflight = 0;
+  }
+}
+
+static double
+percent(int part, int whole)
+{
+  return whole ? 100.0 * part / whole : 0.0;
+}
+
+/* Prints the statistics, after running the baseline to compare with */
+void
+vpred_print(APEX_CPU* cpu)
+{
+  APEX_ValuePredictor* vp = cpu->vpred;
+  APEX_CPU* base = vp->baseline;
+
+  APEX_cpu_simulate(base);
+  printf("\n(apex) >> Value prediction entries=%d, loads=%d, predicted=%d "
+         "(coverage %.1f%%), correct=%d (accuracy %.1f%%), replays=%d",
+         vp->entries, vp->loads, vp->predicted,
+         percent(vp->predicted, vp->loads), vp->correct,
+         percent(vp->correct, vp->predicted), vp->replays);
+  printf("\n(apex) >> Last-value predictions=%d, correct=%d; stride "
+         "predictions=%d, correct=%d",
+         vp->last_predicted, vp->last_correct, vp->stride_predicted,
+         vp->stride_correct);
+  printf("\n(apex) >> Without value prediction: %d cycles, %d retired",
+         base->clock, base->retired);
+  if (cpu->ins_completed == cpu->code_memory_size &&
+      base->ins_completed == base->code_memory_size) {
+    printf(", net cycles saved=%d", base->clock - cpu->clock);
+  }
+}
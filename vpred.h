@@ -0,0 +1,49 @@
+#ifndef _APEX_VPRED_H_
+#define _APEX_VPRED_H_
+/**
+ *  vpred.h
+ *  Load value prediction.
+ *
+ *  A last-value table and a stride table, both indexed by the pc of a
+ *  LOAD, are trained with every value a LOAD reads in the memory stage.
+ *  When one of them is confident about a LOAD being decoded, the value it
+ *  predicts is written to the destination register, which stays valid,
+ *  so dependents read it instead of stalling until writeback. The memory
+ *  stage checks the prediction; on a mismatch the register gets the
+ *  loaded value and the instructions behind the LOAD are squashed and
+ *  fetched again.
+ */
+#include "cpu.h"
+
+#define VPRED_DEFAULT_ENTRIES 64
+
+/* Table that predicted the value of a LOAD */
+enum
+{
+  VPRED_NONE,
+  VPRED_LAST_VALUE,
+  VPRED_STRIDE
+};
+
+typedef struct APEX_ValuePredictor APEX_ValuePredictor;
+
+APEX_ValuePredictor*
+vpred_create(APEX_CPU* cpu, int entries);
+
+void
+vpred_destroy(APEX_ValuePredictor* vp);
+
+void
+vpred_print(APEX_CPU* cpu);
+
+/* Hooks, called only while the predictor is enabled */
+int
+vpred_decode(APEX_CPU* cpu, CPU_Stage* stage);
+
+int
+vpred_memory(APEX_CPU* cpu, CPU_Stage* stage);
+
+void
+vpred_squash(APEX_CPU* cpu);
+
+#endif
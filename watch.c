@@ -0,0 +1,230 @@
+/*
+ *  watch.c
+ *  Contains the breakpoints and watchpoints of the quiet engine
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dmem.h"
+#include "hostprof.h"
+#include "trace.h"
+#include "watch.h"
+
+struct APEX_Watch
+{
+  int action;
+
+  /* Breakpoints, -1 when unused. Only the earliest clock/retired matter. */
+  int clock;
+  int retired;
+  unsigned char* pcs;	// One flag per code memory entry
+  int pcs_size;
+
+  /* Watchpoints */
+  unsigned regs;	// Bit per integer register
+  unsigned char mem[DATA_MEMORY_SIZE];
+
+  int hit;
+  int stopped;
+  char reason[256];
+};
+
+/* Scalar opcodes that write rd in writeback */
+static int
+writes_register(const char* opcode)
+{
+  return strcmp(opcode, "MOVC") == 0 || strcmp(opcode, "LOAD") == 0 ||
+         strcmp(opcode, "ADD") == 0 || strcmp(opcode, "SUB") == 0 ||
+         strcmp(opcode, "AND") == 0 || strcmp(opcode, "OR") == 0 ||
+         strcmp(opcode, "XOR") == 0 || strcmp(opcode, "MUL") == 0;
+}
+
+/*
+ * Attaches an empty set of breakpoints and watchpoints to the cpu
+ */
+APEX_Watch*
+watch_create(APEX_CPU* cpu, int action)
+{
+  APEX_Watch* watch = calloc(1, sizeof(*watch));
+  if (!watch) {
+    return NULL;
+  }
+
+  watch->pcs = calloc(cpu->code_memory_size ? cpu->code_memory_size : 1, 1);
+  if (!watch->pcs) {
+    free(watch);
+    return NULL;
+  }
+  watch->pcs_size = cpu->code_memory_size;
+  watch->action = action;
+  watch->clock = -1;
+  watch->retired = -1;
+  cpu->watch = watch;
+  return watch;
+}
+
+static int
+earliest(int current, int value)
+{
+  return current < 0 || value < current ? value : current;
+}
+
+/*
+ * Adds one breakpoint or watchpoint. spec is pc:<pc>, clock:<cycle>,
+ * retired:<count>, R<n> or mem:<address>. Returns 0 on success and -1 if
+ * spec is not understood.
+ */
+int
+watch_add(APEX_Watch* watch, const char* spec)
+{
+  char* end;
+  long value;
+
+  if (strncmp(spec, "pc:", 3) == 0) {
+    value = strtol(spec + 3, &end, 0);
+    int index = get_code_index(value);
+    if (*end || value % 4 || index < 0 || index >= watch->pcs_size) {
+      return -1;
+    }
+    watch->pcs[index] = 1;
+  } else if (strncmp(spec, "clock:", 6) == 0) {
+    value = strtol(spec + 6, &end, 0);
+    if (*end || value < 0) {
+      return -1;
+    }
+    watch->clock = earliest(watch->clock, value);
+  } else if (strncmp(spec, "retired:", 8) == 0) {
+    value = strtol(spec + 8, &end, 0);
+    if (*end || value < 0) {
+      return -1;
+    }
+    watch->retired = earliest(watch->retired, value);
+  } else if (spec[0] == 'R' || spec[0] == 'r') {
+    value = strtol(spec + 1, &end, 10);
+    if (*end || end == spec + 1 || value < 0 || value >= 16) {
+      return -1;
+    }
+    watch->regs |= 1u << value;
+  } else if (strncmp(spec, "mem:", 4) == 0) {
+    value = strtol(spec + 4, &end, 0);
+    if (*end || value < 0 || value >= DATA_MEMORY_SIZE) {
+      return -1;
+    }
+    watch->mem[value] = 1;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Called by writeback for every instruction it completes, before the
+ * register file is updated
+ */
+void
+watch_retire(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  APEX_Watch* watch = cpu->watch;
+  int index = get_code_index(stage->pc);
+
+  if (watch->hit) {
+    return;
+  }
+  if (index >= 0 && index < watch->pcs_size && watch->pcs[index]) {
+    watch->hit = 1;
+    snprintf(watch->reason, sizeof(watch->reason),
+             "breakpoint at pc(%d) %.32s", stage->pc, stage->opcode);
+  } else if (writes_register(stage->opcode) &&
+             (watch->regs >> stage->rd & 1)) {
+    watch->hit = 1;
+    snprintf(watch->reason, sizeof(watch->reason),
+             "R%d written by pc(%d) %.32s: %d -> %d", stage->rd, stage->pc,
+             stage->opcode, cpu->regs[stage->rd], stage->buffer);
+  }
+}
+
+/*
+ * Called by every data memory write, before it is done
+ */
+void
+watch_store(APEX_CPU* cpu, int address, int value)
+{
+  APEX_Watch* watch = cpu->watch;
+
+  if (watch->hit || address < 0 || address >= DATA_MEMORY_SIZE ||
+      !watch->mem[address]) {
+    return;
+  }
+  watch->hit = 1;
+  snprintf(watch->reason, sizeof(watch->reason),
+           "MEM[%d] written by pc(%d) %.32s: %d -> %d", address,
+           cpu->stage[MEM].pc, cpu->stage[MEM].opcode,
+           cpu->port ? value : dmem_read(cpu, address), value);
+}
+
+/* Checks the breakpoints that are not tied to a pipeline event */
+static void
+check_counters(APEX_Watch* watch, APEX_CPU* cpu)
+{
+  if (watch->hit) {
+    return;
+  }
+  if (cpu->clock == watch->clock) {
+    watch->hit = 1;
+    snprintf(watch->reason, sizeof(watch->reason), "breakpoint at clock %d",
+             cpu->clock);
+  } else if (cpu->retired == watch->retired) {
+    watch->hit = 1;
+    snprintf(watch->reason, sizeof(watch->reason),
+             "breakpoint at %d instructions retired", cpu->retired);
+  }
+}
+
+/*
+ * Runs the cpu without a trace until the first hit or the end of the
+ * program. A hit takes effect at the end of the cycle it happened in:
+ * the run either stops there or continues with the trace open.
+ */
+int
+watch_simulate(APEX_CPU* cpu)
+{
+  APEX_Watch* watch = cpu->watch;
+
+  check_counters(watch, cpu);
+  while (!watch->hit && !APEX_cpu_done(cpu)) {
+    APEX_cpu_cycle(cpu);
+    check_counters(watch, cpu);
+  }
+
+  if (!watch->hit) {
+    return 0;
+  }
+
+  printf("\n(apex) >> Cycle %d: %s\n", cpu->clock, watch->reason);
+  if (watch->action == WATCH_STOP) {
+    watch->stopped = 1;
+    return 1;
+  }
+
+  cpu->trace = trace_open(stdout);
+  if (cpu->trace && cpu->host_profile) {
+    hostprof_attach_trace(cpu);
+  }
+  APEX_cpu_simulate(cpu);
+  return 1;
+}
+
+/* Returns 1 if a hit stopped the run before the program finished */
+int
+watch_stopped(APEX_CPU* cpu)
+{
+  return cpu->watch && cpu->watch->stopped;
+}
+
+void
+watch_destroy(APEX_Watch* watch)
+{
+  free(watch->pcs);
+  free(watch);
+}
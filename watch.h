@@ -0,0 +1,42 @@
+#ifndef _APEX_WATCH_H_
+#define _APEX_WATCH_H_
+/**
+ *  watch.h
+ *  Breakpoints on pc, clock or retired count and watchpoints on register
+ *  and data memory writes, checked while the cpu runs without a trace.
+ *  The first hit either stops the run or starts the trace from there.
+ */
+#include "cpu.h"
+
+/* What to do on the first hit */
+enum
+{
+  WATCH_STOP,
+  WATCH_TRACE
+};
+
+typedef struct APEX_Watch APEX_Watch;
+
+APEX_Watch*
+watch_create(APEX_CPU* cpu, int action);
+
+int
+watch_add(APEX_Watch* watch, const char* spec);
+
+int
+watch_simulate(APEX_CPU* cpu);
+
+int
+watch_stopped(APEX_CPU* cpu);
+
+void
+watch_destroy(APEX_Watch* watch);
+
+/* Hooks, called only while a watch is attached */
+void
+watch_retire(APEX_CPU* cpu, CPU_Stage* stage);
+
+void
+watch_store(APEX_CPU* cpu, int address, int value);
+
+#endif